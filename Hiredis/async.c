@@ -36,8 +36,10 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "async.h"
+#include "command.h"
 #include "net.h"
 #include "dict.c"
 #include "sds.h"
@@ -60,6 +62,8 @@
 
 /* Forward declaration of function in hiredis.c */
 int __redisAppendCommand(redisContext *c, const char *cmd, size_t len);
+int __redisBufferRead(redisContext *c, size_t *nread);
+void __redisSetError(redisContext *c, int type, const char *str);
 
 /* Functions managing dictionary of callbacks for pub/sub. */
 static unsigned int callbackHash(const void *key) {
@@ -84,6 +88,10 @@ static int callbackKeyCompare(void *privdata, const void *key1, const void *key2
     return memcmp(key1,key2,l1) == 0;
 }
 
+static int callbackKeyMatch(const void *key, const void *buf, size_t len) {
+    return sdslen((const sds)key) == len && memcmp(key,buf,len) == 0;
+}
+
 static void callbackKeyDestructor(void *privdata, void *key) {
     ((void) privdata);
     sdsfree((sds)key);
@@ -127,16 +135,37 @@ static redisAsyncContext *redisAsyncInitialize(redisContext *c) {
     ac->ev.addWrite = NULL;
     ac->ev.delWrite = NULL;
     ac->ev.cleanup = NULL;
+    ac->ev.scheduleTimer = NULL;
+    ac->ev.reattach = NULL;
 
     ac->onConnect = NULL;
     ac->onDisconnect = NULL;
 
-    ac->replies.head = NULL;
-    ac->replies.tail = NULL;
-    ac->sub.invalid.head = NULL;
-    ac->sub.invalid.tail = NULL;
+    memset(&ac->replies,0,sizeof(ac->replies));
+    memset(&ac->sub.invalid,0,sizeof(ac->sub.invalid));
     ac->sub.channels = dictCreate(&callbackDict,NULL);
     ac->sub.patterns = dictCreate(&callbackDict,NULL);
+
+    ac->timeout.connect = 0;
+    ac->timeout.command = 0;
+    ac->timeout.armed = 0;
+    ac->latency.ewma = 0;
+    ac->latency.last = 0;
+    ac->latency.replies = 0;
+    ac->timer.at = 0;
+    ac->timer.fn = NULL;
+    ac->timer.privdata = NULL;
+    ac->wstream.appended = 0;
+    ac->wstream.written = 0;
+
+    ac->readBudget.bytes = REDIS_ASYNC_READ_BUDGET;
+    ac->readBudget.replies = 0;
+    ac->batch.delay = -1;
+    ac->batch.bytes = 0;
+    ac->batch.at = 0;
+    memset(&ac->watermark,0,sizeof(ac->watermark));
+
+    memset(&ac->reconnect,0,sizeof(ac->reconnect));
     return ac;
 }
 
@@ -169,6 +198,25 @@ redisAsyncContext *redisAsyncConnect(const char *ip, int port) {
     return ac;
 }
 
+redisAsyncContext *redisAsyncConnectWithOptions(const char *ip, int port,
+                                               const redisSocketOptions *opts) {
+    redisContext *c;
+    redisAsyncContext *ac;
+
+    c = redisConnectNonBlockWithOptions(ip,port,opts);
+    if (c == NULL)
+        return NULL;
+
+    ac = redisAsyncInitialize(c);
+    if (ac == NULL) {
+        redisFree(c);
+        return NULL;
+    }
+
+    __redisAsyncCopyError(ac);
+    return ac;
+}
+
 redisAsyncContext *redisAsyncConnectBind(const char *ip, int port,
                                          const char *source_addr) {
     redisContext *c = redisConnectBindNonBlock(ip,port,source_addr);
@@ -224,43 +272,280 @@ int redisAsyncSetDisconnectCallback(redisAsyncContext *ac, redisDisconnectCallba
     return REDIS_ERR;
 }
 
-/* Helper functions to push/shift callbacks */
-static int __redisPushCallback(redisCallbackList *list, redisCallback *source) {
+/* Arm the event library timer for the given deadline, unless it is already
+ * armed to fire earlier. The timer is one-shot: redisAsyncHandleTimeout()
+ * re-arms it for the next pending deadline. */
+static void __redisAsyncArmTimer(redisAsyncContext *ac, long long deadline) {
+    struct timeval tv;
+    long long delta;
+
+    if (deadline == 0 || ac->ev.scheduleTimer == NULL)
+        return;
+    if (ac->timeout.armed != 0 && ac->timeout.armed <= deadline)
+        return;
+
+    delta = deadline - redisNowUsec();
+    if (delta < 0) delta = 0;
+    tv.tv_sec = delta / 1000000;
+    tv.tv_usec = delta % 1000000;
+
+    ac->timeout.armed = deadline;
+    ac->ev.scheduleTimer(ac->ev.data,tv);
+}
+
+static long long __redisAsyncTimevalToUsec(const struct timeval *tv) {
+    return (long long)tv->tv_sec*1000000 + tv->tv_usec;
+}
+
+int redisAsyncSetConnectTimeout(redisAsyncContext *ac, const struct timeval tv) {
+    long long usec = __redisAsyncTimevalToUsec(&tv);
+
+    if (usec < 0) return REDIS_ERR;
+    ac->reconnect.timeout = usec;
+    if (usec == 0) {
+        ac->timeout.connect = 0;
+        return REDIS_OK;
+    }
+
+    ac->timeout.connect = redisNowUsec() + usec;
+    if (!(ac->c.flags & REDIS_CONNECTED))
+        __redisAsyncArmTimer(ac,ac->timeout.connect);
+    return REDIS_OK;
+}
+
+/* Cork the writes of a batch spanning several event loop iterations. */
+int redisAsyncCork(redisAsyncContext *ac) {
+    return redisCork(&ac->c);
+}
+
+/* End the batch: what is still buffered goes out uncorked, or the data
+ * the kernel holds back is pushed out right away. */
+int redisAsyncUncork(redisAsyncContext *ac) {
+    if (redisUncork(&ac->c) != REDIS_OK)
+        return REDIS_ERR;
+    if (redisBufferPending(&ac->c) > 0)
+        _EL_ADD_WRITE(ac);
+    return REDIS_OK;
+}
+
+int redisAsyncEnableReconnect(redisAsyncContext *ac, const redisReconnectOptions *opts) {
+    long long min = REDIS_RECONNECT_MIN_DELAY*1000LL;
+    long long max = REDIS_RECONNECT_MAX_DELAY*1000LL;
+
+    if (ac->ev.scheduleTimer == NULL)
+        return REDIS_ERR;
+
+    ac->reconnect.flags = REDIS_RECONNECT_REPLAY_UNSENT;
+    ac->reconnect.max_attempts = 0;
+    ac->reconnect.limit = REDIS_RECONNECT_BUFFER_LIMIT;
+    if (opts != NULL) {
+        ac->reconnect.flags = opts->flags;
+        ac->reconnect.max_attempts = opts->max_attempts;
+        if (opts->buffer_limit) ac->reconnect.limit = opts->buffer_limit;
+        if (__redisAsyncTimevalToUsec(&opts->min_delay) > 0)
+            min = __redisAsyncTimevalToUsec(&opts->min_delay);
+        if (__redisAsyncTimevalToUsec(&opts->max_delay) > 0)
+            max = __redisAsyncTimevalToUsec(&opts->max_delay);
+    }
+    if (max < min) max = min;
+
+    ac->reconnect.min = min;
+    ac->reconnect.max = max;
+    ac->reconnect.enabled = 1;
+
+    /* Seed the jitter apart from other contexts and processes, so that
+     * those dropped in the same tick still spread out. */
+    ac->reconnect.seed = (unsigned long long)redisNowUsec() ^
+                         ((unsigned long long)getpid() << 40) ^
+                         (unsigned long long)(size_t)ac;
+    return REDIS_OK;
+}
+
+void redisAsyncSetReadBudget(redisAsyncContext *ac, size_t bytes, unsigned int replies) {
+    ac->readBudget.bytes = bytes;
+    ac->readBudget.replies = replies;
+}
+
+int redisAsyncSetWriteBatch(redisAsyncContext *ac, long long usec, size_t bytes) {
+    if (usec >= 0 && ac->ev.scheduleTimer == NULL)
+        return REDIS_ERR;
+
+    ac->batch.delay = usec < 0 ? -1 : usec;
+    ac->batch.bytes = bytes;
+
+    /* What is held back goes out with the next command, or the timer. */
+    if (usec < 0 && ac->batch.at != 0) {
+        ac->batch.at = 0;
+        if (redisBufferPending(&ac->c) > 0)
+            _EL_ADD_WRITE(ac);
+    }
+    return REDIS_OK;
+}
+
+/* Whether the context is above its high watermark, or still not under its
+ * low one after going above. The callback is told of every change. */
+static void __redisAsyncCheckWatermarks(redisAsyncContext *ac) {
+    const redisWatermarks *wm = &ac->watermark.limits;
+    size_t bytes = redisBufferPending(&ac->c);
+    int commands = ac->replies.len;
+    int above;
+
+    if (!ac->watermark.above)
+        above = (wm->high_bytes != 0 && bytes > wm->high_bytes) ||
+                (wm->high_commands != 0 && commands > wm->high_commands);
+    else
+        above = (wm->high_bytes != 0 && bytes > wm->low_bytes) ||
+                (wm->high_commands != 0 && commands > wm->low_commands);
+
+    if (above == ac->watermark.above)
+        return;
+    ac->watermark.above = above;
+    if (ac->watermark.fn)
+        ac->watermark.fn(ac,above,ac->watermark.privdata);
+}
+
+int redisAsyncSetWatermarks(redisAsyncContext *ac, const redisWatermarks *wm,
+                            redisWatermarkCallback *fn, void *privdata)
+{
+    if (wm == NULL) {
+        memset(&ac->watermark,0,sizeof(ac->watermark));
+        return REDIS_OK;
+    }
+    if ((wm->high_bytes != 0 && wm->low_bytes > wm->high_bytes) ||
+        (wm->high_commands != 0 && wm->low_commands > wm->high_commands))
+        return REDIS_ERR;
+
+    ac->watermark.limits = *wm;
+    ac->watermark.fn = fn;
+    ac->watermark.privdata = privdata;
+    __redisAsyncCheckWatermarks(ac);
+    return REDIS_OK;
+}
+
+int redisAsyncSetTimeout(redisAsyncContext *ac, const struct timeval tv) {
+    long long usec = __redisAsyncTimevalToUsec(&tv);
+
+    if (usec < 0) return REDIS_ERR;
+    ac->timeout.command = usec;
+    return REDIS_OK;
+}
+
+int redisAsyncSetTimer(redisAsyncContext *ac, long long usec, redisTimerCallback *fn, void *privdata) {
+    if (fn == NULL) {
+        ac->timer.at = 0;
+        return REDIS_OK;
+    }
+    if (usec < 0 || ac->ev.scheduleTimer == NULL)
+        return REDIS_ERR;
+
+    ac->timer.at = redisNowUsec() + usec;
+    ac->timer.fn = fn;
+    ac->timer.privdata = privdata;
+    __redisAsyncArmTimer(ac,ac->timer.at);
+    return REDIS_OK;
+}
+
+/* Move the callbacks of a list to "size" new slots, a power of two. */
+static int __redisResizeCallbacks(redisCallbackList *list, int size) {
+    redisCallback *slots;
+    int i;
+
+    slots = malloc(sizeof(*slots)*size);
+    if (slots == NULL)
+        return REDIS_ERR;
+    for (i = 0; i < list->len; i++)
+        memcpy(&slots[i],redisCallbackListAt(list,i),sizeof(*slots));
+    free(list->slots);
+    list->slots = slots;
+    list->head = 0;
+    list->size = size;
+    return REDIS_OK;
+}
+
+/* Helper functions to push/shift callbacks. A push beyond the capacity of
+ * the list is refused, one that runs out of memory sets the error. */
+static int __redisPushCallback(redisAsyncContext *ac, redisCallbackList *list, redisCallback *source) {
     redisCallback *cb;
 
-    /* Copy callback from stack to heap */
-    cb = malloc(sizeof(*cb));
-    if (cb == NULL)
-        return REDIS_ERR_OOM;
+    if (list->capacity != 0 && list->len >= list->capacity)
+        return REDIS_ERR;
+    if (list->len == list->size &&
+        __redisResizeCallbacks(list,list->size ? list->size*2 : REDIS_ASYNC_CALLBACK_SLOTS) != REDIS_OK)
+    {
+        __redisSetError(&ac->c,REDIS_ERR_OOM,"Out of memory");
+        __redisAsyncCopyError(ac);
+        return REDIS_ERR;
+    }
 
-    if (source != NULL) {
+    /* Copy callback from stack to its slot */
+    cb = redisCallbackListAt(list,list->len);
+    if (source != NULL)
         memcpy(cb,source,sizeof(*cb));
-        cb->next = NULL;
-    }
+    else
+        memset(cb,0,sizeof(*cb));
+    list->len++;
+    return REDIS_OK;
+}
 
-    /* Store callback in list */
-    if (list->head == NULL)
-        list->head = cb;
-    if (list->tail != NULL)
-        list->tail->next = cb;
-    list->tail = cb;
+/* Make room for "n" callbacks so that pushing them can't fail. */
+static int __redisReserveCallbacks(redisCallbackList *list, int n) {
+    int size = REDIS_ASYNC_CALLBACK_SLOTS;
+
+    while (size < n)
+        size *= 2;
+    if (size > list->size)
+        return __redisResizeCallbacks(list,size);
     return REDIS_OK;
 }
 
 static int __redisShiftCallback(redisCallbackList *list, redisCallback *target) {
-    redisCallback *cb = list->head;
-    if (cb != NULL) {
-        list->head = cb->next;
-        if (cb == list->tail)
-            list->tail = NULL;
-
-        /* Copy callback from heap to stack */
-        if (target != NULL)
-            memcpy(target,cb,sizeof(*cb));
-        free(cb);
-        return REDIS_OK;
+    redisCallback *cb;
+
+    if (list->len == 0)
+        return REDIS_ERR;
+    cb = &list->slots[list->head];
+    list->head = (list->head+1) & (list->size-1);
+    list->len--;
+
+    /* Copy callback from its slot to stack */
+    if (target != NULL) {
+        memcpy(target,cb,sizeof(*cb));
+        target->replay = NULL;
     }
-    return REDIS_ERR;
+    sdsfree(cb->replay);
+    return REDIS_OK;
+}
+
+/* Drop the callbacks left in a list and its slots. */
+static void __redisFreeCallbacks(redisCallbackList *list) {
+    while (__redisShiftCallback(list,NULL) == REDIS_OK);
+    free(list->slots);
+    list->slots = NULL;
+    list->head = 0;
+    list->size = 0;
+}
+
+int redisAsyncSetCallbackCapacity(redisAsyncContext *ac, int capacity) {
+    int size = REDIS_ASYNC_CALLBACK_SLOTS;
+
+    if (capacity < 0 || capacity > (1<<24))
+        return REDIS_ERR;
+    if (capacity != 0) {
+        if (capacity < ac->replies.len || capacity < ac->sub.invalid.len)
+            return REDIS_ERR;
+        while (size < capacity)
+            size *= 2;
+        if ((size > ac->replies.size && __redisResizeCallbacks(&ac->replies,size) != REDIS_OK) ||
+            (size > ac->sub.invalid.size && __redisResizeCallbacks(&ac->sub.invalid,size) != REDIS_OK))
+        {
+            __redisSetError(&ac->c,REDIS_ERR_OOM,"Out of memory");
+            __redisAsyncCopyError(ac);
+            return REDIS_ERR;
+        }
+    }
+    ac->replies.capacity = capacity;
+    ac->sub.invalid.capacity = capacity;
+    return REDIS_OK;
 }
 
 static void __redisRunCallback(redisAsyncContext *ac, redisCallback *cb, redisReply *reply) {
@@ -286,6 +571,8 @@ static void __redisAsyncFree(redisAsyncContext *ac) {
     /* Execute callbacks for invalid commands */
     while (__redisShiftCallback(&ac->sub.invalid,&cb) == REDIS_OK)
         __redisRunCallback(ac,&cb,NULL);
+    __redisFreeCallbacks(&ac->replies);
+    __redisFreeCallbacks(&ac->sub.invalid);
 
     /* Run subscription callbacks callbacks with NULL reply */
     it = dictGetIterator(ac->sub.channels);
@@ -303,9 +590,12 @@ static void __redisAsyncFree(redisAsyncContext *ac) {
     /* Signal event lib to clean up */
     _EL_CLEANUP(ac);
 
+    sdsfree(ac->reconnect.auth);
+    sdsfree(ac->reconnect.select);
+
     /* Execute disconnect callback. When redisAsyncFree() initiated destroying
      * this context, the status will always be REDIS_OK. */
-    if (ac->onDisconnect && (c->flags & REDIS_CONNECTED)) {
+    if (ac->onDisconnect && (c->flags & (REDIS_CONNECTED|REDIS_RECONNECTING))) {
         if (c->flags & REDIS_FREEING) {
             ac->onDisconnect(ac,REDIS_OK);
         } else {
@@ -328,6 +618,8 @@ void redisAsyncFree(redisAsyncContext *ac) {
         __redisAsyncFree(ac);
 }
 
+static int __redisAsyncStartReconnect(redisAsyncContext *ac);
+
 /* Helper function to make the disconnect happen and clean up. */
 static void __redisAsyncDisconnect(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
@@ -338,6 +630,10 @@ static void __redisAsyncDisconnect(redisAsyncContext *ac) {
     if (ac->err == 0) {
         /* For clean disconnects, there should be no pending callbacks. */
         assert(__redisShiftCallback(&ac->replies,NULL) == REDIS_ERR);
+    } else if (ac->reconnect.enabled && !(c->flags & (REDIS_DISCONNECTING|REDIS_FREEING))) {
+        /* The context outlives the connection. */
+        __redisAsyncStartReconnect(ac);
+        return;
     } else {
         /* Disconnection is caused by an error, make sure that pending
          * callbacks cannot call new commands. */
@@ -358,41 +654,56 @@ static void __redisAsyncDisconnect(redisAsyncContext *ac) {
 void redisAsyncDisconnect(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
     c->flags |= REDIS_DISCONNECTING;
-    if (!(c->flags & REDIS_IN_CALLBACK) && ac->replies.head == NULL)
+
+    /* Without a connection, pending commands will never get a reply. */
+    if ((c->flags & REDIS_RECONNECTING) && !(c->flags & REDIS_IN_CALLBACK)) {
+        __redisAsyncFree(ac);
+        return;
+    }
+    if (!(c->flags & REDIS_IN_CALLBACK) && ac->replies.len == 0)
         __redisAsyncDisconnect(ac);
 }
 
+/* Pub/sub replies are told apart by the length of their type and its
+ * first bytes: "message" and "pmessage" are by far the most common and
+ * need no string compare. */
+static int __redisIsUnsubscribe(const redisReply *type, int pvariant) {
+    return type->len == 11+pvariant &&
+           strncasecmp(type->str+pvariant,"unsubscribe",11) == 0;
+}
+
 static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply, redisCallback *dstcb) {
     redisContext *c = &(ac->c);
+    redisReply *type, *name;
     dict *callbacks;
     dictEntry *de;
     int pvariant;
-    char *stype;
-    sds sname;
 
     /* Custom reply functions are not supported for pub/sub. This will fail
      * very hard when they are used... */
     if (reply->type == REDIS_REPLY_ARRAY) {
         assert(reply->elements >= 2);
         assert(reply->element[0]->type == REDIS_REPLY_STRING);
-        stype = reply->element[0]->str;
-        pvariant = (tolower(stype[0]) == 'p') ? 1 : 0;
+        type = reply->element[0];
+        pvariant = type->len > 0 && (type->str[0] | 0x20) == 'p';
 
         if (pvariant)
             callbacks = ac->sub.patterns;
         else
             callbacks = ac->sub.channels;
 
-        /* Locate the right callback */
+        /* Locate the right callback, looking up the name in place. */
         assert(reply->element[1]->type == REDIS_REPLY_STRING);
-        sname = sdsnewlen(reply->element[1]->str,reply->element[1]->len);
-        de = dictFind(callbacks,sname);
+        name = reply->element[1];
+        de = dictFindBuffer(callbacks,
+                            dictGenHashFunction((const unsigned char*)name->str,name->len),
+                            name->str,name->len,callbackKeyMatch);
         if (de != NULL) {
             memcpy(dstcb,dictGetEntryVal(de),sizeof(*dstcb));
 
             /* If this is an unsubscribe message, remove it. */
-            if (strcasecmp(stype+pvariant,"unsubscribe") == 0) {
-                dictDelete(callbacks,sname);
+            if (__redisIsUnsubscribe(type,pvariant)) {
+                dictDelete(callbacks,dictGetEntryKey(de));
 
                 /* If this was the last unsubscribe message, revert to
                  * non-subscribe mode. */
@@ -401,7 +712,6 @@ static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
                     c->flags &= ~REDIS_SUBSCRIBED;
             }
         }
-        sdsfree(sname);
     } else {
         /* Shift callback for invalid commands. */
         __redisShiftCallback(&ac->sub.invalid,dstcb);
@@ -409,24 +719,37 @@ static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
     return REDIS_OK;
 }
 
-void redisProcessCallbacks(redisAsyncContext *ac) {
+static void __redisAsyncAddLatency(redisAsyncContext *ac, long long now, long long usec) {
+    ac->latency.last = now;
+    if (ac->latency.replies++ == 0)
+        ac->latency.ewma = usec;
+    else
+        ac->latency.ewma += (usec-ac->latency.ewma)/REDIS_ASYNC_LATENCY_WEIGHT;
+}
+
+/* Execute the callbacks for the replies available in the reader. Returns
+ * REDIS_ERR when the context was disconnected or free'd in the process and
+ * must not be touched anymore. Handled replies are counted in *nreplies. */
+static int __redisProcessCallbacks(redisAsyncContext *ac, unsigned int *nreplies) {
     redisContext *c = &(ac->c);
-    redisCallback cb = {NULL, NULL, NULL};
+    redisCallback cb;
     void *reply = NULL;
     int status;
 
+    memset(&cb,0,sizeof(cb));
+
     while((status = redisGetReply(c,&reply)) == REDIS_OK) {
         if (reply == NULL) {
             /* When the connection is being disconnected and there are
              * no more replies, this is the cue to really disconnect. */
-            if (c->flags & REDIS_DISCONNECTING && sdslen(c->obuf) == 0) {
+            if (c->flags & REDIS_DISCONNECTING && redisBufferPending(c) == 0) {
                 __redisAsyncDisconnect(ac);
-                return;
+                return REDIS_ERR;
             }
 
             /* If monitor mode, repush callback */
             if(c->flags & REDIS_MONITORING) {
-                __redisPushCallback(&ac->replies,&cb);
+                __redisPushCallback(ac,&ac->replies,&cb);
             }
 
             /* When the connection is not being disconnected, simply stop
@@ -434,9 +757,16 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
             break;
         }
 
+        if (nreplies != NULL) (*nreplies)++;
+
         /* Even if the context is subscribed, pending regular callbacks will
          * get a reply before pub/sub messages arrive. */
-        if (__redisShiftCallback(&ac->replies,&cb) != REDIS_OK) {
+        if (__redisShiftCallback(&ac->replies,&cb) == REDIS_OK) {
+            if (cb.issued != 0) {
+                long long now = redisNowUsec();
+                __redisAsyncAddLatency(ac,now,now-cb.issued);
+            }
+        } else {
             /*
              * A spontaneous reply in a not-subscribed context can be the error
              * reply that is sent when a new connection exceeds the maximum
@@ -457,7 +787,7 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
                 snprintf(c->errstr,sizeof(c->errstr),"%s",((redisReply*)reply)->str);
                 c->reader->fn->freeObject(reply);
                 __redisAsyncDisconnect(ac);
-                return;
+                return REDIS_ERR;
             }
             /* No more regular callbacks and no errors, the context *must* be subscribed or monitoring. */
             assert((c->flags & REDIS_SUBSCRIBED || c->flags & REDIS_MONITORING));
@@ -472,7 +802,7 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
             /* Proceed with free'ing when redisAsyncFree() was called. */
             if (c->flags & REDIS_FREEING) {
                 __redisAsyncFree(ac);
-                return;
+                return REDIS_ERR;
             }
         } else {
             /* No callback for this reply. This can either be a NULL callback,
@@ -484,13 +814,47 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
     }
 
     /* Disconnect when there was an error reading the reply */
-    if (status != REDIS_OK)
+    if (status != REDIS_OK) {
         __redisAsyncDisconnect(ac);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+void redisProcessCallbacks(redisAsyncContext *ac) {
+    __redisProcessCallbacks(ac,NULL);
+}
+
+/* Step the connect race and move the event library over to the attempt it
+ * is to watch next. Without the ev.reattach hook the event library can't
+ * move, so only the first address is tried. */
+static int __redisAsyncStepRace(redisAsyncContext *ac, int failed) {
+    redisContext *c = &(ac->c);
+    int fd = c->fd, oldfd;
+
+    if (ac->ev.reattach == NULL) {
+        redisContextFreeRace(c);
+        return REDIS_ERR;
+    }
+    if (redisContextRaceStep(c,failed,&oldfd) != REDIS_OK)
+        return REDIS_ERR;
+
+    c->err = 0;
+    c->errstr[0] = '\0';
+    if (c->fd != fd) {
+        ac->ev.reattach(ac->ev.data);
+        _EL_ADD_WRITE(ac);
+    }
+    if (oldfd != -1)
+        close(oldfd);
+    __redisAsyncArmTimer(ac,c->race.at);
+    return REDIS_OK;
 }
 
 /* Internal helper function to detect socket status the first time a read or
- * write event fires. When connecting was not succesful, the connect callback
- * is called with a REDIS_ERR status and the context is free'd. */
+ * write event fires. When connecting was not succesful, the next address of
+ * the race is tried; when there is none, the connect callback is called
+ * with a REDIS_ERR status and the context is free'd. */
 static int __redisAsyncHandleConnect(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
 
@@ -499,22 +863,490 @@ static int __redisAsyncHandleConnect(redisAsyncContext *ac) {
         if (errno == EINPROGRESS)
             return REDIS_OK;
 
+        if (c->race.addrs != NULL && __redisAsyncStepRace(ac,1) == REDIS_OK)
+            return REDIS_OK;
+
         if (ac->onConnect) ac->onConnect(ac,REDIS_ERR);
         __redisAsyncDisconnect(ac);
         return REDIS_ERR;
     }
 
     /* Mark context as connected. */
+    redisContextFreeRace(c);
     c->flags |= REDIS_CONNECTED;
+    c->flags &= ~REDIS_RECONNECTING;
+    ac->timeout.connect = 0;
+    ac->reconnect.attempts = 0;
+    ac->reconnect.delay = 0;
     if (ac->onConnect) ac->onConnect(ac,REDIS_OK);
     return REDIS_OK;
 }
 
+/* Remove an unsent command from the output buffer. Offsets of the commands
+ * following it in the reply list are moved back accordingly. */
+static void __redisAsyncShedCommand(redisAsyncContext *ac, int i) {
+    redisContext *c = &(ac->c);
+    redisCallback *cb = redisCallbackListAt(&ac->replies,i);
+    size_t pos = (size_t)(cb->offset - ac->wstream.written -
+                          (redisBufferPending(c) - sdslen(c->obuf)));
+    size_t tail = sdslen(c->obuf) - pos - cb->len;
+
+    memmove(c->obuf+pos,c->obuf+pos+cb->len,tail);
+    sdsIncrLen(c->obuf,-(int)cb->len);
+    ac->wstream.appended -= cb->len;
+
+    for (i++; i < ac->replies.len; i++)
+        redisCallbackListAt(&ac->replies,i)->offset -= cb->len;
+}
+
+/* Keep the commands that change the state of the connection, to issue
+ * them again on the next connection. */
+static void __redisAsyncRemember(redisAsyncContext *ac, const char *name, size_t namelen,
+                                 const char *cmd, size_t len)
+{
+    if (namelen == 4 && strncasecmp(name,"auth",4) == 0) {
+        sdsfree(ac->reconnect.auth);
+        ac->reconnect.auth = sdsnewlen(cmd,len);
+    } else if (namelen == 6 && strncasecmp(name,"select",6) == 0) {
+        sdsfree(ac->reconnect.select);
+        ac->reconnect.select = sdsnewlen(cmd,len);
+    }
+}
+
+/* Append a command without callback to a rebuilt output buffer. */
+static void __redisAsyncPushPreamble(redisAsyncContext *ac, redisCallbackList *list, sds *obuf,
+                                     const char *cmd, size_t len)
+{
+    redisCallback cb;
+
+    memset(&cb,0,sizeof(cb));
+    cb.offset = sdslen(*obuf);
+    cb.len = len;
+    *obuf = sdscatlen(*obuf,cmd,len);
+    __redisPushCallback(ac,list,&cb);
+}
+
+/* Append a command naming every channel or pattern of a dict again, or
+ * only those being left. */
+static sds __redisAsyncResubscribe(sds obuf, dict *callbacks, const char *cmd, int leaving) {
+    dictIterator *it;
+    dictEntry *de;
+    const char **argv;
+    size_t *argvlen;
+    sds formatted;
+    int argc = 0;
+
+    if (dictSize(callbacks) == 0)
+        return obuf;
+
+    argv = malloc(sizeof(char*)*(dictSize(callbacks)+1));
+    argvlen = malloc(sizeof(size_t)*(dictSize(callbacks)+1));
+    if (argv != NULL && argvlen != NULL) {
+        argv[argc] = cmd;
+        argvlen[argc++] = strlen(cmd);
+        it = dictGetIterator(callbacks);
+        while ((de = dictNext(it)) != NULL) {
+            if (leaving && !((redisCallback*)dictGetEntryVal(de))->leaving)
+                continue;
+            argv[argc] = dictGetEntryKey(de);
+            argvlen[argc++] = sdslen((sds)dictGetEntryKey(de));
+        }
+        dictReleaseIterator(it);
+
+        if (argc > 1 && redisFormatSdsCommandArgv(&formatted,argc,argv,argvlen) > 0) {
+            obuf = sdscatsds(obuf,formatted);
+            sdsfree(formatted);
+        }
+    }
+    free(argv);
+    free(argvlen);
+    return obuf;
+}
+
+/* Rebuild the output buffer for the next connection: the last AUTH and
+ * SELECT first, the commands sent again next, then the subscriptions.
+ * Callbacks of commands that can't be sent again are moved to "failed".
+ * Returns REDIS_ERR with the error set when out of memory; nothing is
+ * changed then. */
+static int __redisAsyncRebuild(redisAsyncContext *ac, redisCallbackList *failed) {
+    redisContext *c = &(ac->c);
+    redisCallbackList kept = {NULL, 0, 0, 0, 0};
+    unsigned long long written = ac->wstream.written;
+    redisCallbackList *list;
+    redisCallback *p;
+    redisReader *reader;
+    const char *bytes;
+    sds unsent, obuf;
+    int i;
+
+    /* The next connection starts with a fresh reader set up like this one. */
+    reader = redisReaderCreateWithFunctions(c->reader->fn);
+    if (reader == NULL) {
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    reader->maxbuf = c->reader->maxbuf;
+    reader->privdata = c->reader->privdata;
+
+    /* Room for every callback up front, so none is lost half way. */
+    if (__redisReserveCallbacks(&kept,ac->replies.len+2) != REDIS_OK ||
+        __redisReserveCallbacks(failed,ac->replies.len+ac->sub.invalid.len) != REDIS_OK)
+    {
+        free(kept.slots);
+        redisReaderFree(reader);
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+
+    /* Bytes not written yet, starting at stream offset "written". */
+    unsent = sdsempty();
+    if (c->zerocopy.cur != NULL)
+        unsent = sdscatlen(unsent,c->zerocopy.cur+c->zerocopy.pos,
+                           sdslen(c->zerocopy.cur)-c->zerocopy.pos);
+    unsent = sdscatlen(unsent,c->obuf,sdslen(c->obuf));
+
+    obuf = sdsempty();
+    if (ac->reconnect.auth != NULL)
+        __redisAsyncPushPreamble(ac,&kept,&obuf,ac->reconnect.auth,sdslen(ac->reconnect.auth));
+    if (ac->reconnect.select != NULL)
+        __redisAsyncPushPreamble(ac,&kept,&obuf,ac->reconnect.select,sdslen(ac->reconnect.select));
+
+    for (i = 0; i < ac->replies.len; i++) {
+        p = redisCallbackListAt(&ac->replies,i);
+        if (p->offset >= written && (ac->reconnect.flags & REDIS_RECONNECT_REPLAY_UNSENT))
+            bytes = unsent+(p->offset-written);
+        else if (p->offset < written && p->replay != NULL)
+            bytes = p->replay;
+        else
+            bytes = NULL;
+
+        if (bytes != NULL) {
+            p->offset = sdslen(obuf);
+            obuf = sdscatlen(obuf,bytes,p->len);
+            list = &kept;
+        } else {
+            list = failed;
+        }
+        __redisPushCallback(ac,list,p);
+    }
+    kept.capacity = ac->replies.capacity;
+    free(ac->replies.slots);
+    ac->replies = kept;
+
+    /* Commands issued while subscribed only get an error reply. */
+    for (i = 0; i < ac->sub.invalid.len; i++)
+        __redisPushCallback(ac,failed,redisCallbackListAt(&ac->sub.invalid,i));
+    ac->sub.invalid.head = 0;
+    ac->sub.invalid.len = 0;
+
+    obuf = __redisAsyncResubscribe(obuf,ac->sub.channels,"SUBSCRIBE",0);
+    obuf = __redisAsyncResubscribe(obuf,ac->sub.patterns,"PSUBSCRIBE",0);
+
+    /* An UNSUBSCRIBE has no callback to be sent again with, and may not
+     * have made it out: send it again for what is still being left. */
+    obuf = __redisAsyncResubscribe(obuf,ac->sub.channels,"UNSUBSCRIBE",1);
+    obuf = __redisAsyncResubscribe(obuf,ac->sub.patterns,"PUNSUBSCRIBE",1);
+    if (dictSize(ac->sub.channels) + dictSize(ac->sub.patterns) > 0)
+        c->flags |= REDIS_SUBSCRIBED;
+    else
+        c->flags &= ~REDIS_SUBSCRIBED;
+
+    redisContextFreeZeroCopy(c);
+    sdsfree(c->obuf);
+    sdsfree(unsent);
+    c->obuf = obuf;
+    redisReaderFree(c->reader);
+    c->reader = reader;
+    ac->wstream.written = 0;
+    ac->wstream.appended = sdslen(obuf);
+    return REDIS_OK;
+}
+
+/* Next number of the context's backoff jitter generator (splitmix64). */
+static unsigned long long __redisAsyncRandom(redisAsyncContext *ac) {
+    unsigned long long z = (ac->reconnect.seed += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Keep the context when its connection is lost and schedule the next
+ * attempt. When the connection was up, commands that can't be sent again
+ * get a NULL reply with the error visible. Returns REDIS_ERR when giving
+ * up or when asked to go away; the context is free'd then. */
+static int __redisAsyncStartReconnect(redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+    redisCallbackList failed = {NULL, 0, 0, 0, 0};
+    redisCallback cb;
+    long long now = redisNowUsec(), delay;
+
+    _EL_DEL_READ(ac);
+    _EL_DEL_WRITE(ac);
+    redisContextFreeRace(c);
+
+    if ((c->flags & (REDIS_DISCONNECTING|REDIS_FREEING)) ||
+        (ac->reconnect.max_attempts && ac->reconnect.attempts >= ac->reconnect.max_attempts))
+    {
+        c->flags |= REDIS_DISCONNECTING;
+        __redisAsyncFree(ac);
+        return REDIS_ERR;
+    }
+
+    if ((c->flags & REDIS_CONNECTED) && __redisAsyncRebuild(ac,&failed) != REDIS_OK) {
+        /* Give up as if reconnecting was off: pending callbacks get a NULL
+         * reply with the error visible. */
+        __redisAsyncCopyError(ac);
+        c->flags |= REDIS_DISCONNECTING;
+        __redisAsyncFree(ac);
+        return REDIS_ERR;
+    }
+    c->flags &= ~(REDIS_CONNECTED|REDIS_MONITORING|REDIS_CORKED|REDIS_CORK_PENDING);
+    c->flags |= REDIS_RECONNECTING;
+
+    /* Exponential backoff, with the delay picked at random in its upper
+     * half so clients dropped together don't come back together. */
+    delay = ac->reconnect.delay ? ac->reconnect.delay*2 : ac->reconnect.min;
+    if (delay > ac->reconnect.max)
+        delay = ac->reconnect.max;
+    ac->reconnect.delay = delay;
+    ac->reconnect.attempts++;
+    ac->reconnect.at = now + delay/2 +
+        (long long)(__redisAsyncRandom(ac) % (unsigned long long)(delay/2+1));
+    ac->timeout.connect = 0;
+    __redisAsyncArmTimer(ac,ac->reconnect.at);
+
+    while (__redisShiftCallback(&failed,&cb) == REDIS_OK) {
+        __redisRunCallback(ac,&cb,NULL);
+
+        /* Proceed with free'ing when asked to from the callback. */
+        if (c->flags & (REDIS_FREEING|REDIS_DISCONNECTING)) {
+            while (__redisShiftCallback(&failed,&cb) == REDIS_OK)
+                __redisRunCallback(ac,&cb,NULL);
+            __redisFreeCallbacks(&failed);
+            __redisAsyncFree(ac);
+            return REDIS_ERR;
+        }
+    }
+    __redisFreeCallbacks(&failed);
+
+    c->err = 0;
+    c->errstr[0] = '\0';
+    __redisAsyncCopyError(ac);
+    return REDIS_OK;
+}
+
+/* Make the next connection attempt. The old socket is kept until one
+ * succeeds, then the event library moves over to the new one through the
+ * ev.reattach hook. Returns REDIS_ERR when the context was free'd. */
+static int __redisAsyncReconnect(redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+    int fd = c->fd, status;
+
+    ac->reconnect.at = 0;
+    c->fd = -1;
+    if (c->connection_type == REDIS_CONN_TCP)
+        status = redisContextConnectBindTcp(c,c->tcp.host,c->tcp.port,c->timeout,
+                                            c->tcp.source_addr);
+    else
+        status = redisContextConnectUnix(c,c->unix_sock.path,c->timeout);
+
+    if (status == REDIS_OK && fd != -1) {
+        if (ac->ev.reattach)
+            ac->ev.reattach(ac->ev.data);
+        close(fd);
+    } else if (c->fd == -1) {
+        c->fd = fd;
+    }
+
+    if (status != REDIS_OK) {
+        __redisAsyncCopyError(ac);
+        c->flags |= REDIS_IN_CALLBACK;
+        if (ac->onConnect) ac->onConnect(ac,REDIS_ERR);
+        c->flags &= ~REDIS_IN_CALLBACK;
+        return __redisAsyncStartReconnect(ac);
+    }
+
+    /* Connected for real once the socket turns writable. */
+    c->flags &= ~REDIS_CONNECTED;
+    if (c->zerocopy.threshold)
+        redisContextEnableZeroCopy(c);
+    if (ac->reconnect.timeout != 0) {
+        ac->timeout.connect = redisNowUsec() + ac->reconnect.timeout;
+        __redisAsyncArmTimer(ac,ac->timeout.connect);
+    }
+    __redisAsyncArmTimer(ac,c->race.at);
+
+    _EL_ADD_WRITE(ac);
+    return REDIS_OK;
+}
+
+/* Run the callback of an expired command with a NULL reply. The timeout
+ * error is only visible in the context for the duration of the callback,
+ * since the connection itself is still usable. */
+static void __redisAsyncRunTimedOut(redisAsyncContext *ac, redisCallback *cb) {
+    redisContext *c = &(ac->c);
+
+    __redisSetError(c,REDIS_ERR_TIMEOUT,"Command timed out");
+    __redisAsyncCopyError(ac);
+    __redisRunCallback(ac,cb,NULL);
+    c->err = 0;
+    c->errstr[0] = '\0';
+    __redisAsyncCopyError(ac);
+}
+
+/* This function should be called by the event library when the timer armed
+ * through ev.scheduleTimer fires.
+ *
+ * When the connection is not established before its deadline, the connect
+ * callback is called with REDIS_ERR and the context is free'd. Expired
+ * commands that are still in the output buffer are shed: they are removed
+ * from the buffer and their callbacks get a NULL reply. When a command that
+ * was already written expires, the connection is dropped, because replies
+ * following the missing one can't be matched to their callbacks. It also
+ * makes the next attempt when reconnecting. */
+void redisAsyncHandleTimeout(redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+    redisCallbackList shed = {NULL, 0, 0, 0, 0};
+    redisCallback cb, *p;
+    long long now = redisNowUsec();
+    long long earliest = 0;
+    unsigned long long sheddable;
+    int i, j;
+
+    ac->timeout.armed = 0;
+    if (c->flags & REDIS_FREEING)
+        return;
+
+    if (ac->timer.at != 0 && ac->timer.at <= now) {
+        ac->timer.at = 0;
+        c->flags |= REDIS_IN_CALLBACK;
+        ac->timer.fn(ac,ac->timer.privdata);
+        c->flags &= ~REDIS_IN_CALLBACK;
+
+        /* Proceed with free'ing when redisAsyncFree() was called. */
+        if (c->flags & REDIS_FREEING) {
+            __redisAsyncFree(ac);
+            return;
+        }
+    }
+
+    /* Writes held back for a batch are due. */
+    if (ac->batch.at != 0 && ac->batch.at <= now) {
+        ac->batch.at = 0;
+        if (redisBufferPending(c) > 0)
+            _EL_ADD_WRITE(ac);
+    }
+
+    if (ac->reconnect.at != 0 && ac->reconnect.at <= now) {
+        if (__redisAsyncReconnect(ac) != REDIS_OK)
+            return;
+    }
+
+    if (!(c->flags & REDIS_CONNECTED)) {
+        if (c->race.at != 0 && c->race.at <= now)
+            __redisAsyncStepRace(ac,0);
+        if (ac->timeout.connect != 0 && ac->timeout.connect <= now) {
+            __redisSetError(c,REDIS_ERR_TIMEOUT,"Connection timed out");
+            if (ac->onConnect) ac->onConnect(ac,REDIS_ERR);
+            __redisAsyncDisconnect(ac);
+            return;
+        }
+        earliest = ac->reconnect.at ? ac->reconnect.at : ac->timeout.connect;
+        if (c->race.at != 0 && (earliest == 0 || c->race.at < earliest))
+            earliest = c->race.at;
+    }
+
+    /* A written command without a reply in time takes the connection down,
+     * failing every pending callback. */
+    for (i = 0; i < ac->replies.len; i++) {
+        p = redisCallbackListAt(&ac->replies,i);
+        if (p->offset >= ac->wstream.written)
+            break;
+        if (p->deadline != 0 && p->deadline <= now) {
+            __redisSetError(c,REDIS_ERR_TIMEOUT,"Command timed out");
+            __redisAsyncDisconnect(ac);
+            return;
+        }
+    }
+
+    /* Move expired unsent commands to a list of their own, so callbacks
+     * issuing new commands don't interfere with the walk. The callbacks
+     * kept are packed towards the head. Commands in a buffer handed to a
+     * zero-copy send can't be taken back. */
+    sheddable = ac->wstream.written + redisBufferPending(c) - sdslen(c->obuf);
+    for (i = 0, j = 0; i < ac->replies.len; i++) {
+        p = redisCallbackListAt(&ac->replies,i);
+        if (p->deadline == 0 || p->deadline > now || p->offset < sheddable) {
+            if (p->deadline != 0 && (earliest == 0 || p->deadline < earliest))
+                earliest = p->deadline;
+            if (j != i)
+                memcpy(redisCallbackListAt(&ac->replies,j),p,sizeof(*p));
+            j++;
+            continue;
+        }
+
+        /* Without room to move it, the command stays until the next one. */
+        if (__redisPushCallback(ac,&shed,p) != REDIS_OK) {
+            if (j != i)
+                memcpy(redisCallbackListAt(&ac->replies,j),p,sizeof(*p));
+            j++;
+            continue;
+        }
+        __redisAsyncShedCommand(ac,i);
+    }
+    ac->replies.len = j;
+
+    while (__redisShiftCallback(&shed,&cb) == REDIS_OK) {
+        __redisAsyncRunTimedOut(ac,&cb);
+
+        /* Proceed with free'ing when redisAsyncFree() was called. */
+        if (c->flags & REDIS_FREEING) {
+            while (__redisShiftCallback(&shed,&cb) == REDIS_OK)
+                __redisRunCallback(ac,&cb,NULL);
+            __redisFreeCallbacks(&shed);
+            __redisAsyncFree(ac);
+            return;
+        }
+    }
+    __redisFreeCallbacks(&shed);
+
+    /* Nothing left to send, stop waiting for the socket to be writable. */
+    if (redisBufferPending(c) == 0 && (c->flags & REDIS_CONNECTED)) {
+        _EL_DEL_WRITE(ac);
+
+        /* Shedding may have removed the last thing a clean disconnect
+         * was waiting for. */
+        if (c->flags & REDIS_DISCONNECTING && ac->replies.len == 0) {
+            __redisAsyncDisconnect(ac);
+            return;
+        }
+    }
+
+    /* Callbacks may have issued commands with an earlier deadline. */
+    if (ac->timer.at != 0 && (earliest == 0 || ac->timer.at < earliest))
+        earliest = ac->timer.at;
+    if (ac->batch.at != 0 && (earliest == 0 || ac->batch.at < earliest))
+        earliest = ac->batch.at;
+    __redisAsyncArmTimer(ac,earliest);
+    __redisAsyncCheckWatermarks(ac);
+}
+
 /* This function should be called when the socket is readable.
  * It processes all replies that can be read and executes their callbacks.
+ * Reading goes on until the socket is drained or the read budget is used
+ * up, in which case the event library reports the socket readable again.
  */
 void redisAsyncHandleRead(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
+    unsigned int nreplies = 0;
+    size_t total = 0, nread;
+
+    /* The old socket, waiting for the next reconnect attempt. */
+    if (ac->reconnect.at != 0) {
+        _EL_DEL_READ(ac);
+        return;
+    }
 
     if (!(c->flags & REDIS_CONNECTED)) {
         /* Abort connect was not successful. */
@@ -525,19 +1357,43 @@ void redisAsyncHandleRead(redisAsyncContext *ac) {
             return;
     }
 
-    if (redisBufferRead(c) == REDIS_ERR) {
+    if (redisHandleZeroCopy(c) == REDIS_ERR) {
         __redisAsyncDisconnect(ac);
-    } else {
-        /* Always re-schedule reads */
-        _EL_ADD_READ(ac);
-        redisProcessCallbacks(ac);
+        return;
     }
+
+    /* Always re-schedule reads */
+    _EL_ADD_READ(ac);
+
+    do {
+        if (__redisBufferRead(c,&nread) == REDIS_ERR) {
+            __redisAsyncDisconnect(ac);
+            return;
+        }
+        if (__redisProcessCallbacks(ac,&nreplies) != REDIS_OK)
+            return;
+        total += nread;
+
+        /* A short read means the socket is drained for now. */
+        if (nread < REDIS_READ_CHUNK)
+            break;
+    } while (total < ac->readBudget.bytes &&
+             (ac->readBudget.replies == 0 || nreplies < ac->readBudget.replies));
+
+    __redisAsyncCheckWatermarks(ac);
 }
 
 void redisAsyncHandleWrite(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
+    size_t pending;
     int done = 0;
 
+    /* The old socket, waiting for the next reconnect attempt. */
+    if (ac->reconnect.at != 0) {
+        _EL_DEL_WRITE(ac);
+        return;
+    }
+
     if (!(c->flags & REDIS_CONNECTED)) {
         /* Abort connect was not successful. */
         if (__redisAsyncHandleConnect(ac) != REDIS_OK)
@@ -547,9 +1403,12 @@ void redisAsyncHandleWrite(redisAsyncContext *ac) {
             return;
     }
 
+    pending = redisBufferPending(c);
     if (redisBufferWrite(c,&done) == REDIS_ERR) {
         __redisAsyncDisconnect(ac);
     } else {
+        ac->wstream.written += pending - redisBufferPending(c);
+
         /* Continue writing when not done, stop writing otherwise */
         if (!done)
             _EL_ADD_WRITE(ac);
@@ -558,6 +1417,7 @@ void redisAsyncHandleWrite(redisAsyncContext *ac) {
 
         /* Always schedule reads after writes */
         _EL_ADD_READ(ac);
+        __redisAsyncCheckWatermarks(ac);
     }
 }
 
@@ -577,15 +1437,61 @@ static const char *nextArgument(const char *start, const char **str, size_t *len
     return p+2+(*len)+2;
 }
 
+/* Schedule the write of what was appended to the output buffer. While
+ * batching, the first command of a batch sets the time it goes out at and
+ * the following ones ride along, until the buffer holds enough to send. */
+static void __redisAsyncScheduleWrite(redisAsyncContext *ac) {
+    redisContext *c = &(ac->c);
+
+    if (ac->batch.delay < 0 || !(c->flags & REDIS_CONNECTED) ||
+        (ac->batch.bytes != 0 && redisBufferPending(c) >= ac->batch.bytes))
+    {
+        ac->batch.at = 0;
+        _EL_ADD_WRITE(ac);
+        if (!(c->flags & REDIS_CONNECTED))
+            __redisAsyncArmTimer(ac,c->race.at);
+        return;
+    }
+    if (ac->batch.at == 0) {
+        ac->batch.at = redisNowUsec() + ac->batch.delay;
+        __redisAsyncArmTimer(ac,ac->batch.at);
+    }
+}
+
 /* Helper function for the redisAsyncCommand* family of functions. Writes a
  * formatted command to the output buffer and registers the provided callback
  * function with the context. */
+/* Mark the channels or patterns named by the arguments at "p" as being
+ * left, or all of them when "p" is NULL. */
+static void __redisAsyncMarkLeaving(dict *callbacks, const char *p) {
+    dictIterator *it;
+    dictEntry *de;
+    const char *astr;
+    size_t alen;
+
+    if (p == NULL) {
+        it = dictGetIterator(callbacks);
+        while ((de = dictNext(it)) != NULL)
+            ((redisCallback*)dictGetEntryVal(de))->leaving = 1;
+        dictReleaseIterator(it);
+        return;
+    }
+    while ((p = nextArgument(p,&astr,&alen)) != NULL) {
+        de = dictFindBuffer(callbacks,dictGenHashFunction((const unsigned char*)astr,alen),
+                            astr,alen,callbackKeyMatch);
+        if (de != NULL)
+            ((redisCallback*)dictGetEntryVal(de))->leaving = 1;
+    }
+}
+
 static int __redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len) {
     redisContext *c = &(ac->c);
     redisCallback cb;
-    int pvariant, hasnext;
-    const char *cstr, *astr;
-    size_t clen, alen;
+    const redisCommandInfo *info;
+    int pvariant, hasnext, flags;
+    dict *callbacks;
+    const char *cstr, *astr, *name;
+    size_t clen, alen, namelen;
     const char *p;
     sds sname;
     int ret;
@@ -593,57 +1499,101 @@ static int __redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void
     /* Don't accept new commands when the connection is about to be closed. */
     if (c->flags & (REDIS_DISCONNECTING | REDIS_FREEING)) return REDIS_ERR;
 
+    /* Flow control asks the caller to hold the command back. */
+    if (ac->watermark.above && (ac->watermark.limits.flags & REDIS_WATERMARK_REFUSE))
+        return REDIS_WOULDBLOCK;
+
+    /* While reconnecting, commands are buffered up to a limit. */
+    if ((c->flags & REDIS_RECONNECTING) && redisBufferPending(c)+len > ac->reconnect.limit)
+        return REDIS_ERR;
+
     /* Setup callback */
     cb.fn = fn;
     cb.privdata = privdata;
+    cb.deadline = 0;
+    cb.issued = 0;
+    cb.offset = ac->wstream.appended;
+    cb.len = len;
+    cb.replay = NULL;
+    cb.leaving = 0;
 
     /* Find out which command will be appended. */
     p = nextArgument(cmd,&cstr,&clen);
     assert(p != NULL);
     hasnext = (p[0] == '$');
+    name = cstr;
+    namelen = clen;
+    if (ac->reconnect.enabled)
+        __redisAsyncRemember(ac,name,namelen,cmd,len);
+    info = redisCommandLookup(name,namelen);
+    flags = info != NULL ? info->flags : 0;
     pvariant = (tolower(cstr[0]) == 'p') ? 1 : 0;
-    cstr += pvariant;
-    clen -= pvariant;
 
-    if (hasnext && strncasecmp(cstr,"subscribe\r\n",11) == 0) {
+    if (hasnext && (flags & REDIS_CMD_SUBSCRIBE)) {
         c->flags |= REDIS_SUBSCRIBED;
+        callbacks = pvariant ? ac->sub.patterns : ac->sub.channels;
 
-        /* Add every channel/pattern to the list of subscription callbacks. */
+        /* Make room for every channel/pattern of the command at once, then
+         * add them to the list of subscription callbacks. */
+        if (cmd[0] == '*')
+            dictReserve(callbacks,strtoul(cmd+1,NULL,10)-1);
         while ((p = nextArgument(p,&astr,&alen)) != NULL) {
             sname = sdsnewlen(astr,alen);
-            if (pvariant)
-                ret = dictReplace(ac->sub.patterns,sname,&cb);
-            else
-                ret = dictReplace(ac->sub.channels,sname,&cb);
-
+            ret = dictReplace(callbacks,sname,&cb);
             if (ret == 0) sdsfree(sname);
         }
-    } else if (strncasecmp(cstr,"unsubscribe\r\n",13) == 0) {
+    } else if (flags & REDIS_CMD_UNSUBSCRIBE) {
         /* It is only useful to call (P)UNSUBSCRIBE when the context is
          * subscribed to one or more channels or patterns. */
         if (!(c->flags & REDIS_SUBSCRIBED)) return REDIS_ERR;
 
+        /* Mark what is being left, so a reconnect before the server
+         * confirms it sends the UNSUBSCRIBE again. */
+        callbacks = pvariant ? ac->sub.patterns : ac->sub.channels;
+        __redisAsyncMarkLeaving(callbacks,hasnext ? p : NULL);
+
         /* (P)UNSUBSCRIBE does not have its own response: every channel or
          * pattern that is unsubscribed will receive a message. This means we
          * should not append a callback function for this command. */
-     } else if(strncasecmp(cstr,"monitor\r\n",9) == 0) {
+     } else if (flags & REDIS_CMD_MONITOR) {
          /* Set monitor flag and push callback */
+         if (__redisPushCallback(ac,&ac->replies,&cb) != REDIS_OK)
+             return REDIS_ERR;
          c->flags |= REDIS_MONITORING;
-         __redisPushCallback(&ac->replies,&cb);
     } else {
-        if (c->flags & REDIS_SUBSCRIBED)
+        if (c->flags & REDIS_SUBSCRIBED) {
             /* This will likely result in an error reply, but it needs to be
              * received and passed to the callback. */
-            __redisPushCallback(&ac->sub.invalid,&cb);
-        else
-            __redisPushCallback(&ac->replies,&cb);
+            if (__redisPushCallback(ac,&ac->sub.invalid,&cb) != REDIS_OK)
+                return REDIS_ERR;
+        } else {
+            cb.issued = redisNowUsec();
+            if (ac->timeout.command != 0)
+                cb.deadline = cb.issued + ac->timeout.command;
+            /* Keep a copy of commands that are safe to send again when
+             * the connection is lost before their reply arrives. */
+            if (ac->reconnect.enabled &&
+                (ac->reconnect.flags & REDIS_RECONNECT_REPLAY_IDEMPOTENT) &&
+                (flags & REDIS_CMD_READONLY))
+                cb.replay = sdsnewlen(cmd,len);
+            if (__redisPushCallback(ac,&ac->replies,&cb) != REDIS_OK) {
+                sdsfree(cb.replay);
+                return REDIS_ERR;
+            }
+            __redisAsyncArmTimer(ac,cb.deadline);
+        }
     }
 
     __redisAppendCommand(c,cmd,len);
+    ac->wstream.appended += len;
 
-    /* Always schedule a write when the write buffer is non-empty */
-    _EL_ADD_WRITE(ac);
+    /* Always schedule a write when the write buffer is non-empty, unless
+     * there is no connection to write to until the next reconnect attempt,
+     * or the write is held back for a batch. */
+    if (ac->reconnect.at == 0)
+        __redisAsyncScheduleWrite(ac);
 
+    __redisAsyncCheckWatermarks(ac);
     return REDIS_OK;
 }
 
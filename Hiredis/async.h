@@ -37,25 +37,92 @@
 extern "C" {
 #endif
 
+/* Default number of bytes consumed for a single read event. */
+#define REDIS_ASYNC_READ_BUDGET (256*1024)
+
+/* Weight of the reply latency moving average: every reply moves it by
+ * 1/REDIS_ASYNC_LATENCY_WEIGHT of the difference. */
+#define REDIS_ASYNC_LATENCY_WEIGHT 8
+
+/* Slots a callback list starts with. */
+#define REDIS_ASYNC_CALLBACK_SLOTS 16
+
+/* Reconnect defaults: backoff bounds in msec and bytes of commands accepted
+ * while the connection is down. */
+#define REDIS_RECONNECT_MIN_DELAY 100
+#define REDIS_RECONNECT_MAX_DELAY 10000
+#define REDIS_RECONNECT_BUFFER_LIMIT (1024*1024)
+
+/* What to send again once reconnected. Commands that can't be sent again
+ * get a NULL reply. */
+#define REDIS_RECONNECT_REPLAY_UNSENT 0x1 /* commands that weren't written yet */
+#define REDIS_RECONNECT_REPLAY_IDEMPOTENT 0x2 /* read-only commands without reply */
+
+/* Flow control: commands are refused while above the high watermark,
+ * instead of being buffered. */
+#define REDIS_WATERMARK_REFUSE 0x1
+
+/* Returned by the command functions instead of REDIS_ERR when a command is
+ * refused by flow control, see redisAsyncSetWatermarks(). */
+#define REDIS_WOULDBLOCK -2
+
 struct redisAsyncContext; /* need forward declaration of redisAsyncContext */
 struct dict; /* dictionary header is included in async.c */
 
 /* Reply callback prototype and container */
 typedef void (redisCallbackFn)(struct redisAsyncContext*, void*, void*);
 typedef struct redisCallback {
-    struct redisCallback *next; /* simple singly linked list */
     redisCallbackFn *fn;
     void *privdata;
+    long long deadline; /* monotonic usec when the command expires, 0 if never */
+    long long issued; /* monotonic usec the command was issued at */
+    unsigned long long offset; /* position of the command in the output stream */
+    size_t len; /* length of the formatted command */
+    char *replay; /* copy of the command to send again after a reconnect, sds */
+    int leaving; /* subscription with an UNSUBSCRIBE on its way */
 } redisCallback;
 
-/* List of callbacks for either regular replies or pub/sub */
+/* List of callbacks for either regular replies or pub/sub: a ring of
+ * callbacks stored inline, growing by doubling. */
 typedef struct redisCallbackList {
-    redisCallback *head, *tail;
+    redisCallback *slots;
+    int head; /* slot of the first callback */
+    int len; /* number of callbacks in the list */
+    int size; /* number of slots, a power of two */
+    int capacity; /* callbacks accepted at most, 0 for no limit */
 } redisCallbackList;
 
+/* The i-th callback of a list, counting from its head. */
+#define redisCallbackListAt(list,i) \
+    (&(list)->slots[((list)->head+(i)) & ((list)->size-1)])
+
+/* Options for redisAsyncEnableReconnect(). */
+typedef struct redisReconnectOptions {
+    int flags; /* REDIS_RECONNECT_REPLAY_* */
+    struct timeval min_delay; /* delay before the first attempt */
+    struct timeval max_delay; /* the delay doubles up to this after every failure */
+    int max_attempts; /* failed attempts in a row before giving up, 0 for no limit */
+    size_t buffer_limit; /* bytes of commands accepted while reconnecting */
+} redisReconnectOptions;
+
+/* Options for redisAsyncSetWatermarks(). A context goes above its high
+ * watermark when either limit is exceeded, and back under its low one
+ * once neither is. */
+typedef struct redisWatermarks {
+    int flags; /* REDIS_WATERMARK_REFUSE */
+    size_t high_bytes, low_bytes; /* output buffered, 0 for no limit */
+    int high_commands, low_commands; /* commands without a reply yet, 0 for no limit */
+} redisWatermarks;
+
+/* Called when a context goes above its high watermark, with "above" set,
+ * and when it is back under its low one. It may issue commands, but not
+ * free or disconnect the context. */
+typedef void (redisWatermarkCallback)(struct redisAsyncContext*, int above, void *privdata);
+
 /* Connection callback prototypes */
 typedef void (redisDisconnectCallback)(const struct redisAsyncContext*, int status);
 typedef void (redisConnectCallback)(const struct redisAsyncContext*, int status);
+typedef void (redisTimerCallback)(struct redisAsyncContext*, void *privdata);
 
 /* Context for an async connection to Redis */
 typedef struct redisAsyncContext {
@@ -80,6 +147,18 @@ typedef struct redisAsyncContext {
         void (*addWrite)(void *privdata);
         void (*delWrite)(void *privdata);
         void (*cleanup)(void *privdata);
+
+        /* Hook that is called to (re)arm a one-shot timer firing after the
+         * given interval. The event library should then call
+         * redisAsyncHandleTimeout(). Optional: without it timeouts are not
+         * enforced. */
+        void (*scheduleTimer)(void *privdata, struct timeval tv);
+
+        /* Hook that is called when reconnecting replaced the socket: the
+         * event library should stop watching the old descriptor, still open
+         * during the call, and watch c.fd instead. Optional for libraries
+         * that pick up c.fd every time they wait. */
+        void (*reattach)(void *privdata);
     } ev;
 
     /* Called when either the connection is terminated due to an error or per
@@ -98,22 +177,140 @@ typedef struct redisAsyncContext {
         struct dict *channels;
         struct dict *patterns;
     } sub;
+
+    /* Timeouts. Deadlines are monotonic usec, 0 meaning none. */
+    struct {
+        long long connect; /* deadline for the connection to be established */
+        long long command; /* timeout in usec given to new commands */
+        long long armed; /* deadline the event library timer is armed for */
+    } timeout;
+
+    /* Reply latency, from the moment a command is issued until its reply
+     * is read: a moving average in usec, 0 until the first reply. */
+    struct {
+        long long ewma;
+        long long last; /* monotonic usec of the last reply */
+        unsigned long long replies;
+    } latency;
+
+    /* One-shot timer for the layers built on top, see redisAsyncSetTimer(). */
+    struct {
+        long long at; /* monotonic usec, 0 when not set */
+        redisTimerCallback *fn;
+        void *privdata;
+    } timer;
+
+    /* Total bytes appended to and written from the output buffer. Commands
+     * with an offset past "written" did not reach the socket yet. */
+    struct {
+        unsigned long long appended;
+        unsigned long long written;
+    } wstream;
+
+    /* Work done for a single read event at most, so one busy connection
+     * can't starve the others sharing the event loop. */
+    struct {
+        size_t bytes; /* 0 reads only once per event */
+        unsigned int replies; /* 0 for no limit */
+    } readBudget;
+
+    /* Writes held back, so commands issued close together go out in one
+     * write, see redisAsyncSetWriteBatch(). */
+    struct {
+        long long delay; /* usec, -1 when writes aren't held back */
+        size_t bytes; /* buffered bytes sent right away, 0 for no limit */
+        long long at; /* monotonic usec held back writes go out, 0 if none */
+    } batch;
+
+    /* Flow control, see redisAsyncSetWatermarks(). */
+    struct {
+        redisWatermarks limits;
+        int above; /* went above the high watermark, not yet under the low one */
+        redisWatermarkCallback *fn;
+        void *privdata;
+    } watermark;
+
+    /* Automatic reconnect. Backoff is in usec. */
+    struct {
+        int enabled;
+        int flags; /* REDIS_RECONNECT_REPLAY_* */
+        long long min, max;
+        long long delay; /* last backoff, 0 after a successful connect */
+        long long at; /* monotonic usec of the next attempt, 0 if none is due */
+        long long timeout; /* connect timeout given to every attempt */
+        int attempts, max_attempts;
+        size_t limit;
+        char *auth, *select; /* last AUTH and SELECT issued, formatted (sds) */
+        unsigned long long seed; /* state of the backoff jitter generator */
+    } reconnect;
 } redisAsyncContext;
 
 /* Functions that proxy to hiredis */
 redisAsyncContext *redisAsyncConnect(const char *ip, int port);
+redisAsyncContext *redisAsyncConnectWithOptions(const char *ip, int port,
+                                               const redisSocketOptions *opts);
 redisAsyncContext *redisAsyncConnectBind(const char *ip, int port, const char *source_addr);
 redisAsyncContext *redisAsyncConnectBindWithReuse(const char *ip, int port,
                                                   const char *source_addr);
 redisAsyncContext *redisAsyncConnectUnix(const char *path);
 int redisAsyncSetConnectCallback(redisAsyncContext *ac, redisConnectCallback *fn);
 int redisAsyncSetDisconnectCallback(redisAsyncContext *ac, redisDisconnectCallback *fn);
+
+/* Timeouts. The connect timeout counts from the moment it is set, the
+ * command timeout applies to every command issued after it is set. A zero
+ * timeval disables the timeout. Both require the ev.scheduleTimer hook. */
+int redisAsyncSetConnectTimeout(redisAsyncContext *ac, const struct timeval tv);
+int redisAsyncSetTimeout(redisAsyncContext *ac, const struct timeval tv);
+
+/* Call "fn" once, "usec" from now, replacing the timer set before. It runs
+ * from redisAsyncHandleTimeout() and may issue commands. A NULL "fn"
+ * cancels the timer. Requires the ev.scheduleTimer hook. */
+int redisAsyncSetTimer(redisAsyncContext *ac, long long usec, redisTimerCallback *fn, void *privdata);
+
+/* Reconnect when the connection is lost, instead of failing every pending
+ * command and free'ing the context. Attempts are made with an exponential,
+ * jittered backoff and reported to the connect callback; the disconnect
+ * callback is only called when giving up. Once connected again, the last
+ * AUTH and SELECT are issued again and every channel and pattern is
+ * subscribed to again. Commands issued in the meantime are buffered.
+ * Requires the ev.scheduleTimer hook. NULL options use the defaults. */
+int redisAsyncEnableReconnect(redisAsyncContext *ac, const redisReconnectOptions *opts);
+
+/* Cork writes until redisAsyncUncork(), see redisCork(). */
+int redisAsyncCork(redisAsyncContext *ac);
+int redisAsyncUncork(redisAsyncContext *ac);
+
+/* Read budget. A read event stops reading once "bytes" bytes were read or
+ * "replies" replies were handled, whichever comes first. */
+void redisAsyncSetReadBudget(redisAsyncContext *ac, size_t bytes, unsigned int replies);
+
+/* Write batching. The write for a command is held back for "usec", so the
+ * commands issued meanwhile go out with it, as an implicit pipeline. 0
+ * holds it until the event loop is done with the current iteration. Once
+ * "bytes" are buffered they are sent right away, 0 for no limit. A
+ * negative "usec" sends every command right away again, the default.
+ * Requires the ev.scheduleTimer hook. */
+int redisAsyncSetWriteBatch(redisAsyncContext *ac, long long usec, size_t bytes);
+
+/* Watermarks on the output buffered and the commands waiting for a reply.
+ * "fn" is told when they are crossed, so producers can pause and resume.
+ * With REDIS_WATERMARK_REFUSE, commands are also refused with
+ * REDIS_WOULDBLOCK while above. NULL watermarks remove them. Returns
+ * REDIS_ERR when a low watermark is above its high one. */
+int redisAsyncSetWatermarks(redisAsyncContext *ac, const redisWatermarks *wm,
+                            redisWatermarkCallback *fn, void *privdata);
+
+/* Room for pending callbacks. The lists are allocated for "capacity"
+ * callbacks up front and commands beyond it are refused, so a deep
+ * pipeline never reallocates. 0 lets the lists grow as needed. */
+int redisAsyncSetCallbackCapacity(redisAsyncContext *ac, int capacity);
 void redisAsyncDisconnect(redisAsyncContext *ac);
 void redisAsyncFree(redisAsyncContext *ac);
 
 /* Handle read/write events */
 void redisAsyncHandleRead(redisAsyncContext *ac);
 void redisAsyncHandleWrite(redisAsyncContext *ac);
+void redisAsyncHandleTimeout(redisAsyncContext *ac);
 
 /* Command functions for an async context. Write the command to the
  * output buffer and register the provided callback. */
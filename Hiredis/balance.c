@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+
+#include "balance.h"
+#include "net.h"
+
+void redisBalancerInit(redisBalancer *b) {
+    b->seed = (unsigned int)redisNowUsec() | 1;
+    b->check = 0;
+    b->typical = 0;
+}
+
+/* xorshift32, good enough to spread the choices. */
+static unsigned int __redisBalanceRandom(redisBalancer *b) {
+    unsigned int x = b->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return b->seed = x;
+}
+
+long long redisBalanceLatency(const redisAsyncContext *ac, long long now) {
+    long long latency = ac->latency.ewma, wait, halvings;
+    const redisCallback *first;
+
+    if (ac->replies.len == 0) {
+        halvings = (now-ac->latency.last)/(REDIS_BALANCE_IDLE_DECAY*1000LL);
+        return halvings < 63 ? latency >> halvings : 0;
+    }
+
+    /* A connection that stopped answering has no new replies to tell. */
+    first = redisCallbackListAt(&ac->replies,0);
+    if (first->issued != 0) {
+        wait = now-first->issued;
+        if (wait > latency)
+            latency = wait;
+    }
+    return latency;
+}
+
+double redisBalanceScore(const redisBalancer *b, const redisAsyncContext *ac, long long now) {
+    long long latency = redisBalanceLatency(ac,now);
+
+    if (latency == 0)
+        latency = b->typical;
+    return (double)(latency+1)*(ac->replies.len+1);
+}
+
+/* Take back the endpoints whose time is up, and eject those whose latency
+ * spiked. */
+static void __redisBalancerCheck(redisBalancer *b, void *ctx, int n, redisBalanceGetFn *get, long long now) {
+    redisBalanceEndpoint *ep;
+    redisAsyncContext *ac;
+    long long sum = 0, latency;
+    int i, count = 0, total = 0, ejected = 0;
+
+    b->check = now+REDIS_BALANCE_CHECK_INTERVAL*1000LL;
+    for (i = 0; i < n; i++) {
+        if ((ac = get(ctx,i,&ep)) == NULL)
+            continue;
+        total++;
+        if (ep->ejected != 0 && ep->ejected <= now) {
+            ep->ejected = 0;
+            ac->latency.ewma = 0;
+            ac->latency.replies = 0;
+        }
+        if (ep->ejected != 0) {
+            ejected++;
+            continue;
+        }
+        if ((latency = redisBalanceLatency(ac,now)) > 0) {
+            sum += latency;
+            count++;
+        }
+    }
+    b->typical = count > 0 ? sum/count : 0;
+    if (count < 2)
+        return;
+
+    for (i = 0; i < n && (ejected+1)*2 <= total; i++) {
+        if ((ac = get(ctx,i,&ep)) == NULL || ep->ejected != 0)
+            continue;
+        latency = redisBalanceLatency(ac,now);
+        if (latency > REDIS_BALANCE_EJECT_MIN &&
+            latency > REDIS_BALANCE_EJECT_FACTOR*((sum-latency)/(count-1)))
+        {
+            ep->ejected = now+REDIS_BALANCE_EJECT_TIME*1000LL;
+            ep->ejections++;
+            ejected++;
+        }
+    }
+}
+
+int redisBalancerPick(redisBalancer *b, void *ctx, int n, redisBalanceGetFn *get) {
+    redisBalanceEndpoint *ep, *chosen[2] = {NULL, NULL};
+    redisAsyncContext *ac, *conns[2] = {NULL, NULL};
+    long long now = redisNowUsec();
+    int i, j, k, m = 0, usable = 0, all, pick[2], index[2] = {-1, -1};
+
+    if (b->check <= now)
+        __redisBalancerCheck(b,ctx,n,get,now);
+
+    for (i = 0; i < n; i++) {
+        if ((ac = get(ctx,i,&ep)) == NULL)
+            continue;
+        usable++;
+        if (ep->ejected == 0)
+            m++;
+    }
+    if (usable == 0)
+        return -1;
+
+    /* The endpoints usable now may all be ejected ones. */
+    all = (m == 0);
+    if (all)
+        m = usable;
+
+    pick[0] = __redisBalanceRandom(b) % m;
+    pick[1] = pick[0];
+    if (m > 1) {
+        pick[1] = __redisBalanceRandom(b) % (m-1);
+        if (pick[1] >= pick[0])
+            pick[1]++;
+    }
+
+    for (i = 0, k = 0; i < n; i++) {
+        if ((ac = get(ctx,i,&ep)) == NULL || (!all && ep->ejected != 0))
+            continue;
+        for (j = 0; j < 2; j++) {
+            if (pick[j] != k)
+                continue;
+            index[j] = i;
+            conns[j] = ac;
+            chosen[j] = ep;
+        }
+        k++;
+    }
+
+    k = redisBalanceScore(b,conns[1],now) < redisBalanceScore(b,conns[0],now);
+    chosen[k]->picks++;
+    return index[k];
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_BALANCE_H
+#define __HIREDIS_BALANCE_H
+#include "async.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* An endpoint is ejected when its latency is REDIS_BALANCE_EJECT_FACTOR
+ * times the average of the others, and above REDIS_BALANCE_EJECT_MIN usec.
+ * It is back after REDIS_BALANCE_EJECT_TIME msec, with its latency
+ * measured anew. At most half of the endpoints are ejected at a time. */
+#define REDIS_BALANCE_EJECT_FACTOR 4
+#define REDIS_BALANCE_EJECT_MIN 1000
+#define REDIS_BALANCE_EJECT_TIME 5000
+
+/* Msec a connection with nothing pending takes to see its latency halved,
+ * so one that fell behind gets commands again to measure it anew. */
+#define REDIS_BALANCE_IDLE_DECAY 1000
+
+/* Msec between two checks for endpoints to eject or take back. */
+#define REDIS_BALANCE_CHECK_INTERVAL 100
+
+/* Balancing state of an endpoint, kept by its owner next to the
+ * connection. */
+typedef struct redisBalanceEndpoint {
+    long long ejected; /* monotonic usec the endpoint is back at, 0 if in use */
+    unsigned int ejections;
+    unsigned long long picks;
+} redisBalanceEndpoint;
+
+/* Hook giving the connection and balancing state of the endpoint at
+ * "i", or NULL when it can't take commands now. */
+typedef redisAsyncContext *(redisBalanceGetFn)(void *ctx, int i, redisBalanceEndpoint **ep);
+
+typedef struct redisBalancer {
+    unsigned int seed;
+    long long check; /* monotonic usec of the next ejection check */
+    long long typical; /* average latency of the endpoints in use */
+} redisBalancer;
+
+void redisBalancerInit(redisBalancer *b);
+
+/* Pick one of "n" endpoints: the least loaded of two taken at random
+ * among those not ejected. Returns the index, or -1 when none is usable. */
+int redisBalancerPick(redisBalancer *b, void *ctx, int n, redisBalanceGetFn *get);
+
+/* The latency of a connection: the moving average of its replies, decaying
+ * while it is idle, or how long its oldest pending reply has been waiting
+ * when that is longer. */
+long long redisBalanceLatency(const redisAsyncContext *ac, long long now);
+
+/* The score endpoints are compared by, lower is better: the latency times
+ * the commands in flight plus one. Endpoints without a latency yet count
+ * as typical. For debugging, along with the redisBalanceEndpoint fields. */
+double redisBalanceScore(const redisBalancer *b, const redisAsyncContext *ac, long long now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
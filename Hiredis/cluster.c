@@ -0,0 +1,511 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "cluster.h"
+#include "scatter.h"
+
+/* Set while redisClusterDisconnect() walks the nodes, so the context isn't
+ * free'd under its feet. */
+#define REDIS_CLUSTER_IN_DISCONNECT 0x4
+
+/* A command on its way, sent again when redirected. */
+typedef struct redisClusterRequest {
+    redisClusterContext *cc;
+    redisCallbackFn *fn;
+    void *privdata;
+    sds cmd;
+    int redirects;
+} redisClusterRequest;
+
+/* CRC16 (XMODEM), as used by Redis Cluster for key hash slots. */
+static const unsigned short __redisClusterCrc16Table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
+};
+
+static unsigned short __redisClusterCrc16(const char *buf, size_t len) {
+    unsigned short crc = 0;
+    while (len--)
+        crc = (crc<<8) ^ __redisClusterCrc16Table[((crc>>8) ^ (unsigned char)*buf++) & 0xff];
+    return crc;
+}
+
+unsigned int redisClusterKeySlot(const char *key, size_t len) {
+    redisKeyHashTag(&key,&len);
+    return __redisClusterCrc16(key,len) & (REDIS_CLUSTER_SLOTS-1);
+}
+
+static unsigned int __redisClusterRoute(void *ctx, const char *key, size_t len) {
+    ((void)ctx);
+    return redisClusterKeySlot(key,len);
+}
+
+static void __redisClusterFreeNode(redisClusterNode *node) {
+    free(node->host);
+    free(node);
+}
+
+static void __redisClusterFreeStorage(redisClusterContext *cc) {
+    redisClusterNode *node;
+
+    while ((node = cc->nodes) != NULL) {
+        cc->nodes = node->next;
+        __redisClusterFreeNode(node);
+    }
+    free(cc->slots);
+    free(cc);
+}
+
+/* Free the context once redisClusterDisconnect() closed every node. */
+static void __redisClusterCheckGone(redisClusterContext *cc) {
+    redisClusterNode *node;
+
+    if (!(cc->flags & REDIS_CLUSTER_DISCONNECTING) || (cc->flags & REDIS_CLUSTER_IN_DISCONNECT))
+        return;
+    for (node = cc->nodes; node != NULL; node = node->next)
+        if (node->ac != NULL)
+            return;
+    __redisClusterFreeStorage(cc);
+}
+
+static void __redisClusterRefresh(redisClusterContext *cc, redisClusterNode *node);
+
+static void __redisClusterOnConnect(const redisAsyncContext *ac, int status) {
+    redisClusterNode *node = ac->data;
+
+    if (status == REDIS_OK || node == NULL)
+        return;
+
+    /* The context is free'd after this callback, connect again on use. */
+    node->ac = NULL;
+    __redisClusterCheckGone(node->cc);
+}
+
+static void __redisClusterOnDisconnect(const redisAsyncContext *ac, int status) {
+    redisClusterNode *node = ac->data;
+    redisClusterContext *cc;
+
+    if (node == NULL)
+        return;
+
+    cc = node->cc;
+    node->ac = NULL;
+    if (cc->flags & REDIS_CLUSTER_DISCONNECTING) {
+        __redisClusterCheckGone(cc);
+        return;
+    }
+
+    /* A lost node may mean a failover, see what the others say. */
+    if (status != REDIS_OK)
+        __redisClusterRefresh(cc,NULL);
+}
+
+static int __redisClusterConnectNode(redisClusterNode *node) {
+    redisAsyncContext *ac;
+
+    ac = redisAsyncConnect(node->host,node->port);
+    if (ac == NULL)
+        return REDIS_ERR;
+
+    if (ac->err || node->cc->attach(ac,node->cc->attachdata) != REDIS_OK) {
+        redisAsyncFree(ac);
+        return REDIS_ERR;
+    }
+
+    ac->data = node;
+    redisAsyncSetConnectCallback(ac,__redisClusterOnConnect);
+    redisAsyncSetDisconnectCallback(ac,__redisClusterOnDisconnect);
+    node->ac = ac;
+    return REDIS_OK;
+}
+
+static redisClusterNode *__redisClusterGetNode(redisClusterContext *cc, const char *host, size_t hostlen, int port) {
+    redisClusterNode *node;
+
+    for (node = cc->nodes; node != NULL; node = node->next)
+        if (node->port == port && strlen(node->host) == hostlen &&
+            memcmp(node->host,host,hostlen) == 0)
+            return node;
+
+    node = calloc(1,sizeof(*node));
+    if (node == NULL)
+        return NULL;
+    node->host = malloc(hostlen+1);
+    if (node->host == NULL) {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->host,host,hostlen);
+    node->host[hostlen] = '\0';
+    node->port = port;
+    node->cc = cc;
+    node->next = cc->nodes;
+    cc->nodes = node;
+    return node;
+}
+
+/* A node for commands without a slot owner, connected ones first. */
+static redisClusterNode *__redisClusterAnyNode(redisClusterContext *cc) {
+    redisClusterNode *node, *any = NULL;
+
+    for (node = cc->nodes; node != NULL; node = node->next) {
+        if (node->ac != NULL && (node->ac->c.flags & REDIS_CONNECTED))
+            return node;
+        if (any == NULL || (any->ac == NULL && node->ac != NULL))
+            any = node;
+    }
+    return any;
+}
+
+static int __redisClusterUsable(redisClusterNode *node) {
+    if (node->ac == NULL && __redisClusterConnectNode(node) != REDIS_OK)
+        return 0;
+    return !(node->ac->c.flags & (REDIS_DISCONNECTING|REDIS_FREEING));
+}
+
+/* Replace the slot map with a CLUSTER SLOTS reply. Every entry reads
+ * start, end, then the primary as host, port and id, then the replicas. */
+static void __redisClusterOnSlots(redisAsyncContext *ac, void *r, void *privdata) {
+    redisClusterContext *cc = privdata;
+    redisClusterNode *from = ac->data, *node, **prev;
+    redisReply *reply = r, *range, *primary;
+    const char *host;
+    size_t i, hostlen;
+    long long s;
+
+    cc->refreshing = 0;
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements == 0 ||
+        (cc->flags & (REDIS_CLUSTER_DISCONNECTING|REDIS_CLUSTER_FREEING)))
+        return;
+
+    memset(cc->slots,0,sizeof(redisClusterNode*)*REDIS_CLUSTER_SLOTS);
+    for (i = 0; i < reply->elements; i++) {
+        range = reply->element[i];
+        if (range->type != REDIS_REPLY_ARRAY || range->elements < 3)
+            continue;
+        primary = range->element[2];
+        if (range->element[0]->type != REDIS_REPLY_INTEGER ||
+            range->element[1]->type != REDIS_REPLY_INTEGER ||
+            primary->type != REDIS_REPLY_ARRAY || primary->elements < 2 ||
+            primary->element[0]->type != REDIS_REPLY_STRING ||
+            primary->element[1]->type != REDIS_REPLY_INTEGER)
+            continue;
+
+        /* An empty host is the host of the node that replied. */
+        host = primary->element[0]->str;
+        hostlen = primary->element[0]->len;
+        if (hostlen == 0 && from != NULL) {
+            host = from->host;
+            hostlen = strlen(host);
+        }
+        node = __redisClusterGetNode(cc,host,hostlen,(int)primary->element[1]->integer);
+        if (node == NULL)
+            continue;
+
+        for (s = range->element[0]->integer; s <= range->element[1]->integer; s++)
+            if (s >= 0 && s < REDIS_CLUSTER_SLOTS)
+                cc->slots[s] = node;
+    }
+
+    /* Forget nodes that serve nothing anymore and aren't connected. */
+    for (node = cc->nodes; node != NULL; node = node->next)
+        node->nslots = 0;
+    for (s = 0; s < REDIS_CLUSTER_SLOTS; s++)
+        if (cc->slots[s] != NULL)
+            cc->slots[s]->nslots++;
+    prev = &cc->nodes;
+    while ((node = *prev) != NULL) {
+        if (node->nslots == 0 && node->ac == NULL) {
+            *prev = node->next;
+            __redisClusterFreeNode(node);
+        } else {
+            prev = &node->next;
+        }
+    }
+}
+
+/* Load the slot map again, from "node" or any node. Only one load is in
+ * flight at a time. */
+static void __redisClusterRefresh(redisClusterContext *cc, redisClusterNode *node) {
+    if (cc->refreshing || (cc->flags & (REDIS_CLUSTER_DISCONNECTING|REDIS_CLUSTER_FREEING)))
+        return;
+    if (node == NULL && (node = __redisClusterAnyNode(cc)) == NULL)
+        return;
+    if (!__redisClusterUsable(node))
+        return;
+    if (redisAsyncCommand(node->ac,__redisClusterOnSlots,cc,"CLUSTER SLOTS") == REDIS_OK)
+        cc->refreshing = 1;
+}
+
+static void __redisClusterOnReply(redisAsyncContext *ac, void *r, void *privdata);
+
+static int __redisClusterSendTo(redisClusterNode *node, redisClusterRequest *req, int asking) {
+    if (!__redisClusterUsable(node))
+        return REDIS_ERR;
+    if (asking && redisAsyncCommand(node->ac,NULL,NULL,"ASKING") != REDIS_OK)
+        return REDIS_ERR;
+    return redisAsyncFormattedCommand(node->ac,__redisClusterOnReply,req,req->cmd,sdslen(req->cmd));
+}
+
+/* Follow a "MOVED <slot> <host>:<port>" or "ASK <slot> <host>:<port>"
+ * error. Returns REDIS_OK when the command was sent again. */
+static int __redisClusterRedirect(redisClusterContext *cc, redisAsyncContext *ac,
+                                  redisClusterRequest *req, const redisReply *reply)
+{
+    redisClusterNode *from = ac->data, *node;
+    const char *p, *host, *colon;
+    char *end;
+    long slot, port;
+    int moved;
+
+    if (reply->len > 6 && memcmp(reply->str,"MOVED ",6) == 0)
+        moved = 1;
+    else if (reply->len > 4 && memcmp(reply->str,"ASK ",4) == 0)
+        moved = 0;
+    else
+        return REDIS_ERR;
+
+    p = reply->str + (moved ? 6 : 4);
+    slot = strtol(p,&end,10);
+    if (end == p || *end != ' ' || slot < 0 || slot >= REDIS_CLUSTER_SLOTS)
+        return REDIS_ERR;
+    host = end+1;
+    if ((colon = strrchr(host,':')) == NULL)
+        return REDIS_ERR;
+    port = strtol(colon+1,&end,10);
+    if (end == colon+1 || port <= 0 || port > 65535)
+        return REDIS_ERR;
+
+    /* An empty host is the host of the node that replied. */
+    if (colon == host && from != NULL)
+        node = __redisClusterGetNode(cc,from->host,strlen(from->host),(int)port);
+    else
+        node = __redisClusterGetNode(cc,host,colon-host,(int)port);
+    if (node == NULL)
+        return REDIS_ERR;
+
+    /* The map is loaded again when it turns out to be stale, not for
+     * commands sent before the last load. */
+    if (moved && cc->slots[slot] != node) {
+        cc->slots[slot] = node;
+        __redisClusterRefresh(cc,from);
+    }
+    req->redirects++;
+    return __redisClusterSendTo(node,req,!moved);
+}
+
+static void __redisClusterOnReply(redisAsyncContext *ac, void *r, void *privdata) {
+    redisClusterRequest *req = privdata;
+    redisClusterContext *cc = req->cc;
+    redisReply *reply = r;
+
+    if (reply != NULL && reply->type == REDIS_REPLY_ERROR &&
+        req->redirects < REDIS_CLUSTER_MAX_REDIRECTS &&
+        !(cc->flags & (REDIS_CLUSTER_DISCONNECTING|REDIS_CLUSTER_FREEING)) &&
+        __redisClusterRedirect(cc,ac,req,reply) == REDIS_OK)
+        return;
+
+    if (req->fn != NULL)
+        req->fn(ac,r,req->privdata);
+    sdsfree(req->cmd);
+    free(req);
+}
+
+redisClusterContext *redisClusterConnect(const char *ip, int port,
+                                         redisClusterAttachCallback *attach, void *privdata)
+{
+    redisClusterContext *cc;
+    redisClusterNode *node;
+
+    if (attach == NULL)
+        return NULL;
+
+    cc = calloc(1,sizeof(*cc));
+    if (cc == NULL)
+        return NULL;
+
+    cc->attach = attach;
+    cc->attachdata = privdata;
+    cc->slots = calloc(REDIS_CLUSTER_SLOTS,sizeof(redisClusterNode*));
+    if (cc->slots == NULL || (node = __redisClusterGetNode(cc,ip,strlen(ip),port)) == NULL) {
+        __redisClusterFreeStorage(cc);
+        return NULL;
+    }
+
+    /* The map is loaded once the node is connected. */
+    __redisClusterRefresh(cc,node);
+    return cc;
+}
+
+void redisClusterDisconnect(redisClusterContext *cc) {
+    redisClusterNode *node;
+    redisAsyncContext *ac;
+
+    cc->flags |= REDIS_CLUSTER_DISCONNECTING|REDIS_CLUSTER_IN_DISCONNECT;
+    for (node = cc->nodes; node != NULL; node = node->next) {
+        if ((ac = node->ac) == NULL)
+            continue;
+
+        /* A context that never connected is free'd without telling. */
+        if (!(ac->c.flags & REDIS_CONNECTED) && ac->replies.len == 0) {
+            node->ac = NULL;
+            ac->data = NULL;
+            redisAsyncFree(ac);
+        } else {
+            redisAsyncDisconnect(ac);
+        }
+    }
+    cc->flags &= ~REDIS_CLUSTER_IN_DISCONNECT;
+    __redisClusterCheckGone(cc);
+}
+
+void redisClusterFree(redisClusterContext *cc) {
+    redisClusterNode *node;
+    redisAsyncContext *ac;
+
+    cc->flags |= REDIS_CLUSTER_FREEING;
+    for (node = cc->nodes; node != NULL; node = node->next) {
+        if ((ac = node->ac) == NULL)
+            continue;
+        node->ac = NULL;
+        ac->data = NULL;
+        redisAsyncFree(ac);
+    }
+    __redisClusterFreeStorage(cc);
+}
+
+/* Send a command to the node serving the slot of its key. */
+static int __redisClusterSend(void *ctx, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len) {
+    redisClusterContext *cc = ctx;
+    redisClusterRequest *req;
+    redisClusterNode *node = NULL;
+    const char *key;
+    size_t keylen;
+
+    if (redisFormattedCommandKey(cmd,len,&key,&keylen))
+        node = cc->slots[redisClusterKeySlot(key,keylen)];
+    if (node == NULL && (node = __redisClusterAnyNode(cc)) == NULL)
+        return REDIS_ERR;
+
+    req = malloc(sizeof(*req));
+    if (req == NULL)
+        return REDIS_ERR;
+    req->cc = cc;
+    req->fn = fn;
+    req->privdata = privdata;
+    req->redirects = 0;
+    req->cmd = sdsnewlen(cmd,len);
+    if (req->cmd == NULL || __redisClusterSendTo(node,req,0) != REDIS_OK) {
+        sdsfree(req->cmd);
+        free(req);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+int redisClusterFormattedCommand(redisClusterContext *cc, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len) {
+    int status;
+
+    if (cc->flags & (REDIS_CLUSTER_DISCONNECTING|REDIS_CLUSTER_FREEING))
+        return REDIS_ERR;
+    if (redisScatterCommand(cc,__redisClusterRoute,__redisClusterSend,fn,privdata,cmd,len,&status))
+        return status;
+    return __redisClusterSend(cc,fn,privdata,cmd,len);
+}
+
+int redisvClusterCommand(redisClusterContext *cc, redisCallbackFn *fn, void *privdata, const char *format, va_list ap) {
+    char *cmd;
+    int len;
+    int status;
+    len = redisvFormatCommand(&cmd,format,ap);
+
+    /* We don't want to pass -1 or -2 to future functions as a length. */
+    if (len < 0)
+        return REDIS_ERR;
+
+    status = redisClusterFormattedCommand(cc,fn,privdata,cmd,len);
+    free(cmd);
+    return status;
+}
+
+int redisClusterCommand(redisClusterContext *cc, redisCallbackFn *fn, void *privdata, const char *format, ...) {
+    va_list ap;
+    int status;
+    va_start(ap,format);
+    status = redisvClusterCommand(cc,fn,privdata,format,ap);
+    va_end(ap);
+    return status;
+}
+
+int redisClusterCommandArgv(redisClusterContext *cc, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen) {
+    sds cmd;
+    int len;
+    int status;
+    len = redisFormatSdsCommandArgv(&cmd,argc,argv,argvlen);
+    if (len < 0)
+        return REDIS_ERR;
+    status = redisClusterFormattedCommand(cc,fn,privdata,cmd,len);
+    sdsfree(cmd);
+    return status;
+}
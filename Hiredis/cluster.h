@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_CLUSTER_H
+#define __HIREDIS_CLUSTER_H
+#include "async.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of hash slots the keyspace of a cluster is split in. */
+#define REDIS_CLUSTER_SLOTS 16384
+
+/* Redirections followed for one command before its error reply is passed
+ * to the callback. */
+#define REDIS_CLUSTER_MAX_REDIRECTS 5
+
+/* Flags set while the cluster context goes away. */
+#define REDIS_CLUSTER_DISCONNECTING 0x1
+#define REDIS_CLUSTER_FREEING 0x2
+
+/* Hook attaching a new node connection to the event library, e.g. a wrapper
+ * around redisMacOSAttach(). Returns REDIS_OK or REDIS_ERR. */
+typedef int (redisClusterAttachCallback)(redisAsyncContext *ac, void *privdata);
+
+struct redisClusterContext; /* forward declaration */
+
+/* A primary of the cluster, connected on first use. */
+typedef struct redisClusterNode {
+    char *host;
+    int port;
+    redisAsyncContext *ac; /* NULL while not connected */
+    int nslots; /* hash slots served according to the slot map */
+    struct redisClusterContext *cc;
+    struct redisClusterNode *next;
+} redisClusterNode;
+
+/* Async client for a Redis Cluster. Commands are sent to the primary
+ * serving the hash slot of their key, according to the slot map loaded with
+ * CLUSTER SLOTS. MOVED redirections are followed and reload the map, ASK
+ * redirections are followed for the one command. Commands without a key go
+ * to any node. MGET, MSET, DEL, EXISTS and UNLINK with keys in several slots
+ * are split in one command per slot, sent at once, and get a single reply
+ * put together in the order of the keys. The callback gets the context of
+ * the node that replied last. */
+typedef struct redisClusterContext {
+    redisClusterNode *nodes;
+    redisClusterNode **slots; /* REDIS_CLUSTER_SLOTS entries, NULL if unknown */
+    int flags;
+    int refreshing; /* CLUSTER SLOTS in flight */
+
+    redisClusterAttachCallback *attach;
+    void *attachdata;
+} redisClusterContext;
+
+/* Connect to a node of the cluster and load the slot map from it. Until the
+ * map is loaded, commands go to that node and follow its redirections. */
+redisClusterContext *redisClusterConnect(const char *ip, int port,
+                                         redisClusterAttachCallback *attach, void *privdata);
+
+/* Close the node connections once pending replies are read, the context is
+ * free'd with the last one. */
+void redisClusterDisconnect(redisClusterContext *cc);
+void redisClusterFree(redisClusterContext *cc);
+
+/* Hash slot of a key, honouring {hash tags}. */
+unsigned int redisClusterKeySlot(const char *key, size_t len);
+
+/* Commands, like their redisAsyncCommand() counterparts. REDIS_ERR is
+ * returned when no node could take the command. */
+int redisvClusterCommand(redisClusterContext *cc, redisCallbackFn *fn, void *privdata, const char *format, va_list ap);
+int redisClusterCommand(redisClusterContext *cc, redisCallbackFn *fn, void *privdata, const char *format, ...);
+int redisClusterCommandArgv(redisClusterContext *cc, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen);
+int redisClusterFormattedCommand(redisClusterContext *cc, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
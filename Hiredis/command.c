@@ -0,0 +1,678 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "command.h"
+#include "hiredis.h"
+#include "async.h"
+#include "net.h"
+
+#define RO REDIS_CMD_READONLY
+#define WR REDIS_CMD_WRITE
+#define PS REDIS_CMD_PUBSUB
+#define AD REDIS_CMD_ADMIN
+#define MK REDIS_CMD_MOVABLEKEYS
+
+/* Name, arity, flags, first key, last key, step, key count position. Only
+ * commands that read the keyspace are flagged "readonly", as by the server:
+ * those are the ones sent to replicas and again after a reconnect. */
+static const redisCommandInfo __redisCommands[] = {
+    { "append", 3, WR, 1, 1, 1, 0 },
+    { "auth", 2, 0, 0, 0, 0, 0 },
+    { "bgrewriteaof", 1, AD, 0, 0, 0, 0 },
+    { "bgsave", -1, AD, 0, 0, 0, 0 },
+    { "bitcount", -2, RO, 1, 1, 1, 0 },
+    { "bitfield", -2, WR, 1, 1, 1, 0 },
+    { "bitop", -4, WR, 2, -1, 1, 0 },
+    { "bitpos", -3, RO, 1, 1, 1, 0 },
+    { "blpop", -3, WR, 1, -2, 1, 0 },
+    { "brpop", -3, WR, 1, -2, 1, 0 },
+    { "brpoplpush", 4, WR, 1, 2, 1, 0 },
+    { "client", -2, AD, 0, 0, 0, 0 },
+    { "cluster", -2, AD, 0, 0, 0, 0 },
+    { "command", -1, 0, 0, 0, 0, 0 },
+    { "config", -2, AD, 0, 0, 0, 0 },
+    { "dbsize", 1, RO, 0, 0, 0, 0 },
+    { "debug", -2, AD, 0, 0, 0, 0 },
+    { "decr", 2, WR, 1, 1, 1, 0 },
+    { "decrby", 3, WR, 1, 1, 1, 0 },
+    { "del", -2, WR, 1, -1, 1, 0 },
+    { "discard", 1, 0, 0, 0, 0, 0 },
+    { "dump", 2, RO, 1, 1, 1, 0 },
+    { "echo", 2, 0, 0, 0, 0, 0 },
+    { "eval", -3, MK, 0, 0, 0, 2 },
+    { "evalsha", -3, MK, 0, 0, 0, 2 },
+    { "exec", 1, 0, 0, 0, 0, 0 },
+    { "exists", -2, RO, 1, -1, 1, 0 },
+    { "expire", 3, WR, 1, 1, 1, 0 },
+    { "expireat", 3, WR, 1, 1, 1, 0 },
+    { "flushall", -1, WR, 0, 0, 0, 0 },
+    { "flushdb", -1, WR, 0, 0, 0, 0 },
+    { "geoadd", -5, WR, 1, 1, 1, 0 },
+    { "geodist", -4, RO, 1, 1, 1, 0 },
+    { "geohash", -2, RO, 1, 1, 1, 0 },
+    { "geopos", -2, RO, 1, 1, 1, 0 },
+    { "georadius", -6, WR|MK, 1, 1, 1, 0 },
+    { "georadiusbymember", -5, WR|MK, 1, 1, 1, 0 },
+    { "get", 2, RO, 1, 1, 1, 0 },
+    { "getbit", 3, RO, 1, 1, 1, 0 },
+    { "getrange", 4, RO, 1, 1, 1, 0 },
+    { "getset", 3, WR, 1, 1, 1, 0 },
+    { "hdel", -3, WR, 1, 1, 1, 0 },
+    { "hexists", 3, RO, 1, 1, 1, 0 },
+    { "hget", 3, RO, 1, 1, 1, 0 },
+    { "hgetall", 2, RO, 1, 1, 1, 0 },
+    { "hincrby", 4, WR, 1, 1, 1, 0 },
+    { "hincrbyfloat", 4, WR, 1, 1, 1, 0 },
+    { "hkeys", 2, RO, 1, 1, 1, 0 },
+    { "hlen", 2, RO, 1, 1, 1, 0 },
+    { "hmget", -3, RO, 1, 1, 1, 0 },
+    { "hmset", -4, WR, 1, 1, 1, 0 },
+    { "hscan", -3, RO, 1, 1, 1, 0 },
+    { "hset", -4, WR, 1, 1, 1, 0 },
+    { "hsetnx", 4, WR, 1, 1, 1, 0 },
+    { "hstrlen", 3, RO, 1, 1, 1, 0 },
+    { "hvals", 2, RO, 1, 1, 1, 0 },
+    { "incr", 2, WR, 1, 1, 1, 0 },
+    { "incrby", 3, WR, 1, 1, 1, 0 },
+    { "incrbyfloat", 3, WR, 1, 1, 1, 0 },
+    { "info", -1, 0, 0, 0, 0, 0 },
+    { "keys", 2, RO, 0, 0, 0, 0 },
+    { "lastsave", 1, 0, 0, 0, 0, 0 },
+    { "lindex", 3, RO, 1, 1, 1, 0 },
+    { "linsert", 5, WR, 1, 1, 1, 0 },
+    { "llen", 2, RO, 1, 1, 1, 0 },
+    { "lpop", 2, WR, 1, 1, 1, 0 },
+    { "lpush", -3, WR, 1, 1, 1, 0 },
+    { "lpushx", -3, WR, 1, 1, 1, 0 },
+    { "lrange", 4, RO, 1, 1, 1, 0 },
+    { "lrem", 4, WR, 1, 1, 1, 0 },
+    { "lset", 4, WR, 1, 1, 1, 0 },
+    { "ltrim", 4, WR, 1, 1, 1, 0 },
+    { "mget", -2, RO, 1, -1, 1, 0 },
+    { "migrate", -6, WR|MK, 0, 0, 0, 0 },
+    { "monitor", 1, AD|REDIS_CMD_MONITOR, 0, 0, 0, 0 },
+    { "move", 3, WR, 1, 1, 1, 0 },
+    { "mset", -3, WR, 1, -1, 2, 0 },
+    { "msetnx", -3, WR, 1, -1, 2, 0 },
+    { "multi", 1, 0, 0, 0, 0, 0 },
+    { "object", 3, RO, 2, 2, 1, 0 },
+    { "persist", 2, WR, 1, 1, 1, 0 },
+    { "pexpire", 3, WR, 1, 1, 1, 0 },
+    { "pexpireat", 3, WR, 1, 1, 1, 0 },
+    { "pfadd", -2, WR, 1, 1, 1, 0 },
+    { "pfcount", -2, RO, 1, -1, 1, 0 },
+    { "pfmerge", -2, WR, 1, -1, 1, 0 },
+    { "ping", -1, 0, 0, 0, 0, 0 },
+    { "psetex", 4, WR, 1, 1, 1, 0 },
+    { "psubscribe", -2, PS|REDIS_CMD_SUBSCRIBE, 0, 0, 0, 0 },
+    { "pttl", 2, RO, 1, 1, 1, 0 },
+    { "publish", 3, PS, 0, 0, 0, 0 },
+    { "pubsub", -2, PS, 0, 0, 0, 0 },
+    { "punsubscribe", -1, PS|REDIS_CMD_UNSUBSCRIBE, 0, 0, 0, 0 },
+    { "randomkey", 1, RO, 0, 0, 0, 0 },
+    { "readonly", 1, 0, 0, 0, 0, 0 },
+    { "readwrite", 1, 0, 0, 0, 0, 0 },
+    { "rename", 3, WR, 1, 2, 1, 0 },
+    { "renamenx", 3, WR, 1, 2, 1, 0 },
+    { "restore", -4, WR, 1, 1, 1, 0 },
+    { "role", 1, 0, 0, 0, 0, 0 },
+    { "rpop", 2, WR, 1, 1, 1, 0 },
+    { "rpoplpush", 3, WR, 1, 2, 1, 0 },
+    { "rpush", -3, WR, 1, 1, 1, 0 },
+    { "rpushx", -3, WR, 1, 1, 1, 0 },
+    { "sadd", -3, WR, 1, 1, 1, 0 },
+    { "save", 1, AD, 0, 0, 0, 0 },
+    { "scan", -2, RO, 0, 0, 0, 0 },
+    { "scard", 2, RO, 1, 1, 1, 0 },
+    { "script", -2, 0, 0, 0, 0, 0 },
+    { "sdiff", -2, RO, 1, -1, 1, 0 },
+    { "sdiffstore", -3, WR, 1, -1, 1, 0 },
+    { "select", 2, 0, 0, 0, 0, 0 },
+    { "set", -3, WR, 1, 1, 1, 0 },
+    { "setbit", 4, WR, 1, 1, 1, 0 },
+    { "setex", 4, WR, 1, 1, 1, 0 },
+    { "setnx", 3, WR, 1, 1, 1, 0 },
+    { "setrange", 4, WR, 1, 1, 1, 0 },
+    { "shutdown", -1, AD, 0, 0, 0, 0 },
+    { "sinter", -2, RO, 1, -1, 1, 0 },
+    { "sinterstore", -3, WR, 1, -1, 1, 0 },
+    { "sismember", 3, RO, 1, 1, 1, 0 },
+    { "slaveof", 3, AD, 0, 0, 0, 0 },
+    { "slowlog", -2, AD, 0, 0, 0, 0 },
+    { "smembers", 2, RO, 1, 1, 1, 0 },
+    { "smove", 4, WR, 1, 2, 1, 0 },
+    { "sort", -2, WR|MK, 1, 1, 1, 0 },
+    { "spop", -2, WR, 1, 1, 1, 0 },
+    { "srandmember", -2, RO, 1, 1, 1, 0 },
+    { "srem", -3, WR, 1, 1, 1, 0 },
+    { "sscan", -3, RO, 1, 1, 1, 0 },
+    { "strlen", 2, RO, 1, 1, 1, 0 },
+    { "subscribe", -2, PS|REDIS_CMD_SUBSCRIBE, 0, 0, 0, 0 },
+    { "substr", 4, RO, 1, 1, 1, 0 },
+    { "sunion", -2, RO, 1, -1, 1, 0 },
+    { "sunionstore", -3, WR, 1, -1, 1, 0 },
+    { "sync", 1, AD, 0, 0, 0, 0 },
+    { "time", 1, 0, 0, 0, 0, 0 },
+    { "touch", -2, RO, 1, -1, 1, 0 },
+    { "ttl", 2, RO, 1, 1, 1, 0 },
+    { "type", 2, RO, 1, 1, 1, 0 },
+    { "unlink", -2, WR, 1, -1, 1, 0 },
+    { "unsubscribe", -1, PS|REDIS_CMD_UNSUBSCRIBE, 0, 0, 0, 0 },
+    { "unwatch", 1, 0, 0, 0, 0, 0 },
+    { "wait", 3, 0, 0, 0, 0, 0 },
+    { "watch", -2, 0, 1, -1, 1, 0 },
+    { "zadd", -4, WR, 1, 1, 1, 0 },
+    { "zcard", 2, RO, 1, 1, 1, 0 },
+    { "zcount", 4, RO, 1, 1, 1, 0 },
+    { "zincrby", 4, WR, 1, 1, 1, 0 },
+    { "zinterstore", -4, WR|MK, 1, 1, 1, 0 },
+    { "zlexcount", 4, RO, 1, 1, 1, 0 },
+    { "zrange", -4, RO, 1, 1, 1, 0 },
+    { "zrangebylex", -4, RO, 1, 1, 1, 0 },
+    { "zrangebyscore", -4, RO, 1, 1, 1, 0 },
+    { "zrank", 3, RO, 1, 1, 1, 0 },
+    { "zrem", -3, WR, 1, 1, 1, 0 },
+    { "zremrangebylex", 4, WR, 1, 1, 1, 0 },
+    { "zremrangebyrank", 4, WR, 1, 1, 1, 0 },
+    { "zremrangebyscore", 4, WR, 1, 1, 1, 0 },
+    { "zrevrange", -4, RO, 1, 1, 1, 0 },
+    { "zrevrangebylex", -4, RO, 1, 1, 1, 0 },
+    { "zrevrangebyscore", -4, RO, 1, 1, 1, 0 },
+    { "zrevrank", 3, RO, 1, 1, 1, 0 },
+    { "zscan", -3, RO, 1, 1, 1, 0 },
+    { "zscore", 3, RO, 1, 1, 1, 0 },
+    { "zunionstore", -4, WR|MK, 1, 1, 1, 0 }
+};
+
+#undef RO
+#undef WR
+#undef PS
+#undef AD
+#undef MK
+
+/* Lookups may run on any thread while a refresh sets another table, so the
+ * table is published with an atomic exchange and read with an acquire. */
+#define __redisCommandLoad(p) __atomic_load_n(p,__ATOMIC_ACQUIRE)
+#define __redisCommandExchange(p,v) __atomic_exchange_n(p,v,__ATOMIC_ACQ_REL)
+#define __redisCommandSwap(p,old,v) \
+    __atomic_compare_exchange_n(p,old,v,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED)
+#define __redisCommandPublish(p,old,v) \
+    __atomic_compare_exchange_n(p,old,v,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)
+
+/* The table in use, NULL for the built in one. */
+static const redisCommandTable *__redisCommandTable = NULL;
+
+/* The built in table, indexed by the first lookup that needs it. */
+static const redisCommandTable *__redisCommandDefault = NULL;
+
+/* Tables a refresh replaced. They are never free'd, since there is no
+ * telling when the last lookup in them is over; a refresh only replaces
+ * the table when the server's commands changed. */
+typedef struct redisCommandRetired {
+    const redisCommandTable *table;
+    struct redisCommandRetired *next;
+} redisCommandRetired;
+
+static redisCommandRetired *__redisCommandRetired = NULL;
+
+/* 32 bit FNV-1a of a name in lower case. */
+static unsigned int __redisCommandHash(const char *name, size_t len) {
+    return redisFnv1a(REDIS_FNV_BASIS,name,len,1);
+}
+
+/* Slot of a name in a bucket with displacement "d", mixed with the
+ * MurmurHash3 finalizer. */
+static unsigned int __redisCommandSlot(unsigned int h, unsigned int d, unsigned int nslots) {
+    h += d*0x9e3779b9U;
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h & (nslots-1);
+}
+
+typedef struct {
+    unsigned int size;
+    unsigned int bucket;
+} redisCommandBucket;
+
+static int __redisCommandCompareBuckets(const void *a, const void *b) {
+    const redisCommandBucket *x = a, *y = b;
+    if (x->size != y->size)
+        return x->size > y->size ? -1 : 1;
+    return x->bucket < y->bucket ? -1 : x->bucket > y->bucket;
+}
+
+/* Find a displacement for every bucket of names, largest buckets first,
+ * so the names of a bucket land in slots no other name took ("hash and
+ * displace"). The slots are doubled until it works out. */
+static int __redisCommandIndex(redisCommandTable *table) {
+    unsigned int n = (unsigned int)table->ncommands, nbuckets = n/4+1, nslots;
+    unsigned int *hashes = NULL, *members = NULL, *start = NULL, *pos = NULL;
+    unsigned short *disp = NULL, *slots = NULL;
+    redisCommandBucket *buckets = NULL;
+    unsigned int i, j, k, b, d;
+    int status = REDIS_ERR;
+
+    if (n == 0 || n >= USHRT_MAX)
+        return REDIS_ERR;
+
+    hashes = malloc(sizeof(*hashes)*n);
+    members = malloc(sizeof(*members)*n);
+    pos = calloc(n,sizeof(*pos)); /* n >= nbuckets */
+    start = calloc(nbuckets+1,sizeof(*start));
+    buckets = calloc(nbuckets,sizeof(*buckets));
+    disp = malloc(sizeof(*disp)*nbuckets);
+    if (hashes == NULL || members == NULL || pos == NULL || start == NULL ||
+        buckets == NULL || disp == NULL)
+        goto done;
+
+    /* Names of every bucket, next to each other in "members". */
+    for (i = 0; i < n; i++) {
+        hashes[i] = __redisCommandHash(table->commands[i].name,strlen(table->commands[i].name));
+        buckets[hashes[i]%nbuckets].size++;
+    }
+    for (b = 0; b < nbuckets; b++) {
+        buckets[b].bucket = b;
+        start[b+1] = start[b]+buckets[b].size;
+    }
+    for (i = 0; i < n; i++) {
+        b = hashes[i]%nbuckets;
+        members[start[b]+pos[b]++] = i;
+    }
+    qsort(buckets,nbuckets,sizeof(*buckets),__redisCommandCompareBuckets);
+
+    nslots = 8;
+    while (nslots < n+n/4)
+        nslots *= 2;
+    for (; nslots <= 65536 && status != REDIS_OK; nslots *= 2) {
+        free(slots);
+        if ((slots = calloc(nslots,sizeof(*slots))) == NULL)
+            goto done;
+        for (i = 0; i < nbuckets; i++) {
+            b = buckets[i].bucket;
+            for (d = 0; d < USHRT_MAX; d++) {
+                for (j = 0; j < buckets[i].size; j++) {
+                    pos[j] = __redisCommandSlot(hashes[members[start[b]+j]],d,nslots);
+                    if (slots[pos[j]] != 0)
+                        break;
+                    for (k = 0; k < j && pos[k] != pos[j]; k++);
+                    if (k < j)
+                        break;
+                }
+                if (j == buckets[i].size)
+                    break;
+            }
+            if (d == USHRT_MAX)
+                break;
+            disp[b] = (unsigned short)d;
+            for (j = 0; j < buckets[i].size; j++)
+                slots[pos[j]] = (unsigned short)(members[start[b]+j]+1);
+        }
+        if (i == nbuckets) {
+            table->disp = disp;
+            table->nbuckets = nbuckets;
+            table->slots = slots;
+            table->nslots = nslots;
+            disp = NULL;
+            slots = NULL;
+            status = REDIS_OK;
+        }
+    }
+
+done:
+    free(hashes);
+    free(members);
+    free(pos);
+    free(start);
+    free(buckets);
+    free(disp);
+    free(slots);
+    return status;
+}
+
+/* Index the built in table on first use. Threads that race to do it each
+ * build one, the first to publish it wins and the others drop theirs. */
+static const redisCommandTable *__redisCommandBuiltin(void) {
+    const redisCommandTable *table = __redisCommandLoad(&__redisCommandDefault);
+    redisCommandTable *built;
+
+    if (table != NULL)
+        return table;
+    if ((built = calloc(1,sizeof(*built))) == NULL)
+        return NULL;
+    built->commands = __redisCommands;
+    built->ncommands = sizeof(__redisCommands)/sizeof(__redisCommands[0]);
+    if (__redisCommandIndex(built) != REDIS_OK) {
+        free(built);
+        return NULL;
+    }
+    if (!__redisCommandPublish(&__redisCommandDefault,&table,built)) {
+        free((unsigned short*)built->disp);
+        free((unsigned short*)built->slots);
+        free(built);
+        return table;
+    }
+    return built;
+}
+
+/* The table lookups go to: the one set, or else the built in one. */
+static const redisCommandTable *__redisCommandCurrent(void) {
+    const redisCommandTable *table = __redisCommandLoad(&__redisCommandTable);
+    return table != NULL ? table : __redisCommandBuiltin();
+}
+
+const redisCommandTable *redisCommandTableDefault(void) {
+    return __redisCommandBuiltin();
+}
+
+const redisCommandInfo *redisCommandTableLookup(const redisCommandTable *table, const char *name, size_t len) {
+    const redisCommandInfo *info;
+    unsigned int h = __redisCommandHash(name,len), i;
+
+    i = table->slots[__redisCommandSlot(h,table->disp[h%table->nbuckets],table->nslots)];
+    if (i == 0)
+        return NULL;
+    info = &table->commands[i-1];
+    if (strncasecmp(info->name,name,len) != 0 || info->name[len] != '\0')
+        return NULL;
+    return info;
+}
+
+const redisCommandInfo *redisCommandLookup(const char *name, size_t len) {
+    const redisCommandTable *table = __redisCommandCurrent();
+    return table != NULL ? redisCommandTableLookup(table,name,len) : NULL;
+}
+
+int redisCommandIsReadOnly(const char *name, size_t len) {
+    const redisCommandInfo *info = redisCommandLookup(name,len);
+    return info != NULL && (info->flags & REDIS_CMD_READONLY);
+}
+
+const redisCommandTable *redisCommandTableSet(const redisCommandTable *table) {
+    if (table != NULL && table == __redisCommandLoad(&__redisCommandDefault))
+        table = NULL;
+    table = __redisCommandExchange(&__redisCommandTable,table);
+    return table != NULL ? table : __redisCommandBuiltin();
+}
+
+void redisCommandTableFree(redisCommandTable *table) {
+    int i;
+
+    if (table == NULL || table == __redisCommandLoad(&__redisCommandDefault))
+        return;
+    if (table->commands != NULL) {
+        for (i = 0; i < table->ncommands; i++)
+            free((char*)table->commands[i].name);
+        free((redisCommandInfo*)table->commands);
+    }
+    free((unsigned short*)table->disp);
+    free((unsigned short*)table->slots);
+    free(table);
+}
+
+static int __redisCommandFlag(const redisReply *flag) {
+    static const struct {
+        const char *name;
+        int flag;
+    } flags[] = {
+        { "readonly", REDIS_CMD_READONLY },
+        { "write", REDIS_CMD_WRITE },
+        { "pubsub", REDIS_CMD_PUBSUB },
+        { "admin", REDIS_CMD_ADMIN },
+        { "movablekeys", REDIS_CMD_MOVABLEKEYS }
+    };
+    size_t i;
+
+    if (flag->type != REDIS_REPLY_STATUS && flag->type != REDIS_REPLY_STRING)
+        return 0;
+    for (i = 0; i < sizeof(flags)/sizeof(flags[0]); i++)
+        if (strcasecmp(flags[i].name,flag->str) == 0)
+            return flags[i].flag;
+    return 0;
+}
+
+/* Every entry of a COMMAND reply: name, arity, flags, first key, last
+ * key, step, and more fields newer servers add. */
+redisCommandTable *redisCommandTableCreate(const redisReply *reply) {
+    const redisCommandTable *builtin = __redisCommandBuiltin();
+    const redisCommandInfo *known;
+    redisCommandInfo *commands, *info;
+    redisCommandTable *table;
+    redisReply *entry;
+    char *name;
+    size_t i, j;
+    int n = 0;
+
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY || reply->elements == 0)
+        return NULL;
+    if ((table = calloc(1,sizeof(*table))) == NULL)
+        return NULL;
+    if ((commands = calloc(reply->elements,sizeof(*commands))) == NULL) {
+        free(table);
+        return NULL;
+    }
+    table->commands = commands;
+
+    for (i = 0; i < reply->elements; i++) {
+        entry = reply->element[i];
+        if (entry->type != REDIS_REPLY_ARRAY || entry->elements < 6 ||
+            entry->element[0]->type != REDIS_REPLY_STRING ||
+            entry->element[1]->type != REDIS_REPLY_INTEGER ||
+            entry->element[2]->type != REDIS_REPLY_ARRAY ||
+            entry->element[3]->type != REDIS_REPLY_INTEGER ||
+            entry->element[4]->type != REDIS_REPLY_INTEGER ||
+            entry->element[5]->type != REDIS_REPLY_INTEGER)
+            continue;
+
+        /* Subcommands are looked up by their container. */
+        if (entry->element[0]->len == 0 || strchr(entry->element[0]->str,'|') != NULL)
+            continue;
+        for (j = 0; j < (size_t)n; j++)
+            if (strcasecmp(commands[j].name,entry->element[0]->str) == 0)
+                break;
+        if (j < (size_t)n)
+            continue;
+
+        if ((name = malloc(entry->element[0]->len+1)) == NULL)
+            goto error;
+        for (j = 0; j <= (size_t)entry->element[0]->len; j++)
+            name[j] = (entry->element[0]->str[j] >= 'A' && entry->element[0]->str[j] <= 'Z') ?
+                      entry->element[0]->str[j]+('a'-'A') : entry->element[0]->str[j];
+
+        info = &commands[n++];
+        table->ncommands = n;
+        info->name = name;
+        info->arity = (int)entry->element[1]->integer;
+        for (j = 0; j < entry->element[2]->elements; j++)
+            info->flags |= __redisCommandFlag(entry->element[2]->element[j]);
+        info->firstkey = (int)entry->element[3]->integer;
+        info->lastkey = (int)entry->element[4]->integer;
+        info->step = (int)entry->element[5]->integer;
+
+        /* What the server doesn't tell. */
+        known = builtin != NULL ? redisCommandTableLookup(builtin,name,entry->element[0]->len) : NULL;
+        if (known != NULL) {
+            info->flags |= known->flags & (REDIS_CMD_SUBSCRIBE|REDIS_CMD_UNSUBSCRIBE|REDIS_CMD_MONITOR);
+            info->keynum = known->keynum;
+            if (info->firstkey == 0 && (info->flags & REDIS_CMD_MOVABLEKEYS)) {
+                info->firstkey = known->firstkey;
+                info->lastkey = known->lastkey;
+                info->step = known->step;
+            }
+        }
+    }
+
+    if (__redisCommandIndex(table) != REDIS_OK)
+        goto error;
+    return table;
+
+error:
+    redisCommandTableFree(table);
+    return NULL;
+}
+
+static int __redisCommandTableEqual(const redisCommandTable *a, const redisCommandTable *b) {
+    const redisCommandInfo *x, *y;
+    int i;
+
+    if (a->ncommands != b->ncommands)
+        return 0;
+    for (i = 0; i < a->ncommands; i++) {
+        x = &a->commands[i];
+        y = &b->commands[i];
+        if (strcmp(x->name,y->name) != 0 || x->arity != y->arity ||
+            x->flags != y->flags || x->firstkey != y->firstkey ||
+            x->lastkey != y->lastkey || x->step != y->step ||
+            x->keynum != y->keynum)
+            return 0;
+    }
+    return 1;
+}
+
+static void __redisCommandOnReply(redisAsyncContext *ac, void *r, void *privdata) {
+    const redisCommandTable *current;
+    redisCommandTable *table;
+    redisCommandRetired *retired;
+
+    ((void)ac);
+    ((void)privdata);
+    if ((table = redisCommandTableCreate(r)) == NULL)
+        return;
+
+    /* Every connection refreshing against the same servers gets the same
+     * commands: keep the table in use rather than retire one more. */
+    current = __redisCommandCurrent();
+    if ((current != NULL && __redisCommandTableEqual(table,current)) ||
+        (retired = malloc(sizeof(*retired))) == NULL)
+    {
+        redisCommandTableFree(table);
+        return;
+    }
+    retired->table = redisCommandTableSet(table);
+    retired->next = __redisCommandLoad(&__redisCommandRetired);
+    while (!__redisCommandSwap(&__redisCommandRetired,&retired->next,retired));
+}
+
+int redisAsyncRefreshCommandTable(redisAsyncContext *ac) {
+    return redisAsyncCommand(ac,__redisCommandOnReply,NULL,"COMMAND");
+}
+
+/* Read "*<count>\r\n" or "$<len>\r\n" at "p". Returns what follows, or
+ * NULL when the command ends or doesn't match. */
+static const char *__redisCommandReadLength(const char *p, const char *end, char type, size_t *n) {
+    if (p >= end || *p != type)
+        return NULL;
+    for (*n = 0, p++; p < end && *p >= '0' && *p <= '9'; p++)
+        *n = *n*10+(*p-'0');
+    p += 2; /* \r\n */
+    return p <= end ? p : NULL;
+}
+
+const char *redisFormattedCommandArgc(const char *cmd, size_t len, size_t *argc) {
+    return __redisCommandReadLength(cmd,cmd+len,'*',argc);
+}
+
+const char *redisFormattedCommandNextArgument(const char *p, const char *end, const char **arg, size_t *arglen) {
+    if ((p = __redisCommandReadLength(p,end,'$',arglen)) == NULL || *arglen+2 > (size_t)(end-p))
+        return NULL;
+    *arg = p;
+    return p+*arglen+2;
+}
+
+const redisCommandInfo *redisFormattedCommandInfo(const char *cmd, size_t len, redisCommandKeys *keys) {
+    const char *p, *end = cmd+len, *arg;
+    const redisCommandInfo *info;
+    size_t argc, n, count = 0;
+    int i;
+
+    memset(keys,0,sizeof(*keys));
+    if ((p = redisFormattedCommandArgc(cmd,len,&argc)) == NULL || argc == 0 || argc > INT_MAX)
+        return NULL;
+    if ((p = redisFormattedCommandNextArgument(p,end,&arg,&n)) == NULL)
+        return NULL;
+    keys->argc = (int)argc;
+
+    if ((info = redisCommandLookup(arg,n)) == NULL) {
+        if (argc >= 2)
+            keys->first = keys->last = keys->step = 1;
+        return NULL;
+    }
+
+    if (info->keynum > 0) {
+        for (i = 1; i <= info->keynum; i++)
+            if ((p = redisFormattedCommandNextArgument(p,end,&arg,&n)) == NULL)
+                return info;
+        for (; n > 0 && *arg >= '0' && *arg <= '9'; n--, arg++)
+            if ((count = count*10+(*arg-'0')) >= argc)
+                return info;
+        if (n == 0 && count > 0 && info->keynum+count < argc) {
+            keys->first = info->keynum+1;
+            keys->last = info->keynum+(int)count;
+            keys->step = 1;
+        }
+        return info;
+    }
+
+    if (info->firstkey > 0 && (size_t)info->firstkey < argc) {
+        keys->first = info->firstkey;
+        keys->last = info->lastkey < 0 ? (int)argc+info->lastkey : info->lastkey;
+        if (keys->last >= (int)argc)
+            keys->last = (int)argc-1;
+        keys->step = info->step > 0 ? info->step : 1;
+        if (keys->last < keys->first)
+            keys->first = keys->last = keys->step = 0;
+    }
+    return info;
+}
+
+int redisFormattedCommandKey(const char *cmd, size_t len, const char **key, size_t *keylen) {
+    const char *p, *end = cmd+len;
+    redisCommandKeys keys;
+    size_t argc;
+    int i;
+
+    redisFormattedCommandInfo(cmd,len,&keys);
+    if (keys.first == 0)
+        return 0;
+
+    p = redisFormattedCommandArgc(cmd,len,&argc);
+    for (i = 0; i <= keys.first; i++)
+        if ((p = redisFormattedCommandNextArgument(p,end,key,keylen)) == NULL)
+            return 0;
+    return 1;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_COMMAND_H
+#define __HIREDIS_COMMAND_H
+#include <stddef.h> /* for size_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct redisReply; /* reply header is included in command.c */
+struct redisAsyncContext; /* async header is included in command.c */
+
+/* Command flags, as reported by COMMAND. */
+#define REDIS_CMD_READONLY 0x1 /* reads the keyspace, never changes it */
+#define REDIS_CMD_WRITE 0x2
+#define REDIS_CMD_PUBSUB 0x4
+#define REDIS_CMD_ADMIN 0x8
+#define REDIS_CMD_MOVABLEKEYS 0x10 /* keys aren't at fixed positions only */
+
+/* Flags telling how the client handles the reply. */
+#define REDIS_CMD_SUBSCRIBE 0x100 /* replies come as pub/sub messages */
+#define REDIS_CMD_UNSUBSCRIBE 0x200 /* no reply of its own */
+#define REDIS_CMD_MONITOR 0x400 /* one reply per command the server runs */
+
+/* What is known of a command. Argument positions count the name as 0. */
+typedef struct redisCommandInfo {
+    const char *name; /* lower case */
+    int arity; /* number of arguments, or -N for at least N */
+    int flags; /* REDIS_CMD_* */
+    int firstkey; /* position of the first key, 0 when it has none */
+    int lastkey; /* of the last key, negative to count from the end */
+    int step; /* between two keys */
+    int keynum; /* position of an argument giving the number of keys that
+                 * follow it, like for EVAL, 0 if none */
+} redisCommandInfo;
+
+/* A set of commands with a perfect hash of their names, so a lookup is one
+ * hash, one probe and one compare. */
+typedef struct redisCommandTable {
+    const redisCommandInfo *commands;
+    int ncommands;
+    const unsigned short *disp; /* displacement of every bucket */
+    unsigned int nbuckets;
+    const unsigned short *slots; /* index+1 in commands, 0 if empty */
+    unsigned int nslots; /* a power of two */
+} redisCommandTable;
+
+/* The keys of a formatted command: the arguments from "first" to "last",
+ * every "step". */
+typedef struct redisCommandKeys {
+    int argc;
+    int first; /* 0 when the command has no key */
+    int last;
+    int step;
+} redisCommandKeys;
+
+/* The table built in, with the commands of Redis 3.2. Its index is built
+ * at first use; NULL when that runs out of memory. */
+const redisCommandTable *redisCommandTableDefault(void);
+
+/* Build a table from the reply to COMMAND. Commands the built in table
+ * knows keep the client flags and key count position it gives them.
+ * Returns NULL when the reply isn't a COMMAND reply or out of memory. */
+redisCommandTable *redisCommandTableCreate(const struct redisReply *reply);
+void redisCommandTableFree(redisCommandTable *table);
+
+/* Make "table" the one used by lookups, NULL for the built in one. The
+ * table set before is returned. Lookups running on other threads may
+ * still be using it: only free it, unless it is the built in one, once
+ * none can be. */
+const redisCommandTable *redisCommandTableSet(const redisCommandTable *table);
+
+/* Send COMMAND and make the table built from the reply the one used, when
+ * it differs from the one in use. The table it replaces is kept, never
+ * free'd, so lookups on other threads can go on with it. */
+int redisAsyncRefreshCommandTable(struct redisAsyncContext *ac);
+
+/* Look a command up by name, in any case. Returns NULL when unknown. */
+const redisCommandInfo *redisCommandTableLookup(const redisCommandTable *table, const char *name, size_t len);
+const redisCommandInfo *redisCommandLookup(const char *name, size_t len);
+
+/* Whether a command never changes the dataset. */
+int redisCommandIsReadOnly(const char *name, size_t len);
+
+/* Look up the command of a formatted command and find its keys. Commands
+ * that are not known are taken to have a single key, right after their
+ * name. Only the argument count and the name are read, unless the number
+ * of keys is itself an argument. Commands with movable keys report the
+ * keys at known positions only. Returns NULL for unknown commands, with
+ * keys->argc set to 0 when the command is malformed. */
+const redisCommandInfo *redisFormattedCommandInfo(const char *cmd, size_t len, redisCommandKeys *keys);
+
+/* Walk the arguments of a formatted command: redisFormattedCommandArgc()
+ * reads how many there are and returns where the first one starts, then
+ * redisFormattedCommandNextArgument() reads the one at "p" and returns
+ * where the next one starts. Both return NULL past the end or when the
+ * command is malformed. */
+const char *redisFormattedCommandArgc(const char *cmd, size_t len, size_t *argc);
+const char *redisFormattedCommandNextArgument(const char *p, const char *end, const char **arg, size_t *arglen);
+
+/* Find the first key of a formatted command. Returns 0 when the command
+ * has none. */
+int redisFormattedCommandKey(const char *cmd, size_t len, const char **key, size_t *keylen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -37,32 +37,52 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <limits.h>
+#include <string.h>
 #include "dict.h"
 
 /* -------------------------- private prototypes ---------------------------- */
 
-static int _dictExpandIfNeeded(dict *ht);
+static int _dictExpandIfNeeded(dict *d);
+static void _dictShrinkIfNeeded(dict *d);
 static unsigned long _dictNextPower(unsigned long size);
-static int _dictKeyIndex(dict *ht, const void *key);
-static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
+static int _dictKeyIndex(dict *d, const void *key);
+static int _dictInit(dict *d, dictType *type, void *privDataPtr);
 
 /* -------------------------- hash functions -------------------------------- */
 
-/* Generic hash function (a popular one from Bernstein).
- * I tested a few and this was the best. */
+/* Generic hash function: MurmurHash2, by Austin Appleby. It takes four
+ * bytes a step and spreads keys sharing a long prefix, like channel names,
+ * much better than the Bernstein hash used before. */
 static unsigned int dictGenHashFunction(const unsigned char *buf, int len) {
-    unsigned int hash = 5381;
-
-    while (len--)
-        hash = ((hash << 5) + hash) + (*buf++); /* hash * 33 + c */
-    return hash;
+    const unsigned int m = 0x5bd1e995;
+    unsigned int h = 5381 ^ (unsigned int)len, k;
+
+    while (len >= 4) {
+        memcpy(&k,buf,sizeof(k));
+        k *= m;
+        k ^= k >> 24;
+        k *= m;
+        h = (h * m) ^ k;
+        buf += 4;
+        len -= 4;
+    }
+    switch (len) {
+    case 3: h ^= (unsigned int)buf[2] << 16; /* fall through */
+    case 2: h ^= (unsigned int)buf[1] << 8; /* fall through */
+    case 1: h ^= buf[0];
+            h *= m;
+    }
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+    return h;
 }
 
 /* ----------------------------- API implementation ------------------------- */
 
-/* Reset an hashtable already initialized with ht_init().
- * NOTE: This function should only called by ht_destroy(). */
-static void _dictReset(dict *ht) {
+/* Reset a hash table already initialized with _dictInit().
+ * NOTE: This function should only called by _dictClear(). */
+static void _dictReset(dictht *ht) {
     ht->table = NULL;
     ht->size = 0;
     ht->sizemask = 0;
@@ -71,85 +91,142 @@ static void _dictReset(dict *ht) {
 
 /* Create a new hash table */
 static dict *dictCreate(dictType *type, void *privDataPtr) {
-    dict *ht = malloc(sizeof(*ht));
-    _dictInit(ht,type,privDataPtr);
-    return ht;
+    dict *d = malloc(sizeof(*d));
+    _dictInit(d,type,privDataPtr);
+    return d;
 }
 
 /* Initialize the hash table */
-static int _dictInit(dict *ht, dictType *type, void *privDataPtr) {
-    _dictReset(ht);
-    ht->type = type;
-    ht->privdata = privDataPtr;
+static int _dictInit(dict *d, dictType *type, void *privDataPtr) {
+    _dictReset(&d->ht[0]);
+    _dictReset(&d->ht[1]);
+    d->type = type;
+    d->privdata = privDataPtr;
+    d->rehashidx = -1;
+    d->iterators = 0;
     return DICT_OK;
 }
 
-/* Expand or create the hashtable */
-static int dictExpand(dict *ht, unsigned long size) {
-    dict n; /* the new hashtable */
-    unsigned long realsize = _dictNextPower(size), i;
+/* Resize the table to the minimal size that contains all the elements */
+static int dictResize(dict *d) {
+    unsigned long minimal;
+
+    if (dictIsRehashing(d)) return DICT_ERR;
+    minimal = d->ht[0].used;
+    if (minimal < DICT_HT_INITIAL_SIZE)
+        minimal = DICT_HT_INITIAL_SIZE;
+    return dictExpand(d, minimal);
+}
+
+/* Expand or create the hash table. The elements already inside are not
+ * moved here but a few buckets at a time by the operations that follow,
+ * see dictRehash(). */
+static int dictExpand(dict *d, unsigned long size) {
+    dictht n; /* the new hash table */
+    unsigned long realsize = _dictNextPower(size);
 
     /* the size is invalid if it is smaller than the number of
-     * elements already inside the hashtable */
-    if (ht->used > size)
+     * elements already inside the hash table, or when rehashing */
+    if (dictIsRehashing(d) || d->ht[0].used > size)
+        return DICT_ERR;
+
+    /* Rehashing to the same table size is not useful. */
+    if (realsize == d->ht[0].size)
         return DICT_ERR;
 
-    _dictInit(&n, ht->type, ht->privdata);
     n.size = realsize;
     n.sizemask = realsize-1;
     n.table = calloc(realsize,sizeof(dictEntry*));
+    n.used = 0;
+    if (n.table == NULL)
+        return DICT_ERR;
 
-    /* Copy all the elements from the old to the new table:
-     * note that if the old hash table is empty ht->size is zero,
-     * so dictExpand just creates an hash table. */
-    n.used = ht->used;
-    for (i = 0; i < ht->size && ht->used > 0; i++) {
-        dictEntry *he, *nextHe;
+    /* Is this the first initialization? If so it's not really a rehashing,
+     * we just set the first hash table so that it can accept keys. */
+    if (d->ht[0].table == NULL) {
+        d->ht[0] = n;
+        return DICT_OK;
+    }
 
-        if (ht->table[i] == NULL) continue;
+    /* Prepare a second hash table for incremental rehashing */
+    d->ht[1] = n;
+    d->rehashidx = 0;
+    return DICT_OK;
+}
 
-        /* For each hash entry on this slot... */
-        he = ht->table[i];
-        while(he) {
+/* Move "n" buckets from the old table to the new one. Empty buckets are
+ * visited ten times as many at most, so a step is bounded on a sparse
+ * table. Returns 1 when there are still keys to move, 0 otherwise. */
+static int dictRehash(dict *d, int n) {
+    int empty_visits = n*10;
+
+    if (!dictIsRehashing(d)) return 0;
+
+    while (n-- && d->ht[0].used != 0) {
+        dictEntry *de, *nextde;
+
+        while (d->ht[0].table[d->rehashidx] == NULL) {
+            d->rehashidx++;
+            if (--empty_visits == 0) return 1;
+        }
+        de = d->ht[0].table[d->rehashidx];
+        /* Move all the keys in this bucket from the old to the new table */
+        while (de) {
             unsigned int h;
 
-            nextHe = he->next;
-            /* Get the new element index */
-            h = dictHashKey(ht, he->key) & n.sizemask;
-            he->next = n.table[h];
-            n.table[h] = he;
-            ht->used--;
-            /* Pass to the next element */
-            he = nextHe;
+            nextde = de->next;
+            h = dictHashKey(d, de->key) & d->ht[1].sizemask;
+            de->next = d->ht[1].table[h];
+            d->ht[1].table[h] = de;
+            d->ht[0].used--;
+            d->ht[1].used++;
+            de = nextde;
         }
+        d->ht[0].table[d->rehashidx] = NULL;
+        d->rehashidx++;
     }
-    assert(ht->used == 0);
-    free(ht->table);
 
-    /* Remap the new hashtable in the old */
-    *ht = n;
-    return DICT_OK;
+    /* Check if we already rehashed the whole table... */
+    if (d->ht[0].used == 0) {
+        free(d->ht[0].table);
+        d->ht[0] = d->ht[1];
+        _dictReset(&d->ht[1]);
+        d->rehashidx = -1;
+        return 0;
+    }
+    return 1;
+}
+
+/* Perform a rehashing step for every lookup or update, unless iterators
+ * are running: they would see moved entries twice or not at all. */
+static void _dictRehashStep(dict *d) {
+    if (d->iterators == 0) dictRehash(d,DICT_REHASH_STEP);
 }
 
 /* Add an element to the target hash table */
-static int dictAdd(dict *ht, void *key, void *val) {
+static int dictAdd(dict *d, void *key, void *val) {
     int index;
     dictEntry *entry;
+    dictht *ht;
+
+    if (dictIsRehashing(d)) _dictRehashStep(d);
 
     /* Get the index of the new element, or -1 if
      * the element already exists. */
-    if ((index = _dictKeyIndex(ht, key)) == -1)
+    if ((index = _dictKeyIndex(d, key)) == -1)
         return DICT_ERR;
 
-    /* Allocates the memory and stores key */
+    /* Allocates the memory and stores key. New elements go to the new
+     * table while rehashing. */
+    ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
     entry = malloc(sizeof(*entry));
     entry->next = ht->table[index];
     ht->table[index] = entry;
+    ht->used++;
 
     /* Set the hash entry fields. */
-    dictSetHashKey(ht, entry, key);
-    dictSetHashVal(ht, entry, val);
-    ht->used++;
+    dictSetHashKey(d, entry, key);
+    dictSetHashVal(d, entry, val);
     return DICT_OK;
 }
 
@@ -157,15 +234,15 @@ static int dictAdd(dict *ht, void *key, void *val) {
  * Return 1 if the key was added from scratch, 0 if there was already an
  * element with such key and dictReplace() just performed a value update
  * operation. */
-static int dictReplace(dict *ht, void *key, void *val) {
+static int dictReplace(dict *d, void *key, void *val) {
     dictEntry *entry, auxentry;
 
     /* Try to add the element. If the key
      * does not exists dictAdd will suceed. */
-    if (dictAdd(ht, key, val) == DICT_OK)
+    if (dictAdd(d, key, val) == DICT_OK)
         return 1;
     /* It already exists, get the entry */
-    entry = dictFind(ht, key);
+    entry = dictFind(d, key);
     /* Free the old value and set the new one */
     /* Set the new value and free the old one. Note that it is important
      * to do that in this order, as the value may just be exactly the same
@@ -173,44 +250,51 @@ static int dictReplace(dict *ht, void *key, void *val) {
      * you want to increment (set), and then decrement (free), and not the
      * reverse. */
     auxentry = *entry;
-    dictSetHashVal(ht, entry, val);
-    dictFreeEntryVal(ht, &auxentry);
+    dictSetHashVal(d, entry, val);
+    dictFreeEntryVal(d, &auxentry);
     return 0;
 }
 
 /* Search and remove an element */
-static int dictDelete(dict *ht, const void *key) {
-    unsigned int h;
+static int dictDelete(dict *d, const void *key) {
+    unsigned int h, idx;
     dictEntry *de, *prevde;
+    int table;
 
-    if (ht->size == 0)
+    if (d->ht[0].size == 0)
         return DICT_ERR;
-    h = dictHashKey(ht, key) & ht->sizemask;
-    de = ht->table[h];
-
-    prevde = NULL;
-    while(de) {
-        if (dictCompareHashKeys(ht,key,de->key)) {
-            /* Unlink the element from the list */
-            if (prevde)
-                prevde->next = de->next;
-            else
-                ht->table[h] = de->next;
-
-            dictFreeEntryKey(ht,de);
-            dictFreeEntryVal(ht,de);
-            free(de);
-            ht->used--;
-            return DICT_OK;
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    h = dictHashKey(d, key);
+
+    for (table = 0; table <= 1; table++) {
+        idx = h & d->ht[table].sizemask;
+        de = d->ht[table].table[idx];
+        prevde = NULL;
+        while(de) {
+            if (dictCompareHashKeys(d,key,de->key)) {
+                /* Unlink the element from the list */
+                if (prevde)
+                    prevde->next = de->next;
+                else
+                    d->ht[table].table[idx] = de->next;
+
+                dictFreeEntryKey(d,de);
+                dictFreeEntryVal(d,de);
+                free(de);
+                d->ht[table].used--;
+                _dictShrinkIfNeeded(d);
+                return DICT_OK;
+            }
+            prevde = de;
+            de = de->next;
         }
-        prevde = de;
-        de = de->next;
+        if (!dictIsRehashing(d)) break;
     }
     return DICT_ERR; /* not found */
 }
 
 /* Destroy an entire hash table */
-static int _dictClear(dict *ht) {
+static int _dictClear(dict *d, dictht *ht) {
     unsigned long i;
 
     /* Free all the elements */
@@ -220,8 +304,8 @@ static int _dictClear(dict *ht) {
         if ((he = ht->table[i]) == NULL) continue;
         while(he) {
             nextHe = he->next;
-            dictFreeEntryKey(ht, he);
-            dictFreeEntryVal(ht, he);
+            dictFreeEntryKey(d, he);
+            dictFreeEntryVal(d, he);
             free(he);
             ht->used--;
             he = nextHe;
@@ -235,43 +319,86 @@ static int _dictClear(dict *ht) {
 }
 
 /* Clear & Release the hash table */
-static void dictRelease(dict *ht) {
-    _dictClear(ht);
-    free(ht);
+static void dictRelease(dict *d) {
+    _dictClear(d,&d->ht[0]);
+    _dictClear(d,&d->ht[1]);
+    free(d);
 }
 
-static dictEntry *dictFind(dict *ht, const void *key) {
+static dictEntry *dictFind(dict *d, const void *key) {
     dictEntry *he;
     unsigned int h;
+    int table;
 
-    if (ht->size == 0) return NULL;
-    h = dictHashKey(ht, key) & ht->sizemask;
-    he = ht->table[h];
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key))
-            return he;
-        he = he->next;
+    if (d->ht[0].size == 0) return NULL;
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        he = d->ht[table].table[h & d->ht[table].sizemask];
+        while(he) {
+            if (dictCompareHashKeys(d, key, he->key))
+                return he;
+            he = he->next;
+        }
+        if (!dictIsRehashing(d)) break;
     }
     return NULL;
 }
 
-static dictIterator *dictGetIterator(dict *ht) {
+static dictEntry *dictFindBuffer(dict *d, unsigned int hash, const void *buf, size_t len,
+                                 dictBufferMatch *match) {
+    dictEntry *he;
+    int table;
+
+    if (d->ht[0].size == 0) return NULL;
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    for (table = 0; table <= 1; table++) {
+        he = d->ht[table].table[hash & d->ht[table].sizemask];
+        while(he) {
+            if (match(he->key,buf,len))
+                return he;
+            he = he->next;
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+    return NULL;
+}
+
+static int dictReserve(dict *d, unsigned long n) {
+    unsigned long size = dictSize(d)+n;
+
+    if (dictIsRehashing(d) || size <= d->ht[0].size)
+        return DICT_OK;
+    return dictExpand(d, size);
+}
+
+static dictIterator *dictGetIterator(dict *d) {
     dictIterator *iter = malloc(sizeof(*iter));
 
-    iter->ht = ht;
+    iter->d = d;
+    iter->table = 0;
     iter->index = -1;
     iter->entry = NULL;
     iter->nextEntry = NULL;
+    d->iterators++;
     return iter;
 }
 
 static dictEntry *dictNext(dictIterator *iter) {
     while (1) {
         if (iter->entry == NULL) {
+            dictht *ht = &iter->d->ht[iter->table];
             iter->index++;
-            if (iter->index >=
-                    (signed)iter->ht->size) break;
-            iter->entry = iter->ht->table[iter->index];
+            if (iter->index >= (long)ht->size) {
+                if (dictIsRehashing(iter->d) && iter->table == 0) {
+                    iter->table++;
+                    iter->index = 0;
+                    ht = &iter->d->ht[1];
+                } else {
+                    break;
+                }
+            }
+            iter->entry = ht->table[iter->index];
         } else {
             iter->entry = iter->nextEntry;
         }
@@ -286,22 +413,33 @@ static dictEntry *dictNext(dictIterator *iter) {
 }
 
 static void dictReleaseIterator(dictIterator *iter) {
+    iter->d->iterators--;
     free(iter);
 }
 
 /* ------------------------- private functions ------------------------------ */
 
 /* Expand the hash table if needed */
-static int _dictExpandIfNeeded(dict *ht) {
+static int _dictExpandIfNeeded(dict *d) {
+    /* Incremental rehashing already in progress. Return. */
+    if (dictIsRehashing(d)) return DICT_OK;
+
     /* If the hash table is empty expand it to the intial size,
      * if the table is "full" dobule its size. */
-    if (ht->size == 0)
-        return dictExpand(ht, DICT_HT_INITIAL_SIZE);
-    if (ht->used == ht->size)
-        return dictExpand(ht, ht->size*2);
+    if (d->ht[0].size == 0)
+        return dictExpand(d, DICT_HT_INITIAL_SIZE);
+    if (d->ht[0].used >= d->ht[0].size)
+        return dictExpand(d, d->ht[0].used*2);
     return DICT_OK;
 }
 
+/* Shrink the hash table once deletes left it mostly empty */
+static void _dictShrinkIfNeeded(dict *d) {
+    if (!dictIsRehashing(d) && d->ht[0].size > DICT_HT_INITIAL_SIZE &&
+        d->ht[0].used*100 < d->ht[0].size*DICT_HT_MIN_FILL)
+        dictResize(d);
+}
+
 /* Our hash table capability is a power of two */
 static unsigned long _dictNextPower(unsigned long size) {
     unsigned long i = DICT_HT_INITIAL_SIZE;
@@ -316,23 +454,29 @@ static unsigned long _dictNextPower(unsigned long size) {
 
 /* Returns the index of a free slot that can be populated with
  * an hash entry for the given 'key'.
- * If the key already exists, -1 is returned. */
-static int _dictKeyIndex(dict *ht, const void *key) {
-    unsigned int h;
+ * If the key already exists, -1 is returned.
+ * While rehashing, the index is always returned in the context of the
+ * second (new) hash table. */
+static int _dictKeyIndex(dict *d, const void *key) {
+    unsigned int h, idx = 0;
     dictEntry *he;
+    int table;
 
-    /* Expand the hashtable if needed */
-    if (_dictExpandIfNeeded(ht) == DICT_ERR)
+    /* Expand the hash table if needed */
+    if (_dictExpandIfNeeded(d) == DICT_ERR)
         return -1;
     /* Compute the key hash value */
-    h = dictHashKey(ht, key) & ht->sizemask;
-    /* Search if this slot does not already contain the given key */
-    he = ht->table[h];
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key))
-            return -1;
-        he = he->next;
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        idx = h & d->ht[table].sizemask;
+        /* Search if this slot does not already contain the given key */
+        he = d->ht[table].table[idx];
+        while(he) {
+            if (dictCompareHashKeys(d, key, he->key))
+                return -1;
+            he = he->next;
+        }
+        if (!dictIsRehashing(d)) break;
     }
-    return h;
+    return idx;
 }
-
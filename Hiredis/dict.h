@@ -57,24 +57,43 @@ typedef struct dictType {
     void (*valDestructor)(void *privdata, void *obj);
 } dictType;
 
-typedef struct dict {
+/* This is our hash table structure. Every dictionary has two of this as we
+ * implement incremental rehashing, for the old to the new table. */
+typedef struct dictht {
     dictEntry **table;
-    dictType *type;
     unsigned long size;
     unsigned long sizemask;
     unsigned long used;
+} dictht;
+
+typedef struct dict {
+    dictType *type;
     void *privdata;
+    dictht ht[2];
+    long rehashidx; /* rehashing not in progress if rehashidx == -1 */
+    int iterators; /* number of iterators currently running */
 } dict;
 
+/* Whether a key matches the bytes in "buf", see dictFindBuffer(). */
+typedef int (dictBufferMatch)(const void *key, const void *buf, size_t len);
+
 typedef struct dictIterator {
-    dict *ht;
-    int index;
+    dict *d;
+    int table;
+    long index;
     dictEntry *entry, *nextEntry;
 } dictIterator;
 
 /* This is the initial size of every hash table */
 #define DICT_HT_INITIAL_SIZE     4
 
+/* Tables shrink to fit once less than DICT_HT_MIN_FILL percent of their
+ * buckets are in use. */
+#define DICT_HT_MIN_FILL         10
+
+/* Buckets moved to the new table by every operation while rehashing. */
+#define DICT_REHASH_STEP         1
+
 /* ------------------------------- Macros ------------------------------------*/
 #define dictFreeEntryVal(ht, entry) \
     if ((ht)->type->valDestructor) \
@@ -107,19 +126,29 @@ typedef struct dictIterator {
 
 #define dictGetEntryKey(he) ((he)->key)
 #define dictGetEntryVal(he) ((he)->val)
-#define dictSlots(ht) ((ht)->size)
-#define dictSize(ht) ((ht)->used)
+#define dictSlots(d) ((d)->ht[0].size+(d)->ht[1].size)
+#define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used)
+#define dictIsRehashing(d) ((d)->rehashidx != -1)
 
 /* API */
 static unsigned int dictGenHashFunction(const unsigned char *buf, int len);
 static dict *dictCreate(dictType *type, void *privDataPtr);
-static int dictExpand(dict *ht, unsigned long size);
-static int dictAdd(dict *ht, void *key, void *val);
-static int dictReplace(dict *ht, void *key, void *val);
-static int dictDelete(dict *ht, const void *key);
-static void dictRelease(dict *ht);
-static dictEntry * dictFind(dict *ht, const void *key);
-static dictIterator *dictGetIterator(dict *ht);
+static int dictExpand(dict *d, unsigned long size);
+static int dictResize(dict *d);
+static int dictRehash(dict *d, int n);
+static int dictAdd(dict *d, void *key, void *val);
+static int dictReplace(dict *d, void *key, void *val);
+static int dictDelete(dict *d, const void *key);
+static void dictRelease(dict *d);
+static dictEntry * dictFind(dict *d, const void *key);
+/* Find the key matching the bytes in "buf" without building a key to look
+ * it up: "hash" is what the hash function gives for the matching key. */
+static dictEntry *dictFindBuffer(dict *d, unsigned int hash, const void *buf, size_t len,
+                                 dictBufferMatch *match);
+/* Make room for "n" more elements at once, so adding them doesn't grow
+ * the table again and again on the way. */
+static int dictReserve(dict *d, unsigned long n);
+static dictIterator *dictGetIterator(dict *d);
 static dictEntry *dictNext(dictIterator *iter);
 static void dictReleaseIterator(dictIterator *iter);
 
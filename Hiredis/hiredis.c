@@ -604,6 +604,7 @@ static redisContext *redisContextInit(void) {
     c->tcp.source_addr = NULL;
     c->unix_sock.path = NULL;
     c->timeout = NULL;
+    c->sockopts = NULL;
 
     if (c->obuf == NULL || c->reader == NULL) {
         redisFree(c);
@@ -630,6 +631,10 @@ void redisFree(redisContext *c) {
         free(c->unix_sock.path);
     if (c->timeout)
         free(c->timeout);
+    if (c->sockopts)
+        free(c->sockopts);
+    redisContextFreeZeroCopy(c);
+    redisContextFreeRace(c);
     free(c);
 }
 
@@ -650,13 +655,19 @@ int redisReconnect(redisContext *c) {
 
     sdsfree(c->obuf);
     redisReaderFree(c->reader);
+    redisContextFreeZeroCopy(c);
+    c->flags &= ~(REDIS_CORKED|REDIS_CORK_PENDING);
 
     c->obuf = sdsempty();
     c->reader = redisReaderCreate();
 
     if (c->connection_type == REDIS_CONN_TCP) {
-        return redisContextConnectBindTcp(c, c->tcp.host, c->tcp.port,
-                c->timeout, c->tcp.source_addr);
+        if (redisContextConnectBindTcp(c, c->tcp.host, c->tcp.port,
+                c->timeout, c->tcp.source_addr) != REDIS_OK)
+            return REDIS_ERR;
+        if (c->zerocopy.threshold)
+            return redisContextEnableZeroCopy(c);
+        return REDIS_OK;
     } else if (c->connection_type == REDIS_CONN_UNIX) {
         return redisContextConnectUnix(c, c->unix_sock.path, c->timeout);
     } else {
@@ -707,6 +718,47 @@ redisContext *redisConnectNonBlock(const char *ip, int port) {
     return c;
 }
 
+/* Keep a copy of the socket options, applied by every connect. */
+static int __redisStoreSocketOptions(redisContext *c, const redisSocketOptions *opts) {
+    if (c->sockopts == NULL) {
+        c->sockopts = malloc(sizeof(*c->sockopts));
+        if (c->sockopts == NULL) {
+            __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+            return REDIS_ERR;
+        }
+    }
+    memcpy(c->sockopts,opts,sizeof(*opts));
+    return REDIS_OK;
+}
+
+redisContext *redisConnectWithOptions(const char *ip, int port,
+                                      const redisSocketOptions *opts) {
+    redisContext *c;
+
+    c = redisContextInit();
+    if (c == NULL)
+        return NULL;
+
+    c->flags |= REDIS_BLOCK;
+    if (__redisStoreSocketOptions(c,opts) == REDIS_OK)
+        redisContextConnectTcp(c,ip,port,NULL);
+    return c;
+}
+
+redisContext *redisConnectNonBlockWithOptions(const char *ip, int port,
+                                              const redisSocketOptions *opts) {
+    redisContext *c;
+
+    c = redisContextInit();
+    if (c == NULL)
+        return NULL;
+
+    c->flags &= ~REDIS_BLOCK;
+    if (__redisStoreSocketOptions(c,opts) == REDIS_OK)
+        redisContextConnectTcp(c,ip,port,NULL);
+    return c;
+}
+
 redisContext *redisConnectBindNonBlock(const char *ip, int port,
                                        const char *source_addr) {
     redisContext *c = redisContextInit();
@@ -786,20 +838,82 @@ int redisEnableKeepAlive(redisContext *c) {
     return REDIS_OK;
 }
 
-/* Use this function to handle a read event on the descriptor. It will try
- * and read some bytes from the socket and feed them to the reply parser.
- *
- * After this function is called, you may use redisContextReadReply to
- * see if there is a reply available. */
-int redisBufferRead(redisContext *c) {
-    char buf[1024*16];
+/* Set socket options, kept for reconnects. The socket is already past
+ * connect(2), so buffer sizes wait for the next connect. */
+int redisSetSocketOptions(redisContext *c, const redisSocketOptions *opts) {
+    if (__redisStoreSocketOptions(c,opts) != REDIS_OK)
+        return REDIS_ERR;
+
+    if (c->fd >= 0)
+        return redisContextSetSocketOptions(c,0);
+    return REDIS_OK;
+}
+
+/* Read back the socket options in effect. */
+int redisGetSocketOptions(redisContext *c, redisSocketOptions *opts) {
+    return redisContextGetSocketOptions(c,opts);
+}
+
+/* Enable zero-copy sends for output buffers of at least "threshold" bytes. */
+int redisEnableZeroCopy(redisContext *c, size_t threshold) {
+    if (redisContextEnableZeroCopy(c) != REDIS_OK)
+        return REDIS_ERR;
+    c->zerocopy.threshold = threshold ? threshold : REDIS_ZEROCOPY_THRESHOLD;
+    return REDIS_OK;
+}
+
+/* Release zero-copy buffers the kernel reported as sent. Call this when the
+ * event loop reports an error or read event on the socket. */
+int redisHandleZeroCopy(redisContext *c) {
+    if (c->zerocopy.head == NULL)
+        return REDIS_OK;
+    return redisContextReapZeroCopy(c);
+}
+
+int redisCork(redisContext *c) {
+    if (c->flags & REDIS_CORKED)
+        return REDIS_OK;
+    if (redisContextSetCork(c,1) != REDIS_OK)
+        return REDIS_ERR;
+    c->flags |= REDIS_CORKED;
+    return REDIS_OK;
+}
+
+int redisUncork(redisContext *c) {
+    if (!(c->flags & REDIS_CORKED))
+        return REDIS_OK;
+    c->flags &= ~REDIS_CORKED;
+    return redisContextSetCork(c,0);
+}
+
+int redisGetStats(redisContext *c, redisStats *stats) {
+    if (redisContextGetPacketsOut(c,&c->stats.packets_out) != REDIS_OK)
+        return REDIS_ERR;
+    *stats = c->stats;
+    return REDIS_OK;
+}
+
+size_t redisBufferPending(redisContext *c) {
+    size_t pending = sdslen(c->obuf);
+    if (c->zerocopy.cur != NULL)
+        pending += sdslen(c->zerocopy.cur) - c->zerocopy.pos;
+    return pending;
+}
+
+/* Same as redisBufferRead(), setting *nread_out to the number of bytes read
+ * so the caller can tell when the socket is drained. */
+int __redisBufferRead(redisContext *c, size_t *nread_out) {
+    char buf[REDIS_READ_CHUNK];
     int nread;
 
+    if (nread_out != NULL) *nread_out = 0;
+
     /* Return early when the context has seen an error. */
     if (c->err)
         return REDIS_ERR;
 
     nread = read(c->fd,buf,sizeof(buf));
+    c->stats.reads++;
     if (nread == -1) {
         if ((errno == EAGAIN && !(c->flags & REDIS_BLOCK)) || (errno == EINTR)) {
             /* Try again later */
@@ -811,14 +925,29 @@ int redisBufferRead(redisContext *c) {
         __redisSetError(c,REDIS_ERR_EOF,"Server closed the connection");
         return REDIS_ERR;
     } else {
+        c->stats.bytes_read += nread;
         if (redisReaderFeed(c->reader,buf,nread) != REDIS_OK) {
             __redisSetError(c,c->reader->err,c->reader->errstr);
             return REDIS_ERR;
         }
+
+        /* Quick ACK mode is not sticky, the kernel leaves it on its own. */
+        if (c->sockopts && c->sockopts->quickack)
+            redisContextSetQuickAck(c);
+        if (nread_out != NULL) *nread_out = nread;
     }
     return REDIS_OK;
 }
 
+/* Use this function to handle a read event on the descriptor. It will try
+ * and read some bytes from the socket and feed them to the reply parser.
+ *
+ * After this function is called, you may use redisContextReadReply to
+ * see if there is a reply available. */
+int redisBufferRead(redisContext *c) {
+    return __redisBufferRead(c,NULL);
+}
+
 /* Write the output buffer to the socket.
  *
  * Returns REDIS_OK when the buffer is empty, or (a part of) the buffer was
@@ -835,8 +964,20 @@ int redisBufferWrite(redisContext *c, int *done) {
     if (c->err)
         return REDIS_ERR;
 
+    /* Large buffers go out zero-copy, and must be fully sent before the
+     * rest of the output to keep commands in order. */
+    if (c->zerocopy.threshold) {
+        if (redisHandleZeroCopy(c) != REDIS_OK ||
+            redisContextWriteZeroCopy(c) != REDIS_OK)
+            return REDIS_ERR;
+        if (c->zerocopy.cur != NULL) {
+            if (done != NULL) *done = 0;
+            return REDIS_OK;
+        }
+    }
+
     if (sdslen(c->obuf) > 0) {
-        nwritten = write(c->fd,c->obuf,sdslen(c->obuf));
+        nwritten = redisContextWrite(c,c->obuf,sdslen(c->obuf),0);
         if (nwritten == -1) {
             if ((errno == EAGAIN && !(c->flags & REDIS_BLOCK)) || (errno == EINTR)) {
                 /* Try again later */
@@ -877,6 +1018,10 @@ int redisGetReply(redisContext *c, void **reply) {
 
     /* For the blocking context, flush output buffer and read reply */
     if (aux == NULL && c->flags & REDIS_BLOCK) {
+        /* Waiting for a reply ends a corked batch */
+        if (redisUncork(c) != REDIS_OK)
+            return REDIS_ERR;
+
         /* Write until done */
         do {
             if (redisBufferWrite(c,&wdone) == REDIS_ERR)
@@ -73,12 +73,40 @@
 /* Flag that is set when we should set SO_REUSEADDR before calling bind() */
 #define REDIS_REUSEADDR 0x80
 
+/* Flag that is set while writes are corked, see redisCork(). */
+#define REDIS_CORKED 0x100
+
+/* Flag that is set when the kernel may hold back data written while corked,
+ * until the next uncorked write or an explicit push. */
+#define REDIS_CORK_PENDING 0x200
+
+/* Flag specific to the async API, set from the moment a connection is lost
+ * until it is established again, see redisAsyncEnableReconnect(). */
+#define REDIS_RECONNECTING 0x400
+
 #define REDIS_KEEPALIVE_INTERVAL 15 /* seconds */
 
+/* Number of bytes read from the socket at once. */
+#define REDIS_READ_CHUNK (1024*16)
+
 /* number of times we retry to connect in the case of EADDRNOTAVAIL and
  * SO_REUSEADDR is being used. */
 #define REDIS_CONNECT_RETRIES  10
 
+/* Head start in msec a connect attempt gets before the next candidate
+ * address is tried in parallel (RFC 8305 "Connection Attempt Delay"). */
+#define REDIS_CONNECT_ATTEMPT_DELAY 250
+
+/* Resolved addresses are shared by all contexts and kept for this many
+ * seconds, see redisSetResolverCacheTTL(). */
+#define REDIS_RESOLVER_CACHE_TTL 60
+#define REDIS_RESOLVER_CACHE_SIZE 64
+
+/* Default minimum size of the output buffer for it to be sent with
+ * MSG_ZEROCOPY, see redisEnableZeroCopy(). Below this, copying is cheaper
+ * than pinning pages and handling completions. */
+#define REDIS_ZEROCOPY_THRESHOLD (64*1024)
+
 /* strerror_r has two completely different prototypes and behaviors
  * depending on system issues, so we need to operate on the error buffer
  * differently depending on which strerror_r we're using. */
@@ -130,6 +158,39 @@ int redisFormatSdsCommandArgv(sds *target, int argc, const char ** argv, const s
 void redisFreeCommand(char *cmd);
 void redisFreeSdsCommand(sds cmd);
 
+/* Socket options applied every time a context connects or reconnects, see
+ * redisConnectWithOptions() and redisSetSocketOptions(). Zero fields are left at the system default and
+ * options the platform lacks are ignored. */
+typedef struct redisSocketOptions {
+    int rcvbuf; /* SO_RCVBUF, bytes */
+    int sndbuf; /* SO_SNDBUF, bytes */
+    int quickack; /* TCP_QUICKACK, re-armed after every read (Linux) */
+    int user_timeout; /* TCP_USER_TIMEOUT, msec (Linux) */
+    int busy_poll; /* SO_BUSY_POLL, usec (Linux) */
+    int notsent_lowat; /* TCP_NOTSENT_LOWAT, bytes */
+    int priority; /* SO_PRIORITY (Linux) */
+} redisSocketOptions;
+
+/* Output buffer sent with MSG_ZEROCOPY, kept until the kernel reports it
+ * doesn't need the pages anymore. */
+typedef struct redisZeroCopyBuf {
+    struct redisZeroCopyBuf *next;
+    char *buf; /* sds */
+    uint32_t last; /* sequence number of the last send from this buffer */
+} redisZeroCopyBuf;
+
+/* I/O counters of a context. Calls count system calls, including the ones
+ * that would block. */
+typedef struct redisStats {
+    unsigned long long reads; /* read calls */
+    unsigned long long writes; /* write and send calls */
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+    unsigned long long pushes; /* corked data explicitly pushed out */
+    unsigned long long packets_out; /* TCP segments sent on the current
+                                       socket, 0 when unknown */
+} redisStats;
+
 enum redisConnectionType {
     REDIS_CONN_TCP,
     REDIS_CONN_UNIX,
@@ -146,6 +207,20 @@ typedef struct redisContext {
 
     enum redisConnectionType connection_type;
     struct timeval *timeout;
+    redisSocketOptions *sockopts;
+
+    /* Zero-copy sends (Linux only). While a buffer is being sent it is
+     * moved out of obuf, so new commands can't reallocate it. */
+    struct {
+        size_t threshold; /* 0 when disabled */
+        char *cur; /* sds being sent, NULL if none */
+        size_t pos; /* bytes of cur sent so far */
+        int pinned; /* whether any of cur went out with MSG_ZEROCOPY */
+        uint32_t seq; /* number of zero-copy sends issued */
+        redisZeroCopyBuf *head, *tail; /* buffers awaiting completion */
+    } zerocopy;
+
+    redisStats stats;
 
     struct {
         char *host;
@@ -153,6 +228,16 @@ typedef struct redisContext {
         int port;
     } tcp;
 
+    /* Connect race of a non-blocking context, see redisContextRaceStep():
+     * the addresses left to try and the attempts in flight besides fd. */
+    struct {
+        struct redisRaceAddr *addrs; /* NULL when not racing */
+        int naddrs, next;
+        int *fds;
+        int nfds;
+        long long at; /* monotonic usec to step the race again */
+    } race;
+
     struct {
         char *path;
     } unix_sock;
@@ -162,6 +247,12 @@ typedef struct redisContext {
 redisContext *redisConnect(const char *ip, int port);
 redisContext *redisConnectWithTimeout(const char *ip, int port, const struct timeval tv);
 redisContext *redisConnectNonBlock(const char *ip, int port);
+/* Connect with socket options set before connect(2), which buffer sizes
+ * need to take effect on the first connection. */
+redisContext *redisConnectWithOptions(const char *ip, int port,
+                                      const redisSocketOptions *opts);
+redisContext *redisConnectNonBlockWithOptions(const char *ip, int port,
+                                              const redisSocketOptions *opts);
 redisContext *redisConnectBindNonBlock(const char *ip, int port,
                                        const char *source_addr);
 redisContext *redisConnectBindNonBlockWithReuse(const char *ip, int port,
@@ -182,8 +273,47 @@ redisContext *redisConnectFd(int fd);
  */
 int redisReconnect(redisContext *c);
 
+/* Resolve a host in a helper thread, storing the result in the shared
+ * resolver cache so a following connect doesn't block on DNS. The callback
+ * is called from the helper thread with REDIS_OK, or REDIS_ERR and what the
+ * resolver reported. */
+typedef void (redisResolveCallback)(int status, const char *errstr, void *privdata);
+int redisResolveAsync(const char *host, int port, redisResolveCallback *fn, void *privdata);
+
+/* Set how long resolved addresses are cached, 0 disables the cache. */
+void redisSetResolverCacheTTL(int seconds);
+
 int redisSetTimeout(redisContext *c, const struct timeval tv);
 int redisEnableKeepAlive(redisContext *c);
+
+/* Set socket options, applying them right away and on every reconnect.
+ * Buffer sizes only apply from the next connect, use
+ * redisConnectWithOptions() to have them on the first one. The effective
+ * values, as reported by the kernel, can be read back with
+ * redisGetSocketOptions(). */
+int redisSetSocketOptions(redisContext *c, const redisSocketOptions *opts);
+int redisGetSocketOptions(redisContext *c, redisSocketOptions *opts);
+
+/* Send output of at least "threshold" bytes (0 for the default) with
+ * MSG_ZEROCOPY. Only available on Linux, REDIS_ERR otherwise. Completions
+ * arrive on the socket error queue: event loops get a read or error event
+ * and redisHandleZeroCopy() releases the buffers. The async API and
+ * redisBufferWrite() call it on their own. */
+int redisEnableZeroCopy(redisContext *c, size_t threshold);
+int redisHandleZeroCopy(redisContext *c);
+
+/* Number of bytes waiting to be written to the socket. */
+size_t redisBufferPending(redisContext *c);
+
+/* Cork writes for a batch, so the kernel packs them into full segments
+ * instead of sending every write on its own (MSG_MORE on Linux, TCP_NOPUSH
+ * on BSD and OS X). redisUncork() ends the batch and pushes out what is
+ * held back; redisGetReply() does so before waiting for a reply. */
+int redisCork(redisContext *c);
+int redisUncork(redisContext *c);
+
+/* Copy the I/O counters, querying the kernel for the packet count. */
+int redisGetStats(redisContext *c, redisStats *stats);
 void redisFree(redisContext *c);
 int redisFreeKeepFd(redisContext *c);
 int redisBufferRead(redisContext *c);
@@ -15,10 +15,16 @@ typedef struct {
     redisAsyncContext *context;
     CFSocketRef socketRef;
     CFRunLoopSourceRef sourceRef;
+    CFRunLoopTimerRef timerRef;
+    CFRunLoopRef runLoop;
 } RedisRunLoop;
 
 static int freeRedisRunLoop(RedisRunLoop* redisRunLoop) {
     if( redisRunLoop != NULL ) {
+        if( redisRunLoop->timerRef != NULL ) {
+            CFRunLoopTimerInvalidate(redisRunLoop->timerRef);
+            CFRelease(redisRunLoop->timerRef);
+        }
         if( redisRunLoop->sourceRef != NULL ) {
             CFRunLoopSourceInvalidate(redisRunLoop->sourceRef);
             CFRelease(redisRunLoop->sourceRef);
@@ -34,22 +40,44 @@ static int freeRedisRunLoop(RedisRunLoop* redisRunLoop) {
 
 static void redisMacOSAddRead(void *privdata) {
     RedisRunLoop *redisRunLoop = (RedisRunLoop*)privdata;
-    CFSocketEnableCallBacks(redisRunLoop->socketRef, kCFSocketReadCallBack);
+    if( redisRunLoop->socketRef ) CFSocketEnableCallBacks(redisRunLoop->socketRef, kCFSocketReadCallBack);
 }
 
 static void redisMacOSDelRead(void *privdata) {
     RedisRunLoop *redisRunLoop = (RedisRunLoop*)privdata;
-    CFSocketDisableCallBacks(redisRunLoop->socketRef, kCFSocketReadCallBack);
+    if( redisRunLoop->socketRef ) CFSocketDisableCallBacks(redisRunLoop->socketRef, kCFSocketReadCallBack);
 }
 
 static void redisMacOSAddWrite(void *privdata) {
     RedisRunLoop *redisRunLoop = (RedisRunLoop*)privdata;
-    CFSocketEnableCallBacks(redisRunLoop->socketRef, kCFSocketWriteCallBack);
+    if( redisRunLoop->socketRef ) CFSocketEnableCallBacks(redisRunLoop->socketRef, kCFSocketWriteCallBack);
 }
 
 static void redisMacOSDelWrite(void *privdata) {
     RedisRunLoop *redisRunLoop = (RedisRunLoop*)privdata;
-    CFSocketDisableCallBacks(redisRunLoop->socketRef, kCFSocketWriteCallBack);
+    if( redisRunLoop->socketRef ) CFSocketDisableCallBacks(redisRunLoop->socketRef, kCFSocketWriteCallBack);
+}
+
+static int redisMacOSCreateSocket(RedisRunLoop *redisRunLoop);
+
+/* Reconnecting replaced the socket: watch the new one instead. */
+static void redisMacOSReattach(void *privdata) {
+    RedisRunLoop *redisRunLoop = (RedisRunLoop*)privdata;
+
+    if( redisRunLoop->sourceRef != NULL ) {
+        CFRunLoopSourceInvalidate(redisRunLoop->sourceRef);
+        CFRelease(redisRunLoop->sourceRef);
+        redisRunLoop->sourceRef = NULL;
+    }
+    if( redisRunLoop->socketRef != NULL ) {
+        CFSocketInvalidate(redisRunLoop->socketRef);
+        CFRelease(redisRunLoop->socketRef);
+        redisRunLoop->socketRef = NULL;
+    }
+
+    /* Without a socket the events are lost: the connect timeout, when set,
+       takes the connection down again. */
+    redisMacOSCreateSocket(redisRunLoop);
 }
 
 static void redisMacOSCleanup(void *privdata) {
@@ -57,6 +85,28 @@ static void redisMacOSCleanup(void *privdata) {
     freeRedisRunLoop(redisRunLoop);
 }
 
+static void redisMacOSTimerCallback(CFRunLoopTimerRef __unused timer, void *info) {
+    redisAsyncContext* context = (redisAsyncContext*) info;
+    redisAsyncHandleTimeout(context);
+}
+
+static void redisMacOSScheduleTimer(void *privdata, struct timeval tv) {
+    RedisRunLoop *redisRunLoop = (RedisRunLoop*)privdata;
+    CFAbsoluteTime fireDate = CFAbsoluteTimeGetCurrent() + tv.tv_sec + tv.tv_usec / 1000000.0;
+
+    if( redisRunLoop->timerRef == NULL ) {
+        /* One-shot in practice: the interval is far away and every fire
+         * re-arms the timer through this hook when needed. */
+        CFRunLoopTimerContext timerCtx = { 0, redisRunLoop->context, NULL, NULL, NULL };
+        redisRunLoop->timerRef = CFRunLoopTimerCreate(NULL, fireDate, 365 * 24 * 3600.0, 0, 0,
+                                                      redisMacOSTimerCallback, &timerCtx);
+        if( !redisRunLoop->timerRef ) return;
+        CFRunLoopAddTimer(redisRunLoop->runLoop, redisRunLoop->timerRef, kCFRunLoopDefaultMode);
+    } else {
+        CFRunLoopTimerSetNextFireDate(redisRunLoop->timerRef, fireDate);
+    }
+}
+
 static void redisMacOSAsyncCallback(CFSocketRef __unused s, CFSocketCallBackType callbackType, CFDataRef __unused address, const void __unused *data, void *info) {
     redisAsyncContext* context = (redisAsyncContext*) info;
     
@@ -74,9 +124,29 @@ static void redisMacOSAsyncCallback(CFSocketRef __unused s, CFSocketCallBackType
     }
 }
 
+/* The socket is closed by hiredis, not when it is invalidated: a reconnect
+   invalidates the old one after the new connection took over. */
+static int redisMacOSCreateSocket(RedisRunLoop *redisRunLoop) {
+    CFSocketContext socketCtx = { 0, redisRunLoop->context, NULL, NULL, NULL };
+
+    redisRunLoop->socketRef = CFSocketCreateWithNative(NULL, redisRunLoop->context->c.fd,
+                                                       kCFSocketReadCallBack | kCFSocketWriteCallBack,
+                                                       redisMacOSAsyncCallback,
+                                                       &socketCtx);
+    if( !redisRunLoop->socketRef ) return REDIS_ERR;
+
+    CFSocketSetSocketFlags(redisRunLoop->socketRef,
+                           CFSocketGetSocketFlags(redisRunLoop->socketRef) & ~kCFSocketCloseOnInvalidate);
+
+    redisRunLoop->sourceRef = CFSocketCreateRunLoopSource(NULL, redisRunLoop->socketRef, 0);
+    if( !redisRunLoop->sourceRef ) return REDIS_ERR;
+
+    CFRunLoopAddSource(redisRunLoop->runLoop, redisRunLoop->sourceRef, kCFRunLoopDefaultMode);
+
+    return REDIS_OK;
+}
+
 static int redisMacOSAttach(redisAsyncContext *redisAsyncCtx, CFRunLoopRef runLoop) {
-    redisContext *redisCtx = &(redisAsyncCtx->c);
-    
     /* Nothing should be attached when something is already attached */
     if( redisAsyncCtx->ev.data != NULL ) return REDIS_ERR;
     
@@ -85,27 +155,19 @@ static int redisMacOSAttach(redisAsyncContext *redisAsyncCtx, CFRunLoopRef runLo
     
     /* Setup redis stuff */
     redisRunLoop->context = redisAsyncCtx;
+    redisRunLoop->runLoop = runLoop;
     
     redisAsyncCtx->ev.addRead  = redisMacOSAddRead;
     redisAsyncCtx->ev.delRead  = redisMacOSDelRead;
     redisAsyncCtx->ev.addWrite = redisMacOSAddWrite;
     redisAsyncCtx->ev.delWrite = redisMacOSDelWrite;
     redisAsyncCtx->ev.cleanup  = redisMacOSCleanup;
+    redisAsyncCtx->ev.scheduleTimer = redisMacOSScheduleTimer;
+    redisAsyncCtx->ev.reattach = redisMacOSReattach;
     redisAsyncCtx->ev.data     = redisRunLoop;
     
     /* Initialize and install read/write events */
-    CFSocketContext socketCtx = { 0, redisAsyncCtx, NULL, NULL, NULL };
-    
-    redisRunLoop->socketRef = CFSocketCreateWithNative(NULL, redisCtx->fd,
-                                                       kCFSocketReadCallBack | kCFSocketWriteCallBack,
-                                                       redisMacOSAsyncCallback,
-                                                       &socketCtx);
-    if( !redisRunLoop->socketRef ) return freeRedisRunLoop(redisRunLoop);
-    
-    redisRunLoop->sourceRef = CFSocketCreateRunLoopSource(NULL, redisRunLoop->socketRef, 0);
-    if( !redisRunLoop->sourceRef ) return freeRedisRunLoop(redisRunLoop);
-    
-    CFRunLoopAddSource(runLoop, redisRunLoop->sourceRef, kCFRunLoopDefaultMode);
+    if( redisMacOSCreateSocket(redisRunLoop) != REDIS_OK ) return freeRedisRunLoop(redisRunLoop);
     
     return REDIS_OK;
 }
@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "mux.h"
+#include "command.h"
+#include "net.h"
+
+/* Set while redisMuxDisconnect() walks the connections, so the multiplexer
+ * isn't free'd under its feet. */
+#define REDIS_MUX_IN_DISCONNECT 0x8
+
+static int __redisMuxConnectSlot(redisMuxContext *mux, int i);
+
+static void __redisMuxFreeStorage(redisMuxContext *mux) {
+    free(mux->conns);
+    free(mux->retry);
+    free(mux->balance);
+    free(mux->host);
+    free(mux);
+}
+
+static int __redisMuxIndex(redisMuxContext *mux, const redisAsyncContext *ac) {
+    int i;
+    for (i = 0; i < mux->nconns; i++)
+        if (mux->conns[i] == ac)
+            return i;
+    return -1;
+}
+
+/* Free the multiplexer once redisMuxDisconnect() closed every connection. */
+static void __redisMuxCheckGone(redisMuxContext *mux) {
+    int i;
+
+    if (!(mux->flags & REDIS_MUX_DISCONNECTING) || (mux->flags & REDIS_MUX_IN_DISCONNECT))
+        return;
+    for (i = 0; i < mux->nconns; i++)
+        if (mux->conns[i] != NULL)
+            return;
+    __redisMuxFreeStorage(mux);
+}
+
+static void __redisMuxOnConnect(const redisAsyncContext *ac, int status) {
+    redisMuxContext *mux = ac->data;
+    int i;
+
+    if (status == REDIS_OK || mux == NULL || (i = __redisMuxIndex(mux,ac)) == -1)
+        return;
+
+    /* The context is free'd after this callback, try again later. */
+    mux->conns[i] = NULL;
+    __redisMuxCheckGone(mux);
+}
+
+static void __redisMuxOnDisconnect(const redisAsyncContext *ac, int status) {
+    redisMuxContext *mux = ac->data;
+    int i;
+
+    ((void)status);
+    if (mux == NULL || (i = __redisMuxIndex(mux,ac)) == -1)
+        return;
+
+    mux->conns[i] = NULL;
+    if (mux->flags & REDIS_MUX_DISCONNECTING) {
+        __redisMuxCheckGone(mux);
+        return;
+    }
+
+    /* Connect again right away. Being empty, the new connection is the
+     * first choice for new commands. */
+    __redisMuxConnectSlot(mux,i);
+}
+
+static int __redisMuxConnectSlot(redisMuxContext *mux, int i) {
+    redisAsyncContext *ac;
+
+    mux->retry[i] = redisNowUsec()+REDIS_MUX_RETRY_INTERVAL*1000LL;
+    if (mux->type == REDIS_CONN_TCP)
+        ac = redisAsyncConnect(mux->host,mux->port);
+    else
+        ac = redisAsyncConnectUnix(mux->host);
+    if (ac == NULL)
+        return REDIS_ERR;
+
+    if (ac->err || mux->attach(ac,mux->attachdata) != REDIS_OK) {
+        redisAsyncFree(ac);
+        return REDIS_ERR;
+    }
+
+    ac->data = mux;
+    redisAsyncSetConnectCallback(ac,__redisMuxOnConnect);
+    redisAsyncSetDisconnectCallback(ac,__redisMuxOnDisconnect);
+    mux->conns[i] = ac;
+    mux->balance[i].ejected = 0;
+    return REDIS_OK;
+}
+
+static redisMuxContext *__redisMuxConnect(enum redisConnectionType type, const char *host, int port,
+                                          int n, redisMuxAttachCallback *attach, void *privdata)
+{
+    redisMuxContext *mux;
+    int i;
+
+    if (n < 1 || attach == NULL)
+        return NULL;
+
+    mux = calloc(1,sizeof(*mux));
+    if (mux == NULL)
+        return NULL;
+
+    mux->nconns = n;
+    mux->type = type;
+    mux->port = port;
+    mux->attach = attach;
+    mux->attachdata = privdata;
+    redisBalancerInit(&mux->balancer);
+    mux->conns = calloc(n,sizeof(redisAsyncContext*));
+    mux->retry = calloc(n,sizeof(long long));
+    mux->balance = calloc(n,sizeof(redisBalanceEndpoint));
+    mux->host = strdup(host);
+    if (mux->conns == NULL || mux->retry == NULL || mux->balance == NULL || mux->host == NULL) {
+        __redisMuxFreeStorage(mux);
+        return NULL;
+    }
+
+    /* Connections failing now are retried when commands come in. */
+    for (i = 0; i < n; i++)
+        __redisMuxConnectSlot(mux,i);
+    return mux;
+}
+
+redisMuxContext *redisMuxConnect(const char *ip, int port, int n,
+                                 redisMuxAttachCallback *attach, void *privdata)
+{
+    return __redisMuxConnect(REDIS_CONN_TCP,ip,port,n,attach,privdata);
+}
+
+redisMuxContext *redisMuxConnectUnix(const char *path, int n,
+                                     redisMuxAttachCallback *attach, void *privdata)
+{
+    return __redisMuxConnect(REDIS_CONN_UNIX,path,0,n,attach,privdata);
+}
+
+void redisMuxEnableKeyOrdering(redisMuxContext *mux) {
+    mux->flags |= REDIS_MUX_KEY_ORDERING;
+}
+
+void redisMuxDisconnect(redisMuxContext *mux) {
+    redisAsyncContext *ac;
+    int i;
+
+    mux->flags |= REDIS_MUX_DISCONNECTING|REDIS_MUX_IN_DISCONNECT;
+    for (i = 0; i < mux->nconns; i++) {
+        if ((ac = mux->conns[i]) == NULL)
+            continue;
+
+        /* A context that never connected is free'd without telling. */
+        if (!(ac->c.flags & REDIS_CONNECTED) && ac->replies.len == 0) {
+            mux->conns[i] = NULL;
+            ac->data = NULL;
+            redisAsyncFree(ac);
+        } else {
+            redisAsyncDisconnect(ac);
+        }
+    }
+    mux->flags &= ~REDIS_MUX_IN_DISCONNECT;
+    __redisMuxCheckGone(mux);
+}
+
+void redisMuxFree(redisMuxContext *mux) {
+    redisAsyncContext *ac;
+    int i;
+
+    mux->flags |= REDIS_MUX_FREEING;
+    for (i = 0; i < mux->nconns; i++) {
+        if ((ac = mux->conns[i]) == NULL)
+            continue;
+        mux->conns[i] = NULL;
+        ac->data = NULL;
+        redisAsyncFree(ac);
+    }
+    __redisMuxFreeStorage(mux);
+}
+
+static int __redisMuxUsable(redisAsyncContext *ac, int flags) {
+    return ac != NULL && !(ac->c.flags & (REDIS_DISCONNECTING|REDIS_FREEING)) &&
+           (ac->c.flags & flags) == flags;
+}
+
+/* The connections a command can go to, for the balancer. */
+typedef struct redisMuxChoice {
+    redisMuxContext *mux;
+    int flags;
+} redisMuxChoice;
+
+static redisAsyncContext *__redisMuxGet(void *ctx, int i, redisBalanceEndpoint **ep) {
+    redisMuxChoice *choice = ctx;
+    redisMuxContext *mux = choice->mux;
+
+    if (!__redisMuxUsable(mux->conns[i],choice->flags))
+        return NULL;
+    *ep = &mux->balance[i];
+    return mux->conns[i];
+}
+
+/* Pick the connection for a command. Connections that are up are preferred
+ * over the ones still connecting. */
+static redisAsyncContext *__redisMuxPick(redisMuxContext *mux, const char *cmd, size_t len) {
+    redisMuxChoice choice;
+    long long now = 0;
+    const char *key;
+    size_t keylen;
+    int i, n = 0, flags = 0;
+
+    if (mux->flags & (REDIS_MUX_DISCONNECTING|REDIS_MUX_FREEING))
+        return NULL;
+
+    for (i = 0; i < mux->nconns; i++) {
+        if (mux->conns[i] != NULL)
+            continue;
+        if (now == 0) now = redisNowUsec();
+        if (mux->retry[i] <= now)
+            __redisMuxConnectSlot(mux,i);
+    }
+
+    /* A key stays on its slot whatever state the connections are in, so
+     * its commands can't overtake each other. A connection still being
+     * established buffers them, they fail while the slot is down. */
+    if ((mux->flags & REDIS_MUX_KEY_ORDERING) &&
+        redisFormattedCommandKey(cmd,len,&key,&keylen))
+    {
+        i = redisFnv1a(REDIS_FNV_BASIS,key,keylen,0) % mux->nconns;
+        return __redisMuxUsable(mux->conns[i],0) ? mux->conns[i] : NULL;
+    }
+
+    for (i = 0; i < mux->nconns; i++) {
+        if (__redisMuxUsable(mux->conns[i],REDIS_CONNECTED)) {
+            flags = REDIS_CONNECTED;
+            break;
+        }
+    }
+    for (i = 0; i < mux->nconns; i++)
+        if (__redisMuxUsable(mux->conns[i],flags))
+            n++;
+    if (n == 0)
+        return NULL;
+
+    choice.mux = mux;
+    choice.flags = flags;
+    i = redisBalancerPick(&mux->balancer,&choice,mux->nconns,__redisMuxGet);
+    return i != -1 ? mux->conns[i] : NULL;
+}
+
+int redisMuxFormattedCommand(redisMuxContext *mux, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len) {
+    redisAsyncContext *ac = __redisMuxPick(mux,cmd,len);
+    if (ac == NULL)
+        return REDIS_ERR;
+    return redisAsyncFormattedCommand(ac,fn,privdata,cmd,len);
+}
+
+int redisvMuxCommand(redisMuxContext *mux, redisCallbackFn *fn, void *privdata, const char *format, va_list ap) {
+    char *cmd;
+    int len;
+    int status;
+    len = redisvFormatCommand(&cmd,format,ap);
+
+    /* We don't want to pass -1 or -2 to future functions as a length. */
+    if (len < 0)
+        return REDIS_ERR;
+
+    status = redisMuxFormattedCommand(mux,fn,privdata,cmd,len);
+    free(cmd);
+    return status;
+}
+
+int redisMuxCommand(redisMuxContext *mux, redisCallbackFn *fn, void *privdata, const char *format, ...) {
+    va_list ap;
+    int status;
+    va_start(ap,format);
+    status = redisvMuxCommand(mux,fn,privdata,format,ap);
+    va_end(ap);
+    return status;
+}
+
+int redisMuxCommandArgv(redisMuxContext *mux, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen) {
+    sds cmd;
+    int len;
+    int status;
+    len = redisFormatSdsCommandArgv(&cmd,argc,argv,argvlen);
+    if (len < 0)
+        return REDIS_ERR;
+    status = redisMuxFormattedCommand(mux,fn,privdata,cmd,len);
+    sdsfree(cmd);
+    return status;
+}
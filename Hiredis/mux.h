@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_MUX_H
+#define __HIREDIS_MUX_H
+#include "async.h"
+#include "balance.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Msec to wait before connecting again after a failed attempt. */
+#define REDIS_MUX_RETRY_INTERVAL 1000
+
+/* Commands with a key always go to the same connection, so commands on one
+ * key are executed in the order they were issued. They are buffered while
+ * that connection is being established and refused while it is down. */
+#define REDIS_MUX_KEY_ORDERING 0x1
+
+/* Flags set while the multiplexer goes away. */
+#define REDIS_MUX_DISCONNECTING 0x2
+#define REDIS_MUX_FREEING 0x4
+
+/* Hook attaching a new connection to the event library, e.g. a wrapper
+ * around redisMacOSAttach(). Returns REDIS_OK or REDIS_ERR. */
+typedef int (redisMuxAttachCallback)(redisAsyncContext *ac, void *privdata);
+
+/* Several async connections to one server, used as one. Every command goes
+ * to the better of two connections taken at random, by their reply latency
+ * and the replies they have pending, or by the hash of its key when key
+ * ordering is enabled. A connection whose latency spikes gets no commands
+ * for a while, see balance.h. Dropped connections are connected again
+ * and take their share of commands once they are back. Pub/sub, MULTI and
+ * other commands changing the state of a connection can't be used. */
+typedef struct redisMuxContext {
+    redisAsyncContext **conns; /* NULL while a connection is down */
+    long long *retry; /* monotonic usec a down connection is retried at */
+    redisBalanceEndpoint *balance; /* balancing state of every connection */
+    int nconns;
+    int flags;
+    redisBalancer balancer;
+
+    enum redisConnectionType type;
+    char *host; /* or path of the unix socket */
+    int port;
+
+    redisMuxAttachCallback *attach;
+    void *attachdata;
+} redisMuxContext;
+
+/* Open "n" connections to a server. */
+redisMuxContext *redisMuxConnect(const char *ip, int port, int n,
+                                 redisMuxAttachCallback *attach, void *privdata);
+redisMuxContext *redisMuxConnectUnix(const char *path, int n,
+                                     redisMuxAttachCallback *attach, void *privdata);
+void redisMuxEnableKeyOrdering(redisMuxContext *mux);
+
+/* Close the connections once pending replies are read, the multiplexer is
+ * free'd with the last one. */
+void redisMuxDisconnect(redisMuxContext *mux);
+void redisMuxFree(redisMuxContext *mux);
+
+/* Commands, like their redisAsyncCommand() counterparts. REDIS_ERR is
+ * returned when no connection could take the command. */
+int redisvMuxCommand(redisMuxContext *mux, redisCallbackFn *fn, void *privdata, const char *format, va_list ap);
+int redisMuxCommand(redisMuxContext *mux, redisCallbackFn *fn, void *privdata, const char *format, ...);
+int redisMuxCommandArgv(redisMuxContext *mux, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen);
+int redisMuxFormattedCommand(redisMuxContext *mux, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
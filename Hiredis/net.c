@@ -50,6 +50,12 @@
 #include <poll.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#endif
 
 #include "net.h"
 #include "sds.h"
@@ -57,6 +63,31 @@
 /* Defined in hiredis.c */
 void __redisSetError(redisContext *c, int type, const char *str);
 
+/* Monotonic clock in microseconds, used for connect races and deadlines. */
+long long redisNowUsec(void) {
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC,&ts) == 0)
+        return (long long)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+#endif
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (long long)tv.tv_sec*1000000 + tv.tv_usec;
+}
+
+unsigned int redisFnv1a(unsigned int h, const char *buf, size_t len, int nocase) {
+    unsigned char c;
+
+    while (len--) {
+        c = (unsigned char)*buf++;
+        if (nocase && c >= 'A' && c <= 'Z')
+            c += 'a'-'A';
+        h ^= c;
+        h *= 16777619U;
+    }
+    return h;
+}
+
 static void redisContextCloseFd(redisContext *c) {
     if (c && c->fd >= 0) {
         close(c->fd);
@@ -176,6 +207,371 @@ static int redisSetTcpNoDelay(redisContext *c) {
     return REDIS_OK;
 }
 
+static int redisSetSocketOption(redisContext *c, int level, int name, int val,
+                                const char *label)
+{
+    if (setsockopt(c->fd, level, name, &val, sizeof(val)) == -1) {
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,label);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+static int redisGetSocketOption(redisContext *c, int level, int name, int *val) {
+    socklen_t len = sizeof(*val);
+    if (getsockopt(c->fd, level, name, val, &len) == -1) {
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,"getsockopt");
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* Apply the options stored in c->sockopts to the socket. Buffer sizes must
+ * be set before connect(2) for the window scale to be negotiated, so they
+ * are skipped when "preconnect" is 0 and only used by the next connect. */
+int redisContextSetSocketOptions(redisContext *c, int preconnect) {
+    redisSocketOptions *o = c->sockopts;
+    int tcp = (c->connection_type == REDIS_CONN_TCP);
+
+    if (o == NULL)
+        return REDIS_OK;
+
+    if (preconnect) {
+        if (o->rcvbuf && redisSetSocketOption(c,SOL_SOCKET,SO_RCVBUF,o->rcvbuf,
+                                              "setsockopt(SO_RCVBUF)") != REDIS_OK)
+            return REDIS_ERR;
+        if (o->sndbuf && redisSetSocketOption(c,SOL_SOCKET,SO_SNDBUF,o->sndbuf,
+                                              "setsockopt(SO_SNDBUF)") != REDIS_OK)
+            return REDIS_ERR;
+    }
+#ifdef SO_BUSY_POLL
+    if (o->busy_poll && redisSetSocketOption(c,SOL_SOCKET,SO_BUSY_POLL,o->busy_poll,
+                                             "setsockopt(SO_BUSY_POLL)") != REDIS_OK)
+        return REDIS_ERR;
+#endif
+#ifdef SO_PRIORITY
+    if (o->priority && redisSetSocketOption(c,SOL_SOCKET,SO_PRIORITY,o->priority,
+                                            "setsockopt(SO_PRIORITY)") != REDIS_OK)
+        return REDIS_ERR;
+#endif
+    if (!tcp)
+        return REDIS_OK;
+
+#ifdef TCP_QUICKACK
+    if (o->quickack && redisSetSocketOption(c,IPPROTO_TCP,TCP_QUICKACK,1,
+                                            "setsockopt(TCP_QUICKACK)") != REDIS_OK)
+        return REDIS_ERR;
+#endif
+#ifdef TCP_USER_TIMEOUT
+    if (o->user_timeout && redisSetSocketOption(c,IPPROTO_TCP,TCP_USER_TIMEOUT,o->user_timeout,
+                                                "setsockopt(TCP_USER_TIMEOUT)") != REDIS_OK)
+        return REDIS_ERR;
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+    if (o->notsent_lowat && redisSetSocketOption(c,IPPROTO_TCP,TCP_NOTSENT_LOWAT,o->notsent_lowat,
+                                                 "setsockopt(TCP_NOTSENT_LOWAT)") != REDIS_OK)
+        return REDIS_ERR;
+#endif
+    return REDIS_OK;
+}
+
+/* Read the options in effect from the socket. Note that Linux reports
+ * twice the buffer sizes that were asked for, to account for bookkeeping
+ * overhead. Options the platform lacks read as 0. */
+int redisContextGetSocketOptions(redisContext *c, redisSocketOptions *opts) {
+    int tcp = (c->connection_type == REDIS_CONN_TCP);
+
+    memset(opts,0,sizeof(*opts));
+    if (redisGetSocketOption(c,SOL_SOCKET,SO_RCVBUF,&opts->rcvbuf) != REDIS_OK ||
+        redisGetSocketOption(c,SOL_SOCKET,SO_SNDBUF,&opts->sndbuf) != REDIS_OK)
+        return REDIS_ERR;
+#ifdef SO_BUSY_POLL
+    if (redisGetSocketOption(c,SOL_SOCKET,SO_BUSY_POLL,&opts->busy_poll) != REDIS_OK)
+        return REDIS_ERR;
+#endif
+#ifdef SO_PRIORITY
+    if (redisGetSocketOption(c,SOL_SOCKET,SO_PRIORITY,&opts->priority) != REDIS_OK)
+        return REDIS_ERR;
+#endif
+    if (!tcp)
+        return REDIS_OK;
+
+#ifdef TCP_QUICKACK
+    if (redisGetSocketOption(c,IPPROTO_TCP,TCP_QUICKACK,&opts->quickack) != REDIS_OK)
+        return REDIS_ERR;
+#endif
+#ifdef TCP_USER_TIMEOUT
+    if (redisGetSocketOption(c,IPPROTO_TCP,TCP_USER_TIMEOUT,&opts->user_timeout) != REDIS_OK)
+        return REDIS_ERR;
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+    if (redisGetSocketOption(c,IPPROTO_TCP,TCP_NOTSENT_LOWAT,&opts->notsent_lowat) != REDIS_OK)
+        return REDIS_ERR;
+#endif
+    return REDIS_OK;
+}
+
+void redisContextSetQuickAck(redisContext *c) {
+#ifdef TCP_QUICKACK
+    int on = 1;
+    if (c->connection_type == REDIS_CONN_TCP)
+        setsockopt(c->fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+#else
+    (void)c;
+#endif
+}
+
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define HAVE_MSG_ZEROCOPY 1
+#endif
+
+int redisContextEnableZeroCopy(redisContext *c) {
+#ifdef HAVE_MSG_ZEROCOPY
+    return redisSetSocketOption(c,SOL_SOCKET,SO_ZEROCOPY,1,"setsockopt(SO_ZEROCOPY)");
+#else
+    __redisSetError(c,REDIS_ERR_OTHER,"Zero-copy sends are not supported");
+    return REDIS_ERR;
+#endif
+}
+
+/* Send the buffer set aside for zero-copy, moving the output buffer there
+ * first when it is large enough. A completely sent buffer is kept on the
+ * pinned list until its completion is reaped. */
+int redisContextWriteZeroCopy(redisContext *c) {
+#ifdef HAVE_MSG_ZEROCOPY
+    redisZeroCopyBuf *zb;
+    ssize_t nwritten;
+    int copied = 0;
+    sds empty;
+
+    if (c->zerocopy.cur == NULL) {
+        if (sdslen(c->obuf) < c->zerocopy.threshold)
+            return REDIS_OK;
+        if ((empty = sdsempty()) == NULL) {
+            __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+            return REDIS_ERR;
+        }
+        c->zerocopy.cur = c->obuf;
+        c->zerocopy.pos = 0;
+        c->zerocopy.pinned = 0;
+        c->obuf = empty;
+    }
+
+    nwritten = redisContextWrite(c,c->zerocopy.cur+c->zerocopy.pos,
+                                 sdslen(c->zerocopy.cur)-c->zerocopy.pos,MSG_ZEROCOPY);
+    if (nwritten == -1 && errno == ENOBUFS) {
+        /* Too many pages pinned. Reap what completed and copy this chunk:
+         * the socket stays writable, so waiting would only spin. */
+        if (redisContextReapZeroCopy(c) != REDIS_OK)
+            return REDIS_ERR;
+        nwritten = redisContextWrite(c,c->zerocopy.cur+c->zerocopy.pos,
+                                     sdslen(c->zerocopy.cur)-c->zerocopy.pos,0);
+        copied = 1;
+    }
+    if (nwritten == -1) {
+        if (errno == EAGAIN || errno == EINTR) {
+            /* Try again later */
+        } else {
+            __redisSetError(c,REDIS_ERR_IO,NULL);
+            return REDIS_ERR;
+        }
+        return REDIS_OK;
+    }
+
+    if (!copied) {
+        c->zerocopy.seq++;
+        c->zerocopy.pinned = 1;
+    }
+    c->zerocopy.pos += nwritten;
+    if (c->zerocopy.pos < sdslen(c->zerocopy.cur))
+        return REDIS_OK;
+
+    /* Nothing to wait for when every byte was copied. */
+    if (!c->zerocopy.pinned) {
+        sdsfree(c->zerocopy.cur);
+        c->zerocopy.cur = NULL;
+        c->zerocopy.pos = 0;
+        return REDIS_OK;
+    }
+
+    if ((zb = malloc(sizeof(*zb))) == NULL) {
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    zb->next = NULL;
+    zb->buf = c->zerocopy.cur;
+    zb->last = c->zerocopy.seq-1;
+    if (c->zerocopy.tail)
+        c->zerocopy.tail->next = zb;
+    else
+        c->zerocopy.head = zb;
+    c->zerocopy.tail = zb;
+    c->zerocopy.cur = NULL;
+    c->zerocopy.pos = 0;
+    return REDIS_OK;
+#else
+    (void)c;
+    return REDIS_OK;
+#endif
+}
+
+/* Read zero-copy completions from the error queue and release the buffers
+ * the kernel is done with. Completions report ranges of send sequence
+ * numbers; TCP completes them in order. */
+int redisContextReapZeroCopy(redisContext *c) {
+#ifdef HAVE_MSG_ZEROCOPY
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+    redisZeroCopyBuf *zb;
+
+    while (c->zerocopy.head != NULL) {
+        memset(&msg,0,sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(c->fd,&msg,MSG_ERRQUEUE) == -1) {
+            if (errno == EAGAIN || errno == EINTR)
+                break;
+            __redisSetError(c,REDIS_ERR_IO,NULL);
+            return REDIS_ERR;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg,cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            serr = (struct sock_extended_err*)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            /* ee_data is the highest sequence number completed. */
+            while ((zb = c->zerocopy.head) != NULL &&
+                   (int32_t)(serr->ee_data - zb->last) >= 0)
+            {
+                c->zerocopy.head = zb->next;
+                if (c->zerocopy.head == NULL)
+                    c->zerocopy.tail = NULL;
+                sdsfree(zb->buf);
+                free(zb);
+            }
+        }
+    }
+    return REDIS_OK;
+#else
+    (void)c;
+    return REDIS_OK;
+#endif
+}
+
+#if defined(MSG_MORE) && defined(TCP_CORK)
+#define HAVE_MSG_MORE 1
+#endif
+
+/* Write to the socket, telling the kernel more data follows while corked. */
+ssize_t redisContextWrite(redisContext *c, const char *buf, size_t len, int flags) {
+    ssize_t nwritten;
+
+#ifdef HAVE_MSG_MORE
+    if ((c->flags & REDIS_CORKED) && c->connection_type == REDIS_CONN_TCP)
+        flags |= MSG_MORE;
+#endif
+
+    nwritten = send(c->fd,buf,len,flags);
+    c->stats.writes++;
+    if (nwritten > 0) {
+        c->stats.bytes_written += nwritten;
+#ifdef HAVE_MSG_MORE
+        if (flags & MSG_MORE)
+            c->flags |= REDIS_CORK_PENDING;
+        else
+            c->flags &= ~REDIS_CORK_PENDING;
+#endif
+    }
+    return nwritten;
+}
+
+/* Start or end a corked batch on the socket. With MSG_MORE nothing needs to
+ * be done up front, and when ending the batch the next write pushes the
+ * held back data out anyway, so the socket is only touched when nothing is
+ * left to write. */
+int redisContextSetCork(redisContext *c, int on) {
+    if (c->connection_type != REDIS_CONN_TCP)
+        return REDIS_OK;
+#if defined(HAVE_MSG_MORE)
+    if (!on && (c->flags & REDIS_CORK_PENDING) && redisBufferPending(c) == 0) {
+        c->flags &= ~REDIS_CORK_PENDING;
+        c->stats.pushes++;
+        return redisSetSocketOption(c,IPPROTO_TCP,TCP_CORK,0,"setsockopt(TCP_CORK)");
+    }
+#elif defined(TCP_NOPUSH)
+    if (!on) c->stats.pushes++;
+    return redisSetSocketOption(c,IPPROTO_TCP,TCP_NOPUSH,on,"setsockopt(TCP_NOPUSH)");
+#endif
+    return REDIS_OK;
+}
+
+/* Number of TCP segments sent on the socket, 0 when the platform can't tell.
+ * The C library may ship an older struct tcp_info than the kernel, so the
+ * fields appended since are laid out here. */
+int redisContextGetPacketsOut(redisContext *c, unsigned long long *packets) {
+#if defined(__linux__) && defined(TCP_INFO)
+    struct {
+        struct tcp_info base;
+        uint64_t pacing_rate, max_pacing_rate, bytes_acked, bytes_received;
+        uint32_t segs_out, segs_in;
+    } info;
+    socklen_t len = sizeof(info);
+
+    *packets = 0;
+    if (c->connection_type != REDIS_CONN_TCP || c->fd == -1)
+        return REDIS_OK;
+    memset(&info,0,sizeof(info));
+    if (getsockopt(c->fd,IPPROTO_TCP,TCP_INFO,&info,&len) == -1) {
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,"getsockopt(TCP_INFO)");
+        return REDIS_ERR;
+    }
+    if (len >= (socklen_t)((char*)&info.segs_in - (char*)&info))
+        *packets = info.segs_out;
+#elif defined(__APPLE__) && defined(TCP_CONNECTION_INFO)
+    struct tcp_connection_info info;
+    socklen_t len = sizeof(info);
+
+    *packets = 0;
+    if (c->connection_type != REDIS_CONN_TCP || c->fd == -1)
+        return REDIS_OK;
+    if (getsockopt(c->fd,IPPROTO_TCP,TCP_CONNECTION_INFO,&info,&len) == -1) {
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,"getsockopt(TCP_CONNECTION_INFO)");
+        return REDIS_ERR;
+    }
+    *packets = info.tcpi_txpackets;
+#else
+    (void)c;
+    *packets = 0;
+#endif
+    return REDIS_OK;
+}
+
+/* Release every zero-copy buffer, used when the socket goes away. */
+void redisContextFreeZeroCopy(redisContext *c) {
+    redisZeroCopyBuf *zb;
+
+    while ((zb = c->zerocopy.head) != NULL) {
+        c->zerocopy.head = zb->next;
+        sdsfree(zb->buf);
+        free(zb);
+    }
+    c->zerocopy.tail = NULL;
+    if (c->zerocopy.cur != NULL) {
+        sdsfree(c->zerocopy.cur);
+        c->zerocopy.cur = NULL;
+    }
+    c->zerocopy.pos = 0;
+    c->zerocopy.seq = 0;
+}
+
 #define __MAX_MSEC (((LONG_MAX) - 999) / 1000)
 
 static int redisContextWaitReady(redisContext *c, const struct timeval *timeout) {
@@ -234,8 +630,11 @@ int redisCheckSocketConnected(redisContext* c) {
     
     if( getpeername(c->fd, &addr, &addrlen) == 0 ) {
         err = REDIS_OK;
-    } else {
+    } else if (errno != ENOTCONN) {
         __redisSetErrorFromErrno(c, REDIS_ERR_IO, "getpeername");
+    } else if (redisCheckSocketError(c) == REDIS_OK) {
+        /* No error pending: connect(2) is still in progress. */
+        errno = EINPROGRESS;
     }
 
     return err;
@@ -271,15 +670,561 @@ int redisContextSetTimeout(redisContext *c, const struct timeval tv) {
     return REDIS_OK;
 }
 
+/* Shared cache of resolved addresses, so connects and reconnects to the same
+ * host don't hit the resolver every time. Entries hold a private copy of the
+ * addresses and expire after the configured TTL. */
+typedef struct redisResolverEntry {
+    char *host;
+    int port;
+    long long expires;
+    struct addrinfo *addrs;
+} redisResolverEntry;
+
+static struct {
+    pthread_mutex_t lock;
+    int ttl; /* seconds, 0 disables the cache */
+    int used;
+    redisResolverEntry entries[REDIS_RESOLVER_CACHE_SIZE];
+} resolverCache = { PTHREAD_MUTEX_INITIALIZER, REDIS_RESOLVER_CACHE_TTL, 0, {{0}} };
+
+/* Copy an address list into a single allocation, released with free(). */
+static struct addrinfo *redisCopyAddresses(const struct addrinfo *src) {
+    const struct addrinfo *p;
+    struct addrinfo *dst;
+    char *sa;
+    int n = 0, i = 0;
+
+    for (p = src; p != NULL; p = p->ai_next) n++;
+    if (n == 0) return NULL;
+
+    dst = malloc(n*(sizeof(struct addrinfo)+sizeof(struct sockaddr_storage)));
+    if (dst == NULL) return NULL;
+
+    sa = (char*)(dst+n);
+    for (p = src; p != NULL; p = p->ai_next, i++) {
+        memset(&dst[i],0,sizeof(dst[i]));
+        dst[i].ai_family = p->ai_family;
+        dst[i].ai_socktype = p->ai_socktype;
+        dst[i].ai_protocol = p->ai_protocol;
+        dst[i].ai_addrlen = p->ai_addrlen;
+        dst[i].ai_addr = (struct sockaddr*)(sa+i*sizeof(struct sockaddr_storage));
+        memcpy(dst[i].ai_addr,p->ai_addr,p->ai_addrlen);
+        dst[i].ai_next = (i+1 < n) ? &dst[i+1] : NULL;
+    }
+    return dst;
+}
+
+static void redisResolverEntryFree(redisResolverEntry *e) {
+    free(e->host);
+    free(e->addrs);
+    memset(e,0,sizeof(*e));
+}
+
+/* Must be called with the cache lock held. */
+static redisResolverEntry *redisResolverFind(const char *host, int port) {
+    int i;
+    for (i = 0; i < resolverCache.used; i++) {
+        redisResolverEntry *e = &resolverCache.entries[i];
+        if (e->port == port && strcmp(e->host,host) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+static void redisResolverStore(const char *host, int port, const struct addrinfo *addrs) {
+    redisResolverEntry *e;
+    long long now = redisNowUsec();
+    int i;
+
+    pthread_mutex_lock(&resolverCache.lock);
+    if (resolverCache.ttl == 0) {
+        pthread_mutex_unlock(&resolverCache.lock);
+        return;
+    }
+
+    if ((e = redisResolverFind(host,port)) != NULL) {
+        redisResolverEntryFree(e);
+    } else if (resolverCache.used < REDIS_RESOLVER_CACHE_SIZE) {
+        e = &resolverCache.entries[resolverCache.used++];
+    } else {
+        /* Full: replace the entry closest to expiring. */
+        e = &resolverCache.entries[0];
+        for (i = 1; i < resolverCache.used; i++)
+            if (resolverCache.entries[i].expires < e->expires)
+                e = &resolverCache.entries[i];
+        redisResolverEntryFree(e);
+    }
+
+    e->host = strdup(host);
+    e->port = port;
+    e->expires = now + (long long)resolverCache.ttl*1000000;
+    e->addrs = redisCopyAddresses(addrs);
+    if (e->host == NULL || e->addrs == NULL) {
+        redisResolverEntryFree(e);
+        *e = resolverCache.entries[--resolverCache.used];
+    }
+    pthread_mutex_unlock(&resolverCache.lock);
+}
+
+/* Drop a cached host, for example because none of its addresses worked. */
+static void redisResolverForget(const char *host, int port) {
+    redisResolverEntry *e;
+
+    pthread_mutex_lock(&resolverCache.lock);
+    if ((e = redisResolverFind(host,port)) != NULL)
+        e->expires = 0;
+    pthread_mutex_unlock(&resolverCache.lock);
+}
+
+/* Resolve host and port to a list of addresses released with free(). Cached
+ * addresses are used while they are fresh. Returns 0 or a getaddrinfo()
+ * error code. */
+static int redisResolve(const char *host, int port, struct addrinfo **addrs) {
+    char _port[6];  /* strlen("65535"); */
+    struct addrinfo hints, *servinfo;
+    redisResolverEntry *e;
+    int rv;
+
+    pthread_mutex_lock(&resolverCache.lock);
+    e = redisResolverFind(host,port);
+    if (e != NULL && e->expires > redisNowUsec()) {
+        *addrs = redisCopyAddresses(e->addrs);
+        pthread_mutex_unlock(&resolverCache.lock);
+        return (*addrs == NULL) ? EAI_MEMORY : 0;
+    }
+    pthread_mutex_unlock(&resolverCache.lock);
+
+    snprintf(_port, 6, "%d", port);
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ((rv = getaddrinfo(host,_port,&hints,&servinfo)) != 0)
+        return rv;
+
+    redisResolverStore(host,port,servinfo);
+    *addrs = redisCopyAddresses(servinfo);
+    freeaddrinfo(servinfo);
+    return (*addrs == NULL) ? EAI_MEMORY : 0;
+}
+
+void redisSetResolverCacheTTL(int seconds) {
+    int i;
+
+    pthread_mutex_lock(&resolverCache.lock);
+    resolverCache.ttl = seconds > 0 ? seconds : 0;
+    if (resolverCache.ttl == 0) {
+        for (i = 0; i < resolverCache.used; i++)
+            redisResolverEntryFree(&resolverCache.entries[i]);
+        resolverCache.used = 0;
+    }
+    pthread_mutex_unlock(&resolverCache.lock);
+}
+
+typedef struct redisResolveJob {
+    char *host;
+    int port;
+    redisResolveCallback *fn;
+    void *privdata;
+} redisResolveJob;
+
+static void *redisResolveThread(void *arg) {
+    redisResolveJob *job = arg;
+    struct addrinfo *addrs = NULL;
+    int rv;
+
+    rv = redisResolve(job->host,job->port,&addrs);
+    free(addrs);
+    if (job->fn)
+        job->fn(rv == 0 ? REDIS_OK : REDIS_ERR,rv == 0 ? NULL : gai_strerror(rv),job->privdata);
+
+    free(job->host);
+    free(job);
+    return NULL;
+}
+
+int redisResolveAsync(const char *host, int port, redisResolveCallback *fn, void *privdata) {
+    redisResolveJob *job;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rv;
+
+    if ((job = malloc(sizeof(*job))) == NULL)
+        return REDIS_ERR;
+    if ((job->host = strdup(host)) == NULL) {
+        free(job);
+        return REDIS_ERR;
+    }
+    job->port = port;
+    job->fn = fn;
+    job->privdata = privdata;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+    rv = pthread_create(&thread,&attr,redisResolveThread,job);
+    pthread_attr_destroy(&attr);
+
+    if (rv != 0) {
+        free(job->host);
+        free(job);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* Create a nonblocking socket for the given address, bind it to the source
+ * address when one is configured and start connecting. Returns the socket
+ * on success, which may still be connecting (errno is EINPROGRESS then), or
+ * -1 on error. Only errors that make trying other addresses pointless set
+ * *fatal, with the error already set in the context. */
+static int redisStartConnect(redisContext *c, struct addrinfo *p, int *fatal) {
+    struct addrinfo hints, *bservinfo, *b;
+    int reuseaddr = (c->flags & REDIS_REUSEADDR);
+    int reuses = 0;
+    int s, rv, n;
+
+    *fatal = 0;
+addrretry:
+    if ((s = socket(p->ai_family,p->ai_socktype,p->ai_protocol)) == -1)
+        return -1;
+
+    c->fd = s;
+    if (redisSetBlocking(c,0) != REDIS_OK) {
+        *fatal = 1;
+        return -1;
+    }
+    if (redisContextSetSocketOptions(c,1) != REDIS_OK) {
+        redisContextCloseFd(c);
+        *fatal = 1;
+        return -1;
+    }
+    if (c->tcp.source_addr) {
+        int bound = 0;
+        /* Using getaddrinfo saves us from self-determining IPv4 vs IPv6 */
+        memset(&hints,0,sizeof(hints));
+        hints.ai_family = p->ai_family;
+        hints.ai_socktype = SOCK_STREAM;
+        if ((rv = getaddrinfo(c->tcp.source_addr, NULL, &hints, &bservinfo)) != 0) {
+            char buf[128];
+            snprintf(buf,sizeof(buf),"Can't get addr: %s",gai_strerror(rv));
+            __redisSetError(c,REDIS_ERR_OTHER,buf);
+            redisContextCloseFd(c);
+            *fatal = 1;
+            return -1;
+        }
+
+        if (reuseaddr) {
+            n = 1;
+            if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char*) &n,
+                           sizeof(n)) < 0) {
+                __redisSetErrorFromErrno(c,REDIS_ERR_IO,"setsockopt(SO_REUSEADDR)");
+                freeaddrinfo(bservinfo);
+                redisContextCloseFd(c);
+                *fatal = 1;
+                return -1;
+            }
+        }
+
+        for (b = bservinfo; b != NULL; b = b->ai_next) {
+            if (bind(s,b->ai_addr,b->ai_addrlen) != -1) {
+                bound = 1;
+                break;
+            }
+        }
+        freeaddrinfo(bservinfo);
+        if (!bound) {
+            char buf[128];
+            snprintf(buf,sizeof(buf),"Can't bind socket: %s",strerror(errno));
+            __redisSetError(c,REDIS_ERR_OTHER,buf);
+            redisContextCloseFd(c);
+            *fatal = 1;
+            return -1;
+        }
+    }
+    if (connect(s,p->ai_addr,p->ai_addrlen) == -1) {
+        if (errno == EINPROGRESS) {
+            /* This is ok. */
+        } else if (errno == EADDRNOTAVAIL && reuseaddr) {
+            __redisSetErrorFromErrno(c,REDIS_ERR_IO,NULL);
+            redisContextCloseFd(c);
+            if (++reuses >= REDIS_CONNECT_RETRIES) {
+                *fatal = 1;
+                return -1;
+            }
+            goto addrretry;
+        } else {
+            int err = errno;
+            redisContextCloseFd(c);
+            errno = err;
+            return -1;
+        }
+    } else {
+        errno = 0;
+    }
+    c->fd = -1;
+    return s;
+}
+
+/* Order the resolved addresses the way RFC 8305 suggests: start with the
+ * family of the preferred address, then alternate between families so a
+ * broken path for one family doesn't delay the other. */
+static int redisSortAddresses(struct addrinfo *servinfo, struct addrinfo ***sorted) {
+    struct addrinfo *p, **out, **same, **other;
+    int n = 0, nsame = 0, nother = 0, i = 0, j = 0, k = 0, first;
+
+    for (p = servinfo; p != NULL; p = p->ai_next) n++;
+    if ((out = malloc(sizeof(*out)*n*3)) == NULL)
+        return -1;
+    same = out + n;
+    other = out + 2*n;
+
+    first = servinfo->ai_family;
+    for (p = servinfo; p != NULL; p = p->ai_next) {
+        if (p->ai_family == first)
+            same[nsame++] = p;
+        else
+            other[nother++] = p;
+    }
+
+    while (j < nsame || k < nother) {
+        if (j < nsame) out[i++] = same[j++];
+        if (k < nother) out[i++] = other[k++];
+    }
+
+    *sorted = out;
+    return n;
+}
+
+/* Race connects to the candidate addresses, starting a new attempt every
+ * REDIS_CONNECT_ATTEMPT_DELAY msec or as soon as an attempt fails. The first
+ * socket to connect wins and becomes c->fd, the others are closed. */
+static int redisRaceConnect(redisContext *c, struct addrinfo **candidates, int n) {
+    struct pollfd *pfd;
+    int inflight = 0, next = 0, winner = -1, fatal = 0, lasterr = 0;
+    long long now, deadline = -1, attempt = 0;
+    int i, s;
+
+    if ((pfd = malloc(sizeof(*pfd)*n)) == NULL) {
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+
+    now = redisNowUsec();
+    if (c->timeout != NULL)
+        deadline = now + (long long)c->timeout->tv_sec*1000000 + c->timeout->tv_usec;
+
+    while (winner == -1 && (inflight > 0 || next < n)) {
+        long long wait;
+        int res;
+
+        /* Start the next attempt when the previous one had its head start
+         * or there is nothing in flight. */
+        if (next < n && (inflight == 0 || now >= attempt)) {
+            s = redisStartConnect(c,candidates[next++],&fatal);
+            if (s == -1) {
+                lasterr = errno;
+                if (fatal) break;
+                continue;
+            }
+            if (errno != EINPROGRESS) {
+                winner = s;
+                break;
+            }
+            pfd[inflight].fd = s;
+            pfd[inflight].events = POLLOUT;
+            inflight++;
+            attempt = now + REDIS_CONNECT_ATTEMPT_DELAY*1000;
+        }
+
+        if (deadline != -1 && now >= deadline) {
+            lasterr = ETIMEDOUT;
+            break;
+        }
+
+        wait = -1;
+        if (next < n) wait = attempt - now;
+        if (deadline != -1 && (wait == -1 || deadline - now < wait))
+            wait = deadline - now;
+        if (wait > 0) wait = (wait + 999) / 1000;
+
+        if ((res = poll(pfd,inflight,(int)wait)) == -1) {
+            if (errno == EINTR) {
+                now = redisNowUsec();
+                continue;
+            }
+            lasterr = errno;
+            break;
+        }
+        now = redisNowUsec();
+
+        for (i = 0; res > 0 && i < inflight; i++) {
+            int err = 0;
+            socklen_t errlen = sizeof(err);
+
+            if (pfd[i].revents == 0) continue;
+            res--;
+            if (getsockopt(pfd[i].fd,SOL_SOCKET,SO_ERROR,&err,&errlen) == -1)
+                err = errno;
+            if (err == 0) {
+                winner = pfd[i].fd;
+                pfd[i] = pfd[--inflight];
+                break;
+            }
+
+            /* This attempt failed, give the next one its turn right away. */
+            lasterr = err;
+            close(pfd[i].fd);
+            pfd[i--] = pfd[--inflight];
+            attempt = now;
+        }
+    }
+
+    for (i = 0; i < inflight; i++)
+        close(pfd[i].fd);
+    free(pfd);
+
+    if (winner == -1) {
+        if (!fatal) {
+            errno = lasterr;
+            __redisSetErrorFromErrno(c,REDIS_ERR_IO,NULL);
+        }
+        return REDIS_ERR;
+    }
+
+    c->fd = winner;
+    return REDIS_OK;
+}
+
+/* An address a non-blocking connect races to, with room for its sockaddr. */
+typedef struct redisRaceAddr {
+    struct addrinfo ai;
+    struct sockaddr_storage addr;
+} redisRaceAddr;
+
+/* Keep the candidates following the one a non-blocking connect was started
+ * for, to race to from the event loop. */
+static int redisRaceSave(redisContext *c, struct addrinfo **candidates, int n) {
+    int i;
+
+    if (n == 0)
+        return REDIS_OK;
+    c->race.addrs = malloc(sizeof(*c->race.addrs)*n);
+    c->race.fds = malloc(sizeof(*c->race.fds)*n);
+    if (c->race.addrs == NULL || c->race.fds == NULL) {
+        redisContextFreeRace(c);
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    for (i = 0; i < n; i++) {
+        memcpy(&c->race.addrs[i].ai,candidates[i],sizeof(struct addrinfo));
+        memcpy(&c->race.addrs[i].addr,candidates[i]->ai_addr,candidates[i]->ai_addrlen);
+        c->race.addrs[i].ai.ai_addr = (struct sockaddr*)&c->race.addrs[i].addr;
+        c->race.addrs[i].ai.ai_canonname = NULL;
+        c->race.addrs[i].ai.ai_next = NULL;
+    }
+    c->race.naddrs = n;
+    c->race.at = redisNowUsec() + REDIS_CONNECT_ATTEMPT_DELAY*1000;
+    return REDIS_OK;
+}
+
+/* Close the attempts still in flight besides c->fd and stop racing. */
+void redisContextFreeRace(redisContext *c) {
+    int i;
+
+    for (i = 0; i < c->race.nfds; i++)
+        close(c->race.fds[i]);
+    free(c->race.addrs);
+    free(c->race.fds);
+    memset(&c->race,0,sizeof(c->race));
+}
+
+/* Step the connect race of a non-blocking context, when its connect failed
+ * ("failed", with errno telling why) or c->race.at passed. The attempts in flight besides c->fd are
+ * polled, the first of them to connect wins. Otherwise the next address is
+ * started when c->fd failed or had its head start, and becomes c->fd so
+ * the event loop watches the newest attempt. A socket the event loop may
+ * still be watching is handed back in "oldfd", to be closed once the loop
+ * moved over; -1 if none. Returns REDIS_ERR with the error set when every
+ * address failed; c->fd is left as it was then. */
+int redisContextRaceStep(redisContext *c, int failed, int *oldfd) {
+    long long now = redisNowUsec();
+    int i, s, fd, err, fatal = 0, started = 0, lasterr = ECONNREFUSED;
+    socklen_t errlen;
+    struct pollfd pfd;
+
+    *oldfd = -1;
+    if (failed) {
+        if (errno != 0)
+            lasterr = errno;
+        *oldfd = c->fd;
+        c->fd = -1;
+    }
+
+    for (i = 0; i < c->race.nfds; i++) {
+        pfd.fd = c->race.fds[i];
+        pfd.events = POLLOUT;
+        if (poll(&pfd,1,0) <= 0)
+            continue;
+        errlen = sizeof(err);
+        if (getsockopt(pfd.fd,SOL_SOCKET,SO_ERROR,&err,&errlen) == -1)
+            err = errno;
+        if (err == 0) {
+            if (c->fd != -1)
+                *oldfd = c->fd;
+            c->fd = pfd.fd;
+            c->race.fds[i] = c->race.fds[--c->race.nfds];
+            redisContextFreeRace(c);
+            return REDIS_OK;
+        }
+        lasterr = err;
+        close(pfd.fd);
+        c->race.fds[i--] = c->race.fds[--c->race.nfds];
+    }
+
+    while (!fatal && c->race.next < c->race.naddrs && (c->fd == -1 || now >= c->race.at)) {
+        fd = c->fd;
+        s = redisStartConnect(c,&c->race.addrs[c->race.next++].ai,&fatal);
+        c->fd = s;
+        if (s == -1 || redisSetTcpNoDelay(c) != REDIS_OK) {
+            lasterr = errno;
+            c->fd = fd;
+            continue;
+        }
+        if (fd != -1)
+            c->race.fds[c->race.nfds++] = fd;
+        c->race.at = now + REDIS_CONNECT_ATTEMPT_DELAY*1000;
+        started = 1;
+    }
+
+    /* Nothing left to start: watch an attempt still in flight. */
+    if (c->fd == -1 && c->race.nfds > 0)
+        c->fd = c->race.fds[--c->race.nfds];
+    if (c->fd == -1) {
+        redisContextFreeRace(c);
+        c->fd = *oldfd;
+        *oldfd = -1;
+        if (!fatal) {
+            errno = lasterr;
+            __redisSetErrorFromErrno(c,REDIS_ERR_IO,NULL);
+        }
+        return REDIS_ERR;
+    }
+
+    /* Older attempts are polled again after as long. */
+    if (c->race.next == c->race.naddrs && c->race.nfds == 0)
+        redisContextFreeRace(c);
+    else if (!started && c->race.next == c->race.naddrs)
+        c->race.at = now + REDIS_CONNECT_ATTEMPT_DELAY*1000;
+    return REDIS_OK;
+}
+
 static int _redisContextConnectTcp(redisContext *c, const char *addr, int port,
                                    const struct timeval *timeout,
                                    const char *source_addr) {
-    int s, rv, n;
-    char _port[6];  /* strlen("65535"); */
-    struct addrinfo hints, *servinfo, *bservinfo, *p, *b;
+    int rv, i, n, fd;
+    struct addrinfo *servinfo;
+    struct addrinfo **candidates = NULL;
     int blocking = (c->flags & REDIS_BLOCK);
-    int reuseaddr = (c->flags & REDIS_REUSEADDR);
-    int reuses = 0;
 
     c->connection_type = REDIS_CONN_TCP;
     c->tcp.port = port;
@@ -319,100 +1264,56 @@ static int _redisContextConnectTcp(redisContext *c, const char *addr, int port,
         c->tcp.source_addr = strdup(source_addr);
     }
 
-    snprintf(_port, 6, "%d", port);
-    memset(&hints,0,sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-
-    /* Try with IPv6 if no IPv4 address was found. We do it in this order since
-     * in a Redis client you can't afford to test if you have IPv6 connectivity
-     * as this would add latency to every connect. Otherwise a more sensible
-     * route could be: Use IPv6 if both addresses are available and there is IPv6
-     * connectivity. */
-    if ((rv = getaddrinfo(c->tcp.host,_port,&hints,&servinfo)) != 0) {
-         hints.ai_family = AF_INET6;
-         if ((rv = getaddrinfo(addr,_port,&hints,&servinfo)) != 0) {
-            __redisSetError(c,REDIS_ERR_OTHER,gai_strerror(rv));
-            return REDIS_ERR;
-        }
+    if ((rv = redisResolve(c->tcp.host,port,&servinfo)) != 0) {
+        __redisSetError(c,REDIS_ERR_OTHER,gai_strerror(rv));
+        return REDIS_ERR;
+    }
+    redisContextFreeRace(c);
+    if ((n = redisSortAddresses(servinfo,&candidates)) == -1) {
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        goto error;
     }
-    for (p = servinfo; p != NULL; p = p->ai_next) {
-addrretry:
-        if ((s = socket(p->ai_family,p->ai_socktype,p->ai_protocol)) == -1)
-            continue;
 
-        c->fd = s;
-        if (redisSetBlocking(c,0) != REDIS_OK)
+    if (blocking) {
+        if (redisRaceConnect(c,candidates,n) != REDIS_OK) {
+            /* Make the next attempt resolve again, the host may have moved. */
+            redisResolverForget(c->tcp.host,port);
             goto error;
-        if (c->tcp.source_addr) {
-            int bound = 0;
-            /* Using getaddrinfo saves us from self-determining IPv4 vs IPv6 */
-            if ((rv = getaddrinfo(c->tcp.source_addr, NULL, &hints, &bservinfo)) != 0) {
-                char buf[128];
-                snprintf(buf,sizeof(buf),"Can't get addr: %s",gai_strerror(rv));
-                __redisSetError(c,REDIS_ERR_OTHER,buf);
-                goto error;
-            }
-
-            if (reuseaddr) {
-                n = 1;
-                if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char*) &n,
-                               sizeof(n)) < 0) {
-                    goto error;
-                }
-            }
-
-            for (b = bservinfo; b != NULL; b = b->ai_next) {
-                if (bind(s,b->ai_addr,b->ai_addrlen) != -1) {
-                    bound = 1;
-                    break;
-                }
-            }
-            freeaddrinfo(bservinfo);
-            if (!bound) {
-                char buf[128];
-                snprintf(buf,sizeof(buf),"Can't bind socket: %s",strerror(errno));
-                __redisSetError(c,REDIS_ERR_OTHER,buf);
-                goto error;
-            }
         }
-        if (connect(s,p->ai_addr,p->ai_addrlen) == -1) {
-            if (errno == EHOSTUNREACH) {
-                redisContextCloseFd(c);
-                continue;
-            } else if (errno == EINPROGRESS && !blocking) {
-                /* This is ok. */
-            } else if (errno == EADDRNOTAVAIL && reuseaddr) {
-                if (++reuses >= REDIS_CONNECT_RETRIES) {
-                    goto error;
-                } else {
-                    goto addrretry;
-                }
-            } else {
-                if (redisContextWaitReady(c,c->timeout) != REDIS_OK)
-                    goto error;
-            }
+        if (redisSetBlocking(c,1) != REDIS_OK)
+            goto error;
+    } else {
+        /* The connect completes in the event loop: start the first address
+         * a connect can be started for, and keep the others to race to. */
+        for (i = 0; i < n; i++) {
+            int fatal;
+            if ((fd = redisStartConnect(c,candidates[i],&fatal)) != -1)
+                break;
+            if (fatal) goto error;
         }
-        if (blocking && redisSetBlocking(c,1) != REDIS_OK)
+        if (i == n) {
+            char buf[128];
+            redisResolverForget(c->tcp.host,port);
+            snprintf(buf,sizeof(buf),"Can't create socket: %s",strerror(errno));
+            __redisSetError(c,REDIS_ERR_OTHER,buf);
             goto error;
-        if (redisSetTcpNoDelay(c) != REDIS_OK)
+        }
+        c->fd = fd;
+        if (redisRaceSave(c,candidates+i+1,n-i-1) != REDIS_OK)
             goto error;
-
-        c->flags |= REDIS_CONNECTED;
-        rv = REDIS_OK;
-        goto end;
     }
-    if (p == NULL) {
-        char buf[128];
-        snprintf(buf,sizeof(buf),"Can't create socket: %s",strerror(errno));
-        __redisSetError(c,REDIS_ERR_OTHER,buf);
+    if (redisSetTcpNoDelay(c) != REDIS_OK)
         goto error;
-    }
+
+    c->flags |= REDIS_CONNECTED;
+    rv = REDIS_OK;
+    goto end;
 
 error:
     rv = REDIS_ERR;
 end:
-    freeaddrinfo(servinfo);
+    free(candidates);
+    free(servinfo);
     return rv;  // Need to return REDIS_OK if alright
 }
 
@@ -437,6 +1338,10 @@ int redisContextConnectUnix(redisContext *c, const char *path, const struct time
         return REDIS_ERR;
 
     c->connection_type = REDIS_CONN_UNIX;
+    if (redisContextSetSocketOptions(c,1) != REDIS_OK) {
+        redisContextCloseFd(c);
+        return REDIS_ERR;
+    }
     if (c->unix_sock.path != path)
         c->unix_sock.path = strdup(path);
 
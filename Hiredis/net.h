@@ -49,6 +49,24 @@ int redisContextConnectBindTcp(redisContext *c, const char *addr, int port,
                                const struct timeval *timeout,
                                const char *source_addr);
 int redisContextConnectUnix(redisContext *c, const char *path, const struct timeval *timeout);
+int redisContextRaceStep(redisContext *c, int failed, int *oldfd);
+void redisContextFreeRace(redisContext *c);
 int redisKeepAlive(redisContext *c, int interval);
+int redisContextSetSocketOptions(redisContext *c, int preconnect);
+int redisContextGetSocketOptions(redisContext *c, redisSocketOptions *opts);
+void redisContextSetQuickAck(redisContext *c);
+int redisContextEnableZeroCopy(redisContext *c);
+int redisContextWriteZeroCopy(redisContext *c);
+int redisContextReapZeroCopy(redisContext *c);
+void redisContextFreeZeroCopy(redisContext *c);
+ssize_t redisContextWrite(redisContext *c, const char *buf, size_t len, int flags);
+int redisContextSetCork(redisContext *c, int on);
+int redisContextGetPacketsOut(redisContext *c, unsigned long long *packets);
+long long redisNowUsec(void);
+
+/* 32 bit FNV-1a of "buf", continuing from "h": REDIS_FNV_BASIS to start.
+ * With "nocase", upper case letters are hashed as lower case ones. */
+#define REDIS_FNV_BASIS 2166136261U
+unsigned int redisFnv1a(unsigned int h, const char *buf, size_t len, int nocase);
 
 #endif
@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+
+#include "pool.h"
+#include "net.h"
+
+/* Connections cached by a thread are published and taken with atomic
+ * exchanges; everything else in the pool is guarded by pool->lock. */
+#define __redisPoolLoad(p) __atomic_load_n(p,__ATOMIC_SEQ_CST)
+#define __redisPoolExchange(p,v) __atomic_exchange_n(p,v,__ATOMIC_SEQ_CST)
+
+static redisContext *__redisPoolConnect(redisPool *pool) {
+    if (pool->type == REDIS_CONN_TCP)
+        return pool->timeout ?
+            redisConnectWithTimeout(pool->host,pool->port,*pool->timeout) :
+            redisConnect(pool->host,pool->port);
+    return pool->timeout ?
+        redisConnectUnixWithTimeout(pool->host,*pool->timeout) :
+        redisConnectUnix(pool->host);
+}
+
+/* Must be called with the lock held. */
+static void __redisPoolPushIdle(redisPool *pool, redisContext *c, long long since) {
+    pool->idle[pool->nidle] = c;
+    pool->since[pool->nidle] = since;
+    pool->nidle++;
+    pthread_cond_signal(&pool->cond);
+}
+
+/* Called on thread exit: the connection the thread kept goes back to the
+ * pool for everybody else. */
+static void __redisPoolSlotFree(void *privdata) {
+    redisPoolSlot *slot = privdata;
+    redisPool *pool = slot->pool;
+    redisContext *c;
+
+    pthread_mutex_lock(&pool->lock);
+    if (slot->prev) slot->prev->next = slot->next;
+    else pool->slots = slot->next;
+    if (slot->next) slot->next->prev = slot->prev;
+    if ((c = __redisPoolExchange(&slot->c,NULL)) != NULL)
+        __redisPoolPushIdle(pool,c,redisNowUsec());
+    pthread_mutex_unlock(&pool->lock);
+    free(slot);
+}
+
+static void __redisPoolFreeStorage(redisPool *pool) {
+    free(pool->host);
+    free(pool->idle);
+    free(pool->since);
+    free(pool->timeout);
+    free(pool);
+}
+
+static redisPool *__redisPoolCreate(enum redisConnectionType type, const char *host, int port,
+                                    const struct timeval *timeout, int min, int max)
+{
+    redisPool *pool;
+    redisContext *c;
+
+    if (min < 0 || max < 1 || min > max)
+        return NULL;
+
+    pool = calloc(1,sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->type = type;
+    pool->port = port;
+    pool->min = min;
+    pool->max = max;
+    pool->host = strdup(host);
+    pool->idle = malloc(sizeof(redisContext*)*max);
+    pool->since = malloc(sizeof(long long)*max);
+    if (timeout != NULL && (pool->timeout = malloc(sizeof(struct timeval))) != NULL)
+        *pool->timeout = *timeout;
+    if (pool->host == NULL || pool->idle == NULL || pool->since == NULL ||
+        (timeout != NULL && pool->timeout == NULL))
+    {
+        __redisPoolFreeStorage(pool);
+        return NULL;
+    }
+
+    if (pthread_key_create(&pool->key,__redisPoolSlotFree) != 0) {
+        __redisPoolFreeStorage(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock,NULL);
+    pthread_cond_init(&pool->cond,NULL);
+
+    /* Connections failing now are retried when they are handed out. */
+    while (pool->total < min) {
+        if ((c = __redisPoolConnect(pool)) == NULL) {
+            redisPoolFree(pool);
+            return NULL;
+        }
+        pool->total++;
+        __redisPoolPushIdle(pool,c,redisNowUsec());
+    }
+    return pool;
+}
+
+redisPool *redisPoolCreate(const char *ip, int port, const struct timeval *timeout, int min, int max) {
+    return __redisPoolCreate(REDIS_CONN_TCP,ip,port,timeout,min,max);
+}
+
+redisPool *redisPoolCreateUnix(const char *path, const struct timeval *timeout, int min, int max) {
+    return __redisPoolCreate(REDIS_CONN_UNIX,path,0,timeout,min,max);
+}
+
+/* Take the connection some other thread keeps. Must be called with the
+ * lock held. */
+static redisContext *__redisPoolSteal(redisPool *pool, long long *since) {
+    redisPoolSlot *slot;
+    redisContext *c;
+
+    for (slot = pool->slots; slot != NULL; slot = slot->next) {
+        if (__redisPoolLoad(&slot->c) == NULL)
+            continue;
+        if ((c = __redisPoolExchange(&slot->c,NULL)) != NULL) {
+            *since = __redisPoolLoad(&slot->since);
+            return c;
+        }
+    }
+    return NULL;
+}
+
+/* Make sure a connection is usable before handing it out. The server may
+ * have closed a connection idle for a while: such a socket is readable,
+ * where a healthy idle connection has nothing to read. Connections with an
+ * error or with a half done exchange are reconnected. */
+static void __redisPoolCheck(redisContext *c, long long since) {
+    struct pollfd pfd;
+
+    if (!c->err && redisNowUsec()-since >= REDIS_POOL_CHECK_INTERVAL*1000LL) {
+        pfd.fd = c->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd,1,0) != 0)
+            c->err = REDIS_ERR_EOF;
+    }
+    if (c->err || redisBufferPending(c) > 0 || c->reader->pos < c->reader->len)
+        redisReconnect(c);
+}
+
+redisContext *redisPoolGet(redisPool *pool, const struct timeval *wait) {
+    redisPoolSlot *slot = pthread_getspecific(pool->key);
+    redisContext *c = NULL;
+    struct timespec deadline;
+    struct timeval now;
+    long long since = 0;
+    int rc = 0;
+
+    /* Fast path: the connection this thread used last. */
+    if (slot != NULL && (c = __redisPoolExchange(&slot->c,NULL)) != NULL) {
+        __redisPoolCheck(c,__redisPoolLoad(&slot->since));
+        return c;
+    }
+
+    if (wait != NULL) {
+        gettimeofday(&now,NULL);
+        deadline.tv_sec = now.tv_sec+wait->tv_sec;
+        deadline.tv_nsec = (now.tv_usec+wait->tv_usec)*1000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += deadline.tv_nsec/1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (slot == NULL && (slot = calloc(1,sizeof(*slot))) != NULL) {
+        slot->pool = pool;
+        slot->next = pool->slots;
+        if (pool->slots) pool->slots->prev = slot;
+        pool->slots = slot;
+        pthread_setspecific(pool->key,slot);
+    }
+
+    for (;;) {
+        /* Most recently released first, it is the most likely to be warm. */
+        if (pool->nidle > 0) {
+            pool->nidle--;
+            c = pool->idle[pool->nidle];
+            since = pool->since[pool->nidle];
+            break;
+        }
+
+        if (pool->total < pool->max) {
+            pool->total++;
+            pthread_mutex_unlock(&pool->lock);
+            if ((c = __redisPoolConnect(pool)) == NULL) {
+                pthread_mutex_lock(&pool->lock);
+                pool->total--;
+                pthread_cond_signal(&pool->cond);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            return c;
+        }
+
+        /* Announce the wait before looking at the other threads: a thread
+         * keeping a connection now either is seen here, or sees the waiter
+         * and releases through the lock. */
+        __atomic_add_fetch(&pool->waiters,1,__ATOMIC_SEQ_CST);
+        c = __redisPoolSteal(pool,&since);
+        if (c == NULL && rc == 0) {
+            if (wait == NULL)
+                rc = pthread_cond_wait(&pool->cond,&pool->lock);
+            else if (wait->tv_sec > 0 || wait->tv_usec > 0)
+                rc = pthread_cond_timedwait(&pool->cond,&pool->lock,&deadline);
+            else
+                rc = ETIMEDOUT;
+        }
+        __atomic_sub_fetch(&pool->waiters,1,__ATOMIC_SEQ_CST);
+        if (c != NULL || rc != 0)
+            break;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (c != NULL)
+        __redisPoolCheck(c,since);
+    return c;
+}
+
+void redisPoolRelease(redisPool *pool, redisContext *c) {
+    redisPoolSlot *slot = pthread_getspecific(pool->key);
+    redisContext *expected = NULL;
+    long long now = redisNowUsec();
+
+    /* Fast path: keep the connection for this thread, unless another
+     * thread is waiting for one. */
+    if (slot != NULL && __redisPoolLoad(&slot->c) == NULL) {
+        __atomic_store_n(&slot->since,now,__ATOMIC_SEQ_CST);
+        if (__atomic_compare_exchange_n(&slot->c,&expected,c,0,
+                                        __ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST))
+        {
+            if (__redisPoolLoad(&pool->waiters) == 0)
+                return;
+            if ((c = __redisPoolExchange(&slot->c,NULL)) == NULL)
+                return; /* taken by the waiter already */
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    __redisPoolPushIdle(pool,c,now);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void redisPoolFree(redisPool *pool) {
+    redisPoolSlot *slot, *next;
+
+    if (pool == NULL)
+        return;
+
+    /* Thread exit must not touch the pool anymore. */
+    pthread_key_delete(pool->key);
+    for (slot = pool->slots; slot != NULL; slot = next) {
+        next = slot->next;
+        if (slot->c) redisFree(slot->c);
+        free(slot);
+    }
+    while (pool->nidle > 0)
+        redisFree(pool->idle[--pool->nidle]);
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    __redisPoolFreeStorage(pool);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_POOL_H
+#define __HIREDIS_POOL_H
+#include <pthread.h>
+#include "hiredis.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Idle connections handed out after being pooled for longer than this many
+ * msec are checked for a hangup from the server first. */
+#define REDIS_POOL_CHECK_INTERVAL 1000
+
+/* Connection kept for the thread that used it last, so taking it back
+ * needs no lock. */
+typedef struct redisPoolSlot {
+    redisContext *c;
+    long long since; /* time the connection was released */
+    struct redisPool *pool;
+    struct redisPoolSlot *prev, *next;
+} redisPoolSlot;
+
+/* Pool of blocking connections shared by threads. */
+typedef struct redisPool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_key_t key; /* redisPoolSlot of the calling thread */
+
+    enum redisConnectionType type;
+    char *host; /* or path of the unix socket */
+    int port;
+    struct timeval *timeout;
+
+    int min, max; /* connections kept open / open at most */
+    int total; /* connections open or being opened */
+    int waiters; /* threads waiting for a connection */
+
+    redisContext **idle; /* connections not cached by any thread */
+    long long *since; /* time each idle connection was released */
+    int nidle;
+
+    redisPoolSlot *slots;
+} redisPool;
+
+/* Create a pool of connections to a server. "min" connections are opened
+ * right away, more are opened on demand up to "max". */
+redisPool *redisPoolCreate(const char *ip, int port, const struct timeval *timeout, int min, int max);
+redisPool *redisPoolCreateUnix(const char *path, const struct timeval *timeout, int min, int max);
+
+/* Take a connection from the pool, waiting at most "wait" for one when all
+ * of them are in use (NULL waits forever). Returns NULL when no connection
+ * became available in time. Otherwise the context should be checked for
+ * errors as returned by redisConnect(), and given back with
+ * redisPoolRelease() in any case. */
+redisContext *redisPoolGet(redisPool *pool, const struct timeval *wait);
+
+/* Give a connection back, with every reply to its commands read. A context
+ * with an error is reconnected when it is handed out again. */
+void redisPoolRelease(redisPool *pool, redisContext *c);
+
+/* Close every connection. All of them must have been released. */
+void redisPoolFree(redisPool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "queue.h"
+
+/* Producers push with a compare-and-swap on the head, the event loop takes
+ * the whole list at once with an exchange. Nodes are only ever removed all
+ * together, so the swap can't be fooled by a recycled node. */
+#define __redisQueueLoad(p) __atomic_load_n(p,__ATOMIC_ACQUIRE)
+#define __redisQueueExchange(p,v) __atomic_exchange_n(p,v,__ATOMIC_ACQ_REL)
+#define __redisQueueSwap(p,old,v) \
+    __atomic_compare_exchange_n(p,old,v,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED)
+
+typedef struct redisQueuedCommand {
+    redisCallbackFn *fn;
+    void *privdata;
+    char *cmd; /* malloc'd */
+    size_t len;
+    struct redisQueuedCommand *next; /* pushed before this one */
+} redisQueuedCommand;
+
+#ifndef __linux__
+static int __redisQueueNonBlock(int fd) {
+    int flags;
+
+    if ((flags = fcntl(fd,F_GETFL)) == -1 ||
+        fcntl(fd,F_SETFL,flags|O_NONBLOCK) == -1 ||
+        fcntl(fd,F_SETFD,FD_CLOEXEC) == -1)
+        return REDIS_ERR;
+    return REDIS_OK;
+}
+#endif
+
+redisQueue *redisQueueCreate(redisAsyncContext *ac) {
+    redisQueue *q;
+#ifndef __linux__
+    int fds[2];
+#endif
+
+    if ((q = calloc(1,sizeof(*q))) == NULL)
+        return NULL;
+    q->ac = ac;
+
+#ifdef __linux__
+    q->fd = q->wfd = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    if (q->fd == -1) {
+        free(q);
+        return NULL;
+    }
+#else
+    if (pipe(fds) == -1) {
+        free(q);
+        return NULL;
+    }
+    q->fd = fds[0];
+    q->wfd = fds[1];
+    if (__redisQueueNonBlock(q->fd) != REDIS_OK || __redisQueueNonBlock(q->wfd) != REDIS_OK) {
+        close(q->fd);
+        close(q->wfd);
+        free(q);
+        return NULL;
+    }
+#endif
+    return q;
+}
+
+static void __redisQueueWake(redisQueue *q) {
+#ifdef __linux__
+    uint64_t one = 1;
+    while (write(q->wfd,&one,sizeof(one)) == -1 && errno == EINTR);
+#else
+    /* A full pipe already has a wakeup pending. */
+    char one = 1;
+    while (write(q->wfd,&one,1) == -1 && errno == EINTR);
+#endif
+}
+
+static void __redisQueueReset(redisQueue *q) {
+#ifdef __linux__
+    uint64_t count;
+    while (read(q->fd,&count,sizeof(count)) == -1 && errno == EINTR);
+#else
+    char buf[64];
+    ssize_t nread;
+    do {
+        nread = read(q->fd,buf,sizeof(buf));
+    } while (nread > 0 || (nread == -1 && errno == EINTR));
+#endif
+}
+
+static int __redisQueuePush(redisQueue *q, redisCallbackFn *fn, void *privdata, char *cmd, size_t len) {
+    redisQueuedCommand *qc, *head;
+
+    if ((qc = malloc(sizeof(*qc))) == NULL) {
+        free(cmd);
+        return REDIS_ERR;
+    }
+    qc->fn = fn;
+    qc->privdata = privdata;
+    qc->cmd = cmd;
+    qc->len = len;
+
+    head = __redisQueueLoad(&q->head);
+    do {
+        qc->next = head;
+    } while (!__redisQueueSwap(&q->head,&head,qc));
+
+    /* Only the command that finds the list empty wakes the loop up, the
+     * others are taken along with it. */
+    if (head == NULL)
+        __redisQueueWake(q);
+    return REDIS_OK;
+}
+
+/* Commands taken from the list, oldest first. */
+static redisQueuedCommand *__redisQueueTake(redisQueue *q) {
+    redisQueuedCommand *qc, *next, *list = NULL;
+
+    qc = __redisQueueExchange(&q->head,NULL);
+    while (qc != NULL) {
+        next = qc->next;
+        qc->next = list;
+        list = qc;
+        qc = next;
+    }
+    return list;
+}
+
+void redisQueueHandleWakeup(redisQueue *q) {
+    redisQueuedCommand *qc, *next;
+
+    /* Reset before taking the list: a command pushed after that finds it
+     * empty and wakes the loop up again. */
+    __redisQueueReset(q);
+    for (qc = __redisQueueTake(q); qc != NULL; qc = next) {
+        next = qc->next;
+        if ((q->ac == NULL ||
+             redisAsyncFormattedCommand(q->ac,qc->fn,qc->privdata,qc->cmd,qc->len) != REDIS_OK) &&
+            qc->fn != NULL)
+            qc->fn(q->ac,NULL,qc->privdata);
+        free(qc->cmd);
+        free(qc);
+    }
+}
+
+void redisQueueFree(redisQueue *q) {
+    redisQueuedCommand *qc, *next;
+
+    if (q == NULL)
+        return;
+    for (qc = __redisQueueTake(q); qc != NULL; qc = next) {
+        next = qc->next;
+        if (qc->fn != NULL)
+            qc->fn(q->ac,NULL,qc->privdata);
+        free(qc->cmd);
+        free(qc);
+    }
+    if (q->wfd != q->fd)
+        close(q->wfd);
+    close(q->fd);
+    free(q);
+}
+
+int redisvQueueCommand(redisQueue *q, redisCallbackFn *fn, void *privdata, const char *format, va_list ap) {
+    char *cmd;
+    int len;
+
+    len = redisvFormatCommand(&cmd,format,ap);
+    if (len < 0)
+        return REDIS_ERR;
+    return __redisQueuePush(q,fn,privdata,cmd,len);
+}
+
+int redisQueueCommand(redisQueue *q, redisCallbackFn *fn, void *privdata, const char *format, ...) {
+    va_list ap;
+    int status;
+    va_start(ap,format);
+    status = redisvQueueCommand(q,fn,privdata,format,ap);
+    va_end(ap);
+    return status;
+}
+
+int redisQueueCommandArgv(redisQueue *q, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen) {
+    char *cmd;
+    int len;
+
+    len = redisFormatCommandArgv(&cmd,argc,argv,argvlen);
+    if (len < 0)
+        return REDIS_ERR;
+    return __redisQueuePush(q,fn,privdata,cmd,len);
+}
+
+int redisQueueFormattedCommand(redisQueue *q, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len) {
+    char *copy;
+
+    /* Terminated like formatted commands are, the async context scans the
+     * arguments up to the end. */
+    if ((copy = malloc(len+1)) == NULL)
+        return REDIS_ERR;
+    memcpy(copy,cmd,len);
+    copy[len] = '\0';
+    return __redisQueuePush(q,fn,privdata,copy,len);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_QUEUE_H
+#define __HIREDIS_QUEUE_H
+#include "async.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct redisQueuedCommand; /* private to queue.c */
+
+/* Submission of commands to an async context from other threads. The
+ * context is only touched by the thread running its event loop, other
+ * threads format their commands and push them on a lock-free list:
+ *
+ *   // event loop thread
+ *   redisQueue *q = redisQueueCreate(ac);
+ *   // watch q->fd for reading, and on every event:
+ *   redisQueueHandleWakeup(q);
+ *
+ *   // any thread
+ *   redisQueueCommand(q,onReply,privdata,"INCR %s",key);
+ *
+ * The loop is woken through q->fd (an eventfd where there is one, a pipe
+ * elsewhere) by the command that finds the list empty, so a busy loop is
+ * not woken once per command. Every wakeup moves all the commands pushed
+ * so far to the output buffer of the context, in the order each thread
+ * pushed them.
+ *
+ * Callbacks run on the event loop thread. A command the context refuses
+ * has its callback called with a NULL reply, as have all of them once q->ac
+ * is set to NULL when the context is free'd before the queue. */
+typedef struct redisQueue {
+    redisAsyncContext *ac;
+    int fd; /* watched by the event loop */
+    int wfd; /* written to wake the loop up, same as fd for an eventfd */
+    struct redisQueuedCommand *head; /* last pushed, updated atomically */
+} redisQueue;
+
+/* Called on the event loop thread of "ac". */
+redisQueue *redisQueueCreate(redisAsyncContext *ac);
+
+/* Called on the event loop thread once no thread pushes anymore, before
+ * the context is free'd. Commands still queued get a NULL reply. */
+void redisQueueFree(redisQueue *q);
+
+/* Called on the event loop thread when q->fd is readable. */
+void redisQueueHandleWakeup(redisQueue *q);
+
+/* Push a command from any thread. Returns REDIS_ERR when it could not be
+ * formatted or queued, its callback is not called then. */
+int redisvQueueCommand(redisQueue *q, redisCallbackFn *fn, void *privdata, const char *format, va_list ap);
+int redisQueueCommand(redisQueue *q, redisCallbackFn *fn, void *privdata, const char *format, ...);
+int redisQueueCommandArgv(redisQueue *q, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen);
+int redisQueueFormattedCommand(redisQueue *q, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
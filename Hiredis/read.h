@@ -46,6 +46,7 @@
 #define REDIS_ERR_PROTOCOL 4 /* Protocol error */
 #define REDIS_ERR_OOM 5 /* Out of memory */
 #define REDIS_ERR_OTHER 2 /* Everything else... */
+#define REDIS_ERR_TIMEOUT 6 /* Timed out */
 
 #define REDIS_REPLY_STRING 1
 #define REDIS_REPLY_ARRAY 2
@@ -0,0 +1,589 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replica.h"
+#include "command.h"
+#include "net.h"
+
+/* Set while redisReplicaDisconnect() walks the connections, so the context
+ * isn't free'd under its feet. */
+#define REDIS_REPLICA_IN_DISCONNECT 0x4
+
+/* A hedged read. It is sent to a second replica when the first one takes
+ * too long, the first reply goes to the callback and the other one is
+ * dropped. Free'd once both copies are answered. */
+typedef struct redisReplicaHedge {
+    redisReplicaContext *rc;
+    redisCallbackFn *fn;
+    void *privdata;
+    redisReplicaNode *node; /* replica the read went to first */
+    long long sent, hedged; /* monotonic usec each copy was sent at */
+    long long at; /* monotonic usec to hedge at, 0 once out of node->hedges */
+    int pending; /* copies without a reply */
+    int done; /* callback called */
+    struct redisReplicaHedge *prev, *next;
+    size_t len;
+    char cmd[];
+} redisReplicaHedge;
+
+static void __redisReplicaFreeNode(redisReplicaNode *node) {
+    free(node->host);
+    free(node);
+}
+
+static void __redisReplicaFreeStorage(redisReplicaContext *rc) {
+    redisReplicaNode *node;
+
+    while ((node = rc->replicas) != NULL) {
+        rc->replicas = node->next;
+        __redisReplicaFreeNode(node);
+    }
+    free(rc->host);
+    free(rc);
+}
+
+/* Free the context once redisReplicaDisconnect() closed every connection. */
+static void __redisReplicaCheckGone(redisReplicaContext *rc) {
+    redisReplicaNode *node;
+
+    if (!(rc->flags & REDIS_REPLICA_DISCONNECTING) || (rc->flags & REDIS_REPLICA_IN_DISCONNECT))
+        return;
+    if (rc->primary != NULL)
+        return;
+    for (node = rc->replicas; node != NULL; node = node->next)
+        if (node->ac != NULL)
+            return;
+    __redisReplicaFreeStorage(rc);
+}
+
+static void __redisReplicaOnPrimaryConnect(const redisAsyncContext *ac, int status) {
+    redisReplicaContext *rc = ac->data;
+
+    if (status == REDIS_OK || rc == NULL)
+        return;
+
+    /* The context is free'd after this callback, try again later. */
+    rc->primary = NULL;
+    __redisReplicaCheckGone(rc);
+}
+
+static void __redisReplicaOnPrimaryDisconnect(const redisAsyncContext *ac, int status) {
+    redisReplicaContext *rc = ac->data;
+
+    ((void)status);
+    if (rc == NULL)
+        return;
+    rc->primary = NULL;
+    __redisReplicaCheckGone(rc);
+}
+
+static void __redisReplicaOnConnect(const redisAsyncContext *ac, int status) {
+    redisReplicaNode *node = ac->data;
+
+    if (status == REDIS_OK || node == NULL)
+        return;
+
+    /* Connected again on the next ROLE reply listing it. */
+    node->ac = NULL;
+    __redisReplicaCheckGone(node->rc);
+}
+
+static void __redisReplicaOnDisconnect(const redisAsyncContext *ac, int status) {
+    redisReplicaNode *node = ac->data;
+
+    ((void)status);
+    if (node == NULL)
+        return;
+    node->ac = NULL;
+    __redisReplicaCheckGone(node->rc);
+}
+
+static redisAsyncContext *__redisReplicaConnectTo(redisReplicaContext *rc, const char *host, int port,
+                                                  void *data, redisConnectCallback *onConnect,
+                                                  redisDisconnectCallback *onDisconnect)
+{
+    redisAsyncContext *ac;
+
+    ac = redisAsyncConnect(host,port);
+    if (ac == NULL)
+        return NULL;
+
+    if (ac->err || rc->attach(ac,rc->attachdata) != REDIS_OK) {
+        redisAsyncFree(ac);
+        return NULL;
+    }
+
+    ac->data = data;
+    redisAsyncSetConnectCallback(ac,onConnect);
+    redisAsyncSetDisconnectCallback(ac,onDisconnect);
+    return ac;
+}
+
+static void __redisReplicaConnectPrimary(redisReplicaContext *rc) {
+    rc->retry = redisNowUsec()+REDIS_REPLICA_RETRY_INTERVAL*1000LL;
+    rc->primary = __redisReplicaConnectTo(rc,rc->host,rc->port,rc,
+                                          __redisReplicaOnPrimaryConnect,
+                                          __redisReplicaOnPrimaryDisconnect);
+}
+
+static int __redisReplicaUsable(redisAsyncContext *ac, int flags) {
+    return ac != NULL && !(ac->c.flags & (REDIS_DISCONNECTING|REDIS_FREEING)) &&
+           (ac->c.flags & flags) == flags;
+}
+
+/* Close a connection once its pending replies are read. Returns 1 when it
+ * is gone already: a context that never connected is free'd without
+ * telling. */
+static int __redisReplicaClose(redisAsyncContext *ac) {
+    if (!(ac->c.flags & REDIS_CONNECTED) && ac->replies.len == 0) {
+        ac->data = NULL;
+        redisAsyncFree(ac);
+        return 1;
+    }
+    redisAsyncDisconnect(ac);
+    return 0;
+}
+
+static redisReplicaNode *__redisReplicaGetNode(redisReplicaContext *rc, const char *host, size_t hostlen, int port) {
+    redisReplicaNode *node;
+
+    for (node = rc->replicas; node != NULL; node = node->next)
+        if (node->port == port && strlen(node->host) == hostlen &&
+            memcmp(node->host,host,hostlen) == 0)
+            return node;
+
+    node = calloc(1,sizeof(*node));
+    if (node == NULL)
+        return NULL;
+    node->host = malloc(hostlen+1);
+    if (node->host == NULL) {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->host,host,hostlen);
+    node->host[hostlen] = '\0';
+    node->port = port;
+    node->rc = rc;
+    node->next = rc->replicas;
+    rc->replicas = node;
+    return node;
+}
+
+/* Take the replicas and their offsets from a ROLE reply of the primary:
+ * "master", its offset, then host, port and offset of every replica. */
+static void __redisReplicaOnRole(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReplicaContext *rc = privdata;
+    redisReplicaNode *node, **prev;
+    redisReply *reply = r, *list, *entry;
+    size_t i;
+
+    ((void)ac);
+    rc->refreshing = 0;
+    if (reply == NULL || (rc->flags & (REDIS_REPLICA_DISCONNECTING|REDIS_REPLICA_FREEING)))
+        return;
+
+    for (node = rc->replicas; node != NULL; node = node->next)
+        node->listed = 0;
+
+    /* Anything but a primary has no replicas to offer. */
+    if (reply->type == REDIS_REPLY_ARRAY && reply->elements >= 3 &&
+        reply->element[0]->type == REDIS_REPLY_STRING &&
+        strcmp(reply->element[0]->str,"master") == 0 &&
+        reply->element[1]->type == REDIS_REPLY_INTEGER &&
+        reply->element[2]->type == REDIS_REPLY_ARRAY)
+    {
+        rc->offset = reply->element[1]->integer;
+        list = reply->element[2];
+        for (i = 0; i < list->elements; i++) {
+            entry = list->element[i];
+            if (entry->type != REDIS_REPLY_ARRAY || entry->elements < 3 ||
+                entry->element[0]->type != REDIS_REPLY_STRING ||
+                entry->element[1]->type != REDIS_REPLY_STRING ||
+                entry->element[2]->type != REDIS_REPLY_STRING)
+                continue;
+            node = __redisReplicaGetNode(rc,entry->element[0]->str,entry->element[0]->len,
+                                         atoi(entry->element[1]->str));
+            if (node == NULL)
+                continue;
+            node->listed = 1;
+            node->offset = strtoll(entry->element[2]->str,NULL,10);
+        }
+    }
+
+    /* Connect to new replicas, let go of the ones no longer listed. */
+    prev = &rc->replicas;
+    while ((node = *prev) != NULL) {
+        if (node->listed) {
+            if (node->ac == NULL)
+                node->ac = __redisReplicaConnectTo(rc,node->host,node->port,node,
+                                                   __redisReplicaOnConnect,
+                                                   __redisReplicaOnDisconnect);
+        } else if (node->ac != NULL && !(node->ac->c.flags & REDIS_DISCONNECTING) &&
+                   __redisReplicaClose(node->ac)) {
+            node->ac = NULL;
+        }
+        if (!node->listed && node->ac == NULL) {
+            *prev = node->next;
+            __redisReplicaFreeNode(node);
+            continue;
+        }
+        prev = &node->next;
+    }
+}
+
+static void __redisReplicaRefresh(redisReplicaContext *rc, long long now) {
+    if (rc->refreshing || !__redisReplicaUsable(rc->primary,0))
+        return;
+    if (redisAsyncCommand(rc->primary,__redisReplicaOnRole,rc,"ROLE") == REDIS_OK) {
+        rc->refreshing = 1;
+        rc->refresh = now+REDIS_REPLICA_REFRESH_INTERVAL*1000LL;
+    }
+}
+
+redisReplicaContext *redisReplicaConnect(const char *ip, int port,
+                                         redisReplicaAttachCallback *attach, void *privdata)
+{
+    redisReplicaContext *rc;
+
+    if (attach == NULL)
+        return NULL;
+
+    rc = calloc(1,sizeof(*rc));
+    if (rc == NULL)
+        return NULL;
+
+    rc->port = port;
+    rc->maxlag = REDIS_REPLICA_MAX_LAG;
+    redisBalancerInit(&rc->balancer);
+    rc->attach = attach;
+    rc->attachdata = privdata;
+    rc->host = strdup(ip);
+    if (rc->host == NULL) {
+        __redisReplicaFreeStorage(rc);
+        return NULL;
+    }
+
+    /* A primary failing now is retried when commands come in. */
+    __redisReplicaConnectPrimary(rc);
+    __redisReplicaRefresh(rc,redisNowUsec());
+    return rc;
+}
+
+void redisReplicaSetMaxLag(redisReplicaContext *rc, long long bytes) {
+    rc->maxlag = bytes;
+}
+
+int redisReplicaEnableHedging(redisReplicaContext *rc, int percent) {
+    if (percent < 0 || percent > 100)
+        return REDIS_ERR;
+    rc->hedge.percent = percent;
+    return REDIS_OK;
+}
+
+void redisReplicaDisconnect(redisReplicaContext *rc) {
+    redisReplicaNode *node;
+    redisAsyncContext *ac;
+
+    rc->flags |= REDIS_REPLICA_DISCONNECTING|REDIS_REPLICA_IN_DISCONNECT;
+    if ((ac = rc->primary) != NULL && __redisReplicaClose(ac))
+        rc->primary = NULL;
+    for (node = rc->replicas; node != NULL; node = node->next)
+        if ((ac = node->ac) != NULL && __redisReplicaClose(ac))
+            node->ac = NULL;
+    rc->flags &= ~REDIS_REPLICA_IN_DISCONNECT;
+    __redisReplicaCheckGone(rc);
+}
+
+void redisReplicaFree(redisReplicaContext *rc) {
+    redisReplicaNode *node;
+    redisAsyncContext *ac;
+
+    rc->flags |= REDIS_REPLICA_FREEING;
+    if ((ac = rc->primary) != NULL) {
+        rc->primary = NULL;
+        ac->data = NULL;
+        redisAsyncFree(ac);
+    }
+    for (node = rc->replicas; node != NULL; node = node->next) {
+        if ((ac = node->ac) == NULL)
+            continue;
+        node->ac = NULL;
+        ac->data = NULL;
+        redisAsyncFree(ac);
+    }
+    __redisReplicaFreeStorage(rc);
+}
+
+static int __redisReplicaFresh(redisReplicaContext *rc, redisReplicaNode *node) {
+    return node->listed && __redisReplicaUsable(node->ac,REDIS_CONNECTED) &&
+           (rc->maxlag < 0 || rc->offset-node->offset <= rc->maxlag);
+}
+
+/* The replicas a read can go to, for the balancer. */
+typedef struct redisReplicaChoice {
+    redisReplicaContext *rc;
+    redisReplicaNode *exclude;
+} redisReplicaChoice;
+
+static redisAsyncContext *__redisReplicaGet(void *ctx, int i, redisBalanceEndpoint **ep) {
+    redisReplicaChoice *choice = ctx;
+    redisReplicaNode *node = choice->rc->replicas;
+
+    while (i-- > 0)
+        node = node->next;
+    if (node == choice->exclude || !__redisReplicaFresh(choice->rc,node))
+        return NULL;
+    *ep = &node->balance;
+    return node->ac;
+}
+
+/* Pick among the replicas that are up and recent enough, other than
+ * "exclude". */
+static redisReplicaNode *__redisReplicaPick(redisReplicaContext *rc, redisReplicaNode *exclude) {
+    redisReplicaChoice choice;
+    redisReplicaNode *node;
+    int n = 0;
+
+    for (node = rc->replicas; node != NULL; node = node->next)
+        n++;
+    choice.rc = rc;
+    choice.exclude = exclude;
+    if ((n = redisBalancerPick(&rc->balancer,&choice,n,__redisReplicaGet)) == -1)
+        return NULL;
+    for (node = rc->replicas; n > 0; n--)
+        node = node->next;
+    return node;
+}
+
+static int __redisReplicaCompareLatency(const void *a, const void *b) {
+    unsigned int x = *(const unsigned int*)a, y = *(const unsigned int*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void __redisReplicaAddLatency(redisReplicaNode *node, long long usec) {
+    unsigned int sorted[REDIS_REPLICA_HEDGE_SAMPLES];
+    unsigned int n;
+
+    if (usec > (long long)UINT_MAX)
+        usec = UINT_MAX;
+    node->latency[node->nlatency++ % REDIS_REPLICA_HEDGE_SAMPLES] = (unsigned int)usec;
+    if (node->nlatency % REDIS_REPLICA_HEDGE_MIN_SAMPLES != 0)
+        return;
+
+    n = node->nlatency < REDIS_REPLICA_HEDGE_SAMPLES ? node->nlatency : REDIS_REPLICA_HEDGE_SAMPLES;
+    memcpy(sorted,node->latency,sizeof(*sorted)*n);
+    qsort(sorted,n,sizeof(*sorted),__redisReplicaCompareLatency);
+    node->p95 = sorted[(n-1)*95/100];
+}
+
+static void __redisReplicaUnlinkHedge(redisReplicaHedge *h) {
+    if (h->at == 0)
+        return;
+    if (h->prev != NULL)
+        h->prev->next = h->next;
+    else
+        h->node->hedges = h->next;
+    if (h->next != NULL)
+        h->next->prev = h->prev;
+    h->at = 0;
+}
+
+/* Send the read to a second replica, when the budget allows. */
+static void __redisReplicaSendHedge(redisReplicaHedge *h, long long now);
+
+static void __redisReplicaOnHedgeTimer(redisAsyncContext *ac, void *privdata) {
+    redisReplicaNode *node = privdata;
+    redisReplicaHedge *h, *next;
+    long long now = redisNowUsec(), earliest = 0;
+
+    for (h = node->hedges; h != NULL; h = next) {
+        next = h->next;
+        if (h->at <= now) {
+            __redisReplicaUnlinkHedge(h);
+            __redisReplicaSendHedge(h,now);
+        } else if (earliest == 0 || h->at < earliest) {
+            earliest = h->at;
+        }
+    }
+    if (earliest != 0)
+        redisAsyncSetTimer(ac,earliest-now,__redisReplicaOnHedgeTimer,node);
+}
+
+static void __redisReplicaOnHedgeReply(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReplicaHedge *h = privdata;
+    redisReplicaNode *node = ac->data;
+
+    h->pending--;
+
+    /* The slow replies count most, so the loser's latency is kept too. */
+    if (r != NULL && node != NULL)
+        __redisReplicaAddLatency(node,redisNowUsec()-(node == h->node ? h->sent : h->hedged));
+
+    /* A copy lost with its connection leaves the other one a chance. */
+    if (!h->done && (r != NULL || h->pending == 0)) {
+        h->done = 1;
+        __redisReplicaUnlinkHedge(h);
+        if (r != NULL && node != h->node)
+            h->rc->hedge.won++;
+        if (h->fn != NULL)
+            h->fn(ac,r,h->privdata);
+    }
+    if (h->pending == 0)
+        free(h);
+}
+
+static void __redisReplicaSendHedge(redisReplicaHedge *h, long long now) {
+    redisReplicaContext *rc = h->rc;
+    redisReplicaNode *node;
+
+    if ((rc->flags & (REDIS_REPLICA_DISCONNECTING|REDIS_REPLICA_FREEING)) || rc->hedge.budget < 100)
+        return;
+    if ((node = __redisReplicaPick(rc,h->node)) == NULL)
+        return;
+    if (redisAsyncFormattedCommand(node->ac,__redisReplicaOnHedgeReply,h,h->cmd,h->len) != REDIS_OK)
+        return;
+    h->pending++;
+    h->hedged = now;
+    rc->hedge.budget -= 100;
+    rc->hedge.sent++;
+}
+
+static int __redisReplicaHedgedCommand(redisReplicaContext *rc, redisReplicaNode *node, redisCallbackFn *fn,
+                                       void *privdata, const char *cmd, size_t len, long long now)
+{
+    redisAsyncContext *ac = node->ac;
+    redisReplicaHedge *h;
+
+    h = malloc(sizeof(*h)+len);
+    if (h == NULL)
+        return REDIS_ERR;
+    h->rc = rc;
+    h->fn = fn;
+    h->privdata = privdata;
+    h->node = node;
+    h->sent = now;
+    h->hedged = 0;
+    h->pending = 1;
+    h->done = 0;
+    h->len = len;
+    memcpy(h->cmd,cmd,len);
+    if (redisAsyncFormattedCommand(ac,__redisReplicaOnHedgeReply,h,cmd,len) != REDIS_OK) {
+        free(h);
+        return REDIS_ERR;
+    }
+
+    /* Every read adds "percent" hundredths of a hedge to the budget. */
+    rc->hedge.budget += rc->hedge.percent;
+    if (rc->hedge.budget > 100*REDIS_REPLICA_HEDGE_BURST)
+        rc->hedge.budget = 100*REDIS_REPLICA_HEDGE_BURST;
+
+    h->at = now+(node->p95 != 0 ? node->p95 : REDIS_REPLICA_HEDGE_DELAY*1000LL);
+    h->prev = NULL;
+    h->next = node->hedges;
+    if (h->next != NULL)
+        h->next->prev = h;
+    node->hedges = h;
+    if (ac->timer.at == 0 || h->at < ac->timer.at)
+        redisAsyncSetTimer(ac,h->at-now,__redisReplicaOnHedgeTimer,node);
+    return REDIS_OK;
+}
+
+int redisReplicaFormattedCommand(redisReplicaContext *rc, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len) {
+    const redisCommandInfo *info;
+    redisCommandKeys keys;
+    redisReplicaNode *node;
+    long long now;
+
+    if (rc->flags & (REDIS_REPLICA_DISCONNECTING|REDIS_REPLICA_FREEING))
+        return REDIS_ERR;
+
+    now = redisNowUsec();
+    if (rc->primary == NULL && rc->retry <= now)
+        __redisReplicaConnectPrimary(rc);
+    if (rc->refresh <= now)
+        __redisReplicaRefresh(rc,now);
+
+    info = redisFormattedCommandInfo(cmd,len,&keys);
+    if (info != NULL && (info->flags & REDIS_CMD_READONLY) &&
+        (node = __redisReplicaPick(rc,NULL)) != NULL)
+    {
+        if (rc->hedge.percent > 0) {
+            if (__redisReplicaHedgedCommand(rc,node,fn,privdata,cmd,len,now) == REDIS_OK)
+                return REDIS_OK;
+        } else if (redisAsyncFormattedCommand(node->ac,fn,privdata,cmd,len) == REDIS_OK) {
+            return REDIS_OK;
+        }
+    }
+
+    if (!__redisReplicaUsable(rc->primary,0))
+        return REDIS_ERR;
+    return redisAsyncFormattedCommand(rc->primary,fn,privdata,cmd,len);
+}
+
+int redisvReplicaCommand(redisReplicaContext *rc, redisCallbackFn *fn, void *privdata, const char *format, va_list ap) {
+    char *cmd;
+    int len;
+    int status;
+    len = redisvFormatCommand(&cmd,format,ap);
+
+    /* We don't want to pass -1 or -2 to future functions as a length. */
+    if (len < 0)
+        return REDIS_ERR;
+
+    status = redisReplicaFormattedCommand(rc,fn,privdata,cmd,len);
+    free(cmd);
+    return status;
+}
+
+int redisReplicaCommand(redisReplicaContext *rc, redisCallbackFn *fn, void *privdata, const char *format, ...) {
+    va_list ap;
+    int status;
+    va_start(ap,format);
+    status = redisvReplicaCommand(rc,fn,privdata,format,ap);
+    va_end(ap);
+    return status;
+}
+
+int redisReplicaCommandArgv(redisReplicaContext *rc, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen) {
+    sds cmd;
+    int len;
+    int status;
+    len = redisFormatSdsCommandArgv(&cmd,argc,argv,argvlen);
+    if (len < 0)
+        return REDIS_ERR;
+    status = redisReplicaFormattedCommand(rc,fn,privdata,cmd,len);
+    sdsfree(cmd);
+    return status;
+}
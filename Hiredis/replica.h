@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_REPLICA_H
+#define __HIREDIS_REPLICA_H
+#include "async.h"
+#include "balance.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Msec between two ROLE queries to the primary, which find the replicas
+ * and how far behind they are. */
+#define REDIS_REPLICA_REFRESH_INTERVAL 1000
+
+/* Default staleness tolerance: bytes of the replication stream a replica
+ * may miss and still serve reads. */
+#define REDIS_REPLICA_MAX_LAG (1024*1024)
+
+/* Msec to wait before connecting to the primary again after a failure. */
+#define REDIS_REPLICA_RETRY_INTERVAL 1000
+
+/* Hedge delay in msec until a replica answered enough hedged reads for
+ * its 95th percentile latency to be used. */
+#define REDIS_REPLICA_HEDGE_DELAY 10
+
+/* Latencies kept per replica, and how many are needed before they set the
+ * hedge delay. The percentile is worked out again every
+ * REDIS_REPLICA_HEDGE_MIN_SAMPLES replies. */
+#define REDIS_REPLICA_HEDGE_SAMPLES 128
+#define REDIS_REPLICA_HEDGE_MIN_SAMPLES 16
+
+/* Hedges the budget can save up for a burst of slow replies. */
+#define REDIS_REPLICA_HEDGE_BURST 10
+
+/* Flags set while the context goes away. */
+#define REDIS_REPLICA_DISCONNECTING 0x1
+#define REDIS_REPLICA_FREEING 0x2
+
+/* Hook attaching a new connection to the event library, e.g. a wrapper
+ * around redisMacOSAttach(). Returns REDIS_OK or REDIS_ERR. */
+typedef int (redisReplicaAttachCallback)(redisAsyncContext *ac, void *privdata);
+
+struct redisReplicaContext; /* forward declaration */
+struct redisReplicaHedge; /* forward declaration */
+
+/* A replica, as listed by the primary. */
+typedef struct redisReplicaNode {
+    char *host;
+    int port;
+    long long offset; /* replication offset acknowledged by the replica */
+    int listed; /* still listed by the last ROLE reply */
+    redisAsyncContext *ac; /* NULL while not connected */
+    redisBalanceEndpoint balance;
+    struct redisReplicaContext *rc;
+    struct redisReplicaNode *next;
+
+    /* Hedged reads: usec latencies of the last replies, their 95th
+     * percentile (0 until known), and the reads sent here waiting for
+     * their hedge delay to run out. */
+    unsigned int latency[REDIS_REPLICA_HEDGE_SAMPLES];
+    unsigned int nlatency;
+    long long p95;
+    struct redisReplicaHedge *hedges;
+} redisReplicaNode;
+
+/* A primary and its replicas, used as one. Read-only commands go to the
+ * better of two replicas taken at random, by their reply latency and the
+ * replies they have pending (see balance.h), other commands to the
+ * primary. Replicas are found with
+ * ROLE on the primary, queried again every REDIS_REPLICA_REFRESH_INTERVAL
+ * msec as commands come in. A replica is skipped while it lags behind the
+ * primary by more than the staleness tolerance, and read-only commands go
+ * to the primary when no replica is usable. MULTI, WATCH, pub/sub and other
+ * commands spanning several commands can't be used. */
+typedef struct redisReplicaContext {
+    redisAsyncContext *primary; /* NULL while down */
+    long long retry; /* monotonic usec the primary is retried at */
+    long long offset; /* replication offset of the primary */
+    long long maxlag; /* bytes a replica may lag behind, -1 for no limit */
+    long long refresh; /* monotonic usec of the next ROLE query */
+    int refreshing; /* ROLE in flight */
+    int flags;
+    redisBalancer balancer; /* among replicas */
+    redisReplicaNode *replicas;
+
+    /* Hedged reads, see redisReplicaEnableHedging(). */
+    struct {
+        int percent; /* 0 when off */
+        int budget; /* hundredths of a hedge that may be sent */
+        unsigned long long sent; /* second copies sent */
+        unsigned long long won; /* second copies answering first */
+    } hedge;
+
+    char *host;
+    int port;
+    redisReplicaAttachCallback *attach;
+    void *attachdata;
+} redisReplicaContext;
+
+/* Connect to a primary, and to its replicas once they are known. */
+redisReplicaContext *redisReplicaConnect(const char *ip, int port,
+                                         redisReplicaAttachCallback *attach, void *privdata);
+
+/* Set how many bytes of the replication stream a replica may miss and
+ * still serve reads, 0 to use only replicas that caught up with the last
+ * known offset of the primary, -1 for no limit. */
+void redisReplicaSetMaxLag(redisReplicaContext *rc, long long bytes);
+
+/* Hedged reads. A read-only command a replica didn't answer within its
+ * 95th percentile latency is sent to another replica as well, and the
+ * first reply wins; the other one is dropped. At most "percent" percent of
+ * the reads are sent twice. 0 turns hedging off. Requires the
+ * ev.scheduleTimer hook on the connections. */
+int redisReplicaEnableHedging(redisReplicaContext *rc, int percent);
+
+/* Close the connections once pending replies are read, the context is
+ * free'd with the last one. */
+void redisReplicaDisconnect(redisReplicaContext *rc);
+void redisReplicaFree(redisReplicaContext *rc);
+
+/* Commands, like their redisAsyncCommand() counterparts. REDIS_ERR is
+ * returned when no connection could take the command. */
+int redisvReplicaCommand(redisReplicaContext *rc, redisCallbackFn *fn, void *privdata, const char *format, va_list ap);
+int redisReplicaCommand(redisReplicaContext *rc, redisCallbackFn *fn, void *privdata, const char *format, ...);
+int redisReplicaCommandArgv(redisReplicaContext *rc, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen);
+int redisReplicaFormattedCommand(redisReplicaContext *rc, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
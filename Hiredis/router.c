@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "router.h"
+
+/* Kinds of trie nodes, by the pattern token leading to them. */
+#define REDIS_ROUTE_LITERAL 0
+#define REDIS_ROUTE_CLASS 1 /* '?' or [...] */
+#define REDIS_ROUTE_STAR 2
+
+typedef struct redisRouteHandler {
+    redisCallbackFn *fn; /* NULL once removed while dispatching */
+    void *privdata;
+    struct redisRouteHandler *next;
+} redisRouteHandler;
+
+typedef struct redisRouteEdge {
+    unsigned char byte;
+    struct redisRouteNode *node;
+} redisRouteEdge;
+
+/* A node stands for a pattern prefix. Its literal children are found by
+ * binary search on their byte, its class children are tested one by one.
+ * A '*' child is entered along with its parent, without a byte, and stays
+ * in the walk for every byte that follows. */
+typedef struct redisRouteNode {
+    int kind;
+    unsigned char set[32]; /* bytes a class node is entered with */
+    redisRouteEdge *edges; /* sorted by byte */
+    int nedges;
+    struct redisRouteNode **classes;
+    int nclasses;
+    struct redisRouteNode *star;
+    struct redisRouteNode *parent;
+    int index; /* position in router->nodes */
+    redisRouteHandler *handlers;
+    unsigned int mark; /* walk generation it was last entered in */
+} redisRouteNode;
+
+/* Read the pattern token at "p", as Redis' stringmatchlen() understands
+ * it. Runs of '*' are one token. Returns what follows. */
+static const char *__redisRouterToken(const char *p, const char *end, int *kind,
+                                      unsigned char *byte, unsigned char *set)
+{
+    int negate, i;
+    unsigned char lo, hi, t;
+
+    if (*p == '*') {
+        *kind = REDIS_ROUTE_STAR;
+        while (p < end && *p == '*')
+            p++;
+        return p;
+    }
+    if (*p == '?') {
+        *kind = REDIS_ROUTE_CLASS;
+        memset(set,0xff,32);
+        return p+1;
+    }
+    if (*p == '[') {
+        *kind = REDIS_ROUTE_CLASS;
+        memset(set,0,32);
+        p++;
+        negate = p < end && *p == '^';
+        if (negate)
+            p++;
+        while (p < end && *p != ']') {
+            if (*p == '\\' && p+1 < end) {
+                lo = hi = (unsigned char)p[1];
+                p += 2;
+            } else if (p+2 < end && p[1] == '-') {
+                lo = (unsigned char)p[0];
+                hi = (unsigned char)p[2];
+                if (lo > hi) {
+                    t = lo;
+                    lo = hi;
+                    hi = t;
+                }
+                p += 3;
+            } else {
+                lo = hi = (unsigned char)*p++;
+            }
+            for (i = lo; i <= hi; i++)
+                set[i>>3] |= 1<<(i&7);
+        }
+        if (p < end)
+            p++; /* ']' */
+        if (negate) {
+            for (i = 0; i < 32; i++)
+                set[i] = ~set[i];
+        }
+        return p;
+    }
+
+    if (*p == '\\' && p+1 < end)
+        p++;
+    *kind = REDIS_ROUTE_LITERAL;
+    *byte = (unsigned char)*p;
+    return p+1;
+}
+
+/* Room for every node in the node sets of a walk. */
+static int __redisRouterGrowSets(redisRouter *router) {
+    redisRouteNode **active, **next;
+    int size = router->nactive ? router->nactive : 16;
+
+    while (size < router->nnodes)
+        size *= 2;
+    if (size == router->nactive)
+        return REDIS_OK;
+    active = realloc(router->active,sizeof(*active)*size);
+    if (active == NULL)
+        return REDIS_ERR;
+    router->active = active;
+    next = realloc(router->next,sizeof(*next)*size);
+    if (next == NULL)
+        return REDIS_ERR;
+    router->next = next;
+    router->nactive = size;
+    return REDIS_OK;
+}
+
+static redisRouteNode *__redisRouterNewNode(redisRouter *router, redisRouteNode *parent, int kind) {
+    redisRouteNode **nodes, *node;
+
+    if ((router->nnodes & (router->nnodes-1)) == 0) {
+        nodes = realloc(router->nodes,sizeof(*nodes)*(router->nnodes ? router->nnodes*2 : 16));
+        if (nodes == NULL)
+            return NULL;
+        router->nodes = nodes;
+    }
+    if ((node = calloc(1,sizeof(*node))) == NULL)
+        return NULL;
+    node->kind = kind;
+    node->parent = parent;
+    node->index = router->nnodes;
+    router->nodes[router->nnodes++] = node;
+    return node;
+}
+
+static void __redisRouterFreeNode(redisRouteNode *node) {
+    redisRouteHandler *h;
+
+    while ((h = node->handlers) != NULL) {
+        node->handlers = h->next;
+        free(h);
+    }
+    free(node->edges);
+    free(node->classes);
+    free(node);
+}
+
+/* Position of the literal child for "byte", or where it belongs. */
+static int __redisRouterEdge(const redisRouteNode *node, unsigned char byte) {
+    int lo = 0, hi = node->nedges, mid;
+
+    while (lo < hi) {
+        mid = (lo+hi)/2;
+        if (node->edges[mid].byte < byte)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* The child of "node" for a token, created when "create" is set. */
+static redisRouteNode *__redisRouterChild(redisRouter *router, redisRouteNode *node, int kind,
+                                          unsigned char byte, const unsigned char *set, int create)
+{
+    redisRouteNode *child, **classes;
+    redisRouteEdge *edges;
+    int i;
+
+    if (kind == REDIS_ROUTE_STAR) {
+        if (node->star == NULL && create)
+            node->star = __redisRouterNewNode(router,node,kind);
+        return node->star;
+    }
+
+    if (kind == REDIS_ROUTE_CLASS) {
+        for (i = 0; i < node->nclasses; i++)
+            if (memcmp(node->classes[i]->set,set,32) == 0)
+                return node->classes[i];
+        if (!create)
+            return NULL;
+        classes = realloc(node->classes,sizeof(*classes)*(node->nclasses+1));
+        if (classes == NULL)
+            return NULL;
+        node->classes = classes;
+        if ((child = __redisRouterNewNode(router,node,kind)) == NULL)
+            return NULL;
+        memcpy(child->set,set,32);
+        node->classes[node->nclasses++] = child;
+        return child;
+    }
+
+    i = __redisRouterEdge(node,byte);
+    if (i < node->nedges && node->edges[i].byte == byte)
+        return node->edges[i].node;
+    if (!create)
+        return NULL;
+    edges = realloc(node->edges,sizeof(*edges)*(node->nedges+1));
+    if (edges == NULL)
+        return NULL;
+    node->edges = edges;
+    if ((child = __redisRouterNewNode(router,node,kind)) == NULL)
+        return NULL;
+    memmove(&edges[i+1],&edges[i],sizeof(*edges)*(node->nedges-i));
+    edges[i].byte = byte;
+    edges[i].node = child;
+    node->nedges++;
+    return child;
+}
+
+/* The node a pattern ends at, created along the way when "create" is set. */
+static redisRouteNode *__redisRouterNode(redisRouter *router, const char *pattern, size_t len, int create) {
+    const char *p = pattern, *end = pattern+len;
+    redisRouteNode *node = router->root;
+    unsigned char byte = 0, set[32];
+    int kind;
+
+    while (p < end && node != NULL) {
+        p = __redisRouterToken(p,end,&kind,&byte,set);
+        node = __redisRouterChild(router,node,kind,byte,set,create);
+    }
+    return node;
+}
+
+/* Take a node without handlers or children out of the trie. */
+static void __redisRouterUnlink(redisRouter *router, redisRouteNode *node) {
+    redisRouteNode *parent = node->parent;
+    int i;
+
+    if (parent->star == node) {
+        parent->star = NULL;
+    } else if (node->kind == REDIS_ROUTE_CLASS) {
+        for (i = 0; parent->classes[i] != node; i++);
+        parent->classes[i] = parent->classes[--parent->nclasses];
+    } else {
+        for (i = 0; parent->edges[i].node != node; i++);
+        memmove(&parent->edges[i],&parent->edges[i+1],sizeof(*parent->edges)*(parent->nedges-i-1));
+        parent->nedges--;
+    }
+
+    router->nodes[node->index] = router->nodes[--router->nnodes];
+    router->nodes[node->index]->index = node->index;
+    __redisRouterFreeNode(node);
+}
+
+static int __redisRouterUnused(const redisRouter *router, const redisRouteNode *node) {
+    return node != router->root && node->handlers == NULL && node->nedges == 0 &&
+           node->nclasses == 0 && node->star == NULL;
+}
+
+/* Drop the handlers removed while dispatching and the nodes left unused. */
+static void __redisRouterSweep(redisRouter *router) {
+    redisRouteHandler **h, *dead;
+    int i, pruned;
+
+    for (i = 0; i < router->nnodes; i++) {
+        h = &router->nodes[i]->handlers;
+        while (*h != NULL) {
+            if ((*h)->fn == NULL) {
+                dead = *h;
+                *h = dead->next;
+                free(dead);
+            } else {
+                h = &(*h)->next;
+            }
+        }
+    }
+    do {
+        pruned = 0;
+        for (i = router->nnodes-1; i >= 0; i--) {
+            if (i < router->nnodes && __redisRouterUnused(router,router->nodes[i])) {
+                __redisRouterUnlink(router,router->nodes[i]);
+                pruned = 1;
+            }
+        }
+    } while (pruned);
+    router->removed = 0;
+}
+
+redisRouter *redisRouterCreate(void) {
+    redisRouter *router;
+
+    if ((router = calloc(1,sizeof(*router))) == NULL)
+        return NULL;
+    if ((router->root = __redisRouterNewNode(router,NULL,REDIS_ROUTE_LITERAL)) == NULL ||
+        __redisRouterGrowSets(router) != REDIS_OK)
+    {
+        redisRouterFree(router);
+        return NULL;
+    }
+    return router;
+}
+
+static void __redisRouterFree(redisRouter *router) {
+    int i;
+
+    for (i = 0; i < router->nnodes; i++)
+        __redisRouterFreeNode(router->nodes[i]);
+    free(router->nodes);
+    free(router->active);
+    free(router->next);
+    free(router);
+}
+
+void redisRouterFree(redisRouter *router) {
+    if (router == NULL)
+        return;
+    if (router->dispatching) {
+        router->flags |= REDIS_ROUTER_FREEING;
+        return;
+    }
+    __redisRouterFree(router);
+}
+
+int redisRouterAdd(redisRouter *router, const char *pattern, size_t len, redisCallbackFn *fn, void *privdata) {
+    redisRouteHandler *handler, **tail;
+    redisRouteNode *node;
+
+    if (fn == NULL || (handler = malloc(sizeof(*handler))) == NULL)
+        return REDIS_ERR;
+    if ((node = __redisRouterNode(router,pattern,len,1)) == NULL) {
+        free(handler);
+        if (!router->dispatching)
+            __redisRouterSweep(router);
+        return REDIS_ERR;
+    }
+
+    /* The node sets grow with the trie, unless a walk is using them. */
+    if (!router->dispatching)
+        __redisRouterGrowSets(router);
+
+    handler->fn = fn;
+    handler->privdata = privdata;
+    handler->next = NULL;
+    for (tail = &node->handlers; *tail != NULL; tail = &(*tail)->next);
+    *tail = handler;
+    router->handlers++;
+    return REDIS_OK;
+}
+
+int redisRouterRemove(redisRouter *router, const char *pattern, size_t len, redisCallbackFn *fn, void *privdata) {
+    redisRouteHandler **h, *handler;
+    redisRouteNode *node, *parent;
+
+    if ((node = __redisRouterNode(router,pattern,len,0)) == NULL)
+        return REDIS_ERR;
+    for (h = &node->handlers; *h != NULL; h = &(*h)->next)
+        if ((*h)->fn == fn && (*h)->privdata == privdata)
+            break;
+    if (*h == NULL)
+        return REDIS_ERR;
+    router->handlers--;
+
+    /* A walk may still hold the handler and its node. */
+    if (router->dispatching) {
+        (*h)->fn = NULL;
+        router->removed++;
+        return REDIS_OK;
+    }
+
+    handler = *h;
+    *h = handler->next;
+    free(handler);
+    while (__redisRouterUnused(router,node)) {
+        parent = node->parent;
+        __redisRouterUnlink(router,node);
+        node = parent;
+    }
+    return REDIS_OK;
+}
+
+/* Put a node in a set of the walk, with the '*' child that follows it
+ * without a byte. */
+static void __redisRouterEnter(redisRouter *router, redisRouteNode **set, int *n, redisRouteNode *node) {
+    if (node->mark == router->mark)
+        return;
+    node->mark = router->mark;
+    set[(*n)++] = node;
+    if (node->star != NULL)
+        __redisRouterEnter(router,set,n,node->star);
+}
+
+/* Start a new node set. Nodes remember the generation they were last
+ * entered in, so a set needs no clearing. */
+static void __redisRouterNextMark(redisRouter *router) {
+    int i;
+
+    if (++router->mark == 0) {
+        for (i = 0; i < router->nnodes; i++)
+            router->nodes[i]->mark = 0;
+        router->mark = 1;
+    }
+}
+
+/* Call the handlers of a node set, or of every node when "set" is NULL.
+ * Handlers may add nodes, so those are looked up as the calls go. */
+static int __redisRouterCall(redisRouter *router, redisAsyncContext *ac, redisReply *reply,
+                             redisRouteNode **set, int n)
+{
+    redisRouteHandler *h;
+    int i, called = 0;
+
+    router->dispatching++;
+    for (i = 0; i < (set ? n : router->nnodes); i++) {
+        for (h = (set ? set[i] : router->nodes[i])->handlers; h != NULL; h = h->next) {
+            if (h->fn != NULL) {
+                h->fn(ac,reply,h->privdata);
+                called++;
+            }
+        }
+    }
+    router->dispatching--;
+
+    if (router->dispatching == 0) {
+        if (router->flags & REDIS_ROUTER_FREEING)
+            __redisRouterFree(router);
+        else if (router->removed)
+            __redisRouterSweep(router);
+    }
+    return called;
+}
+
+int redisRouterDispatch(redisRouter *router, redisAsyncContext *ac, redisReply *reply,
+                        const char *channel, size_t len)
+{
+    redisRouteNode **cur, **next, **tmp, *node, *child;
+    int ncur = 0, nnext, i, j;
+    unsigned char c;
+    size_t k;
+
+    /* The node sets are in use until the handlers are called. */
+    if (router->dispatching)
+        return REDIS_ERR;
+    if (router->nactive < router->nnodes && __redisRouterGrowSets(router) != REDIS_OK)
+        return REDIS_ERR;
+
+    cur = router->active;
+    next = router->next;
+    __redisRouterNextMark(router);
+
+    /* Like the server, only the empty pattern matches an empty channel. */
+    if (len == 0)
+        return __redisRouterCall(router,ac,reply,&router->root,1);
+    __redisRouterEnter(router,cur,&ncur,router->root);
+
+    for (k = 0; k < len && ncur > 0; k++) {
+        c = (unsigned char)channel[k];
+        nnext = 0;
+        __redisRouterNextMark(router);
+        for (i = 0; i < ncur; i++) {
+            node = cur[i];
+            if (node->nedges > 0) {
+                j = __redisRouterEdge(node,c);
+                if (j < node->nedges && node->edges[j].byte == c)
+                    __redisRouterEnter(router,next,&nnext,node->edges[j].node);
+            }
+            for (j = 0; j < node->nclasses; j++) {
+                child = node->classes[j];
+                if (child->set[c>>3] & (1<<(c&7)))
+                    __redisRouterEnter(router,next,&nnext,child);
+            }
+            if (node->kind == REDIS_ROUTE_STAR)
+                __redisRouterEnter(router,next,&nnext,node);
+        }
+        tmp = cur;
+        cur = next;
+        next = tmp;
+        ncur = nnext;
+    }
+    return __redisRouterCall(router,ac,reply,cur,ncur);
+}
+
+void redisRouterCallback(redisAsyncContext *ac, void *r, void *privdata) {
+    redisRouter *router = privdata;
+    redisReply *reply = r, *type;
+
+    /* The subscription is gone, every handler is told. */
+    if (reply == NULL) {
+        if (!router->dispatching)
+            __redisRouterCall(router,ac,NULL,NULL,0);
+        return;
+    }
+
+    if (reply->type != REDIS_REPLY_ARRAY || reply->elements < 3)
+        return;
+    type = reply->element[0];
+    if (type->len == 7 && memcmp(type->str,"message",7) == 0)
+        redisRouterDispatch(router,ac,reply,reply->element[1]->str,reply->element[1]->len);
+    else if (type->len == 8 && memcmp(type->str,"pmessage",8) == 0 && reply->elements >= 4)
+        redisRouterDispatch(router,ac,reply,reply->element[2]->str,reply->element[2]->len);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_ROUTER_H
+#define __HIREDIS_ROUTER_H
+#include "async.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Set when the router is free'd by a handler, it goes once the handlers
+ * of the message were called. */
+#define REDIS_ROUTER_FREEING 0x1
+
+struct redisRouteNode; /* private to router.c */
+
+/* Local fan-out of pub/sub messages. Handlers are registered with glob
+ * patterns, as PSUBSCRIBE takes them: '*', '?', '[...]' classes with '^'
+ * and ranges, and '\' escapes. The patterns are compiled into a trie
+ * sharing their common prefixes, walked once per message: every handler
+ * whose pattern matches the channel is called, in no particular order.
+ *
+ * The router stands in for the callback of a few broad server
+ * subscriptions, so many handlers share them:
+ *
+ *   redisRouterAdd(router,"orders.eu.*",11,onEurope,NULL);
+ *   redisRouterAdd(router,"orders.*.refund",15,onRefund,NULL);
+ *   redisAsyncCommand(ac,redisRouterCallback,router,"PSUBSCRIBE orders.*");
+ *
+ * Handlers are called with the message reply, and with a NULL reply for
+ * every subscription dropped with the connection. Subscribe and
+ * unsubscribe replies are not passed on. Handlers may add and remove
+ * handlers, and free the router, but not dispatch on it. */
+typedef struct redisRouter {
+    struct redisRouteNode *root;
+    struct redisRouteNode **nodes; /* every node, to walk and free them */
+    int nnodes;
+    struct redisRouteNode **active, **next; /* node sets of a walk */
+    int nactive; /* room in the node sets */
+    unsigned int mark; /* walk generation, see router.c */
+    int handlers;
+    int dispatching; /* nesting of handler calls */
+    int removed; /* handlers removed while dispatching, see router.c */
+    int flags;
+} redisRouter;
+
+redisRouter *redisRouterCreate(void);
+void redisRouterFree(redisRouter *router);
+
+/* Call "fn" with "privdata" for the messages on channels matching
+ * "pattern". The same pattern may have several handlers. */
+int redisRouterAdd(redisRouter *router, const char *pattern, size_t len, redisCallbackFn *fn, void *privdata);
+
+/* Remove the handler added with these arguments. */
+int redisRouterRemove(redisRouter *router, const char *pattern, size_t len, redisCallbackFn *fn, void *privdata);
+
+/* Call the handlers of the patterns matching "channel" with "reply".
+ * Returns the number of handlers called, REDIS_ERR from a handler. */
+int redisRouterDispatch(redisRouter *router, redisAsyncContext *ac, redisReply *reply,
+                        const char *channel, size_t len);
+
+/* Subscription callback taking the router as privdata: "message" and
+ * "pmessage" replies are dispatched by their channel. */
+void redisRouterCallback(redisAsyncContext *ac, void *reply, void *privdata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE /* for pthread_setaffinity_np() */
+#endif
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "runtime.h"
+#include "command.h"
+#include "net.h"
+
+/* Callback handed off to the executor, with the reply it owns. */
+typedef struct redisRuntimeTask {
+    redisRuntime *rt;
+    redisCallbackFn *fn;
+    void *privdata;
+    redisAsyncContext *ac;
+    redisReply *reply;
+} redisRuntimeTask;
+
+static void __redisRuntimeAddRead(void *privdata) {
+    ((redisRuntimeConn*)privdata)->events |= POLLIN;
+}
+
+static void __redisRuntimeDelRead(void *privdata) {
+    ((redisRuntimeConn*)privdata)->events &= ~POLLIN;
+}
+
+static void __redisRuntimeAddWrite(void *privdata) {
+    ((redisRuntimeConn*)privdata)->events |= POLLOUT;
+}
+
+static void __redisRuntimeDelWrite(void *privdata) {
+    ((redisRuntimeConn*)privdata)->events &= ~POLLOUT;
+}
+
+static void __redisRuntimeScheduleTimer(void *privdata, struct timeval tv) {
+    ((redisRuntimeConn*)privdata)->timer = redisNowUsec()+tv.tv_sec*1000000LL+tv.tv_usec;
+}
+
+/* The loop polls c.fd afresh every time, only the interest in the old
+ * socket has to go. */
+static void __redisRuntimeReattach(void *privdata) {
+    ((redisRuntimeConn*)privdata)->events = 0;
+}
+
+/* The context is free'd: commands still coming get a NULL reply. */
+static void __redisRuntimeCleanup(void *privdata) {
+    redisRuntimeConn *conn = privdata;
+
+    conn->ac = NULL;
+    conn->events = 0;
+    conn->timer = 0;
+    if (conn->q != NULL)
+        conn->q->ac = NULL;
+}
+
+static void __redisRuntimeAttach(redisRuntimeConn *conn) {
+    redisAsyncContext *ac = conn->ac;
+
+    ac->ev.addRead = __redisRuntimeAddRead;
+    ac->ev.delRead = __redisRuntimeDelRead;
+    ac->ev.addWrite = __redisRuntimeAddWrite;
+    ac->ev.delWrite = __redisRuntimeDelWrite;
+    ac->ev.cleanup = __redisRuntimeCleanup;
+    ac->ev.scheduleTimer = __redisRuntimeScheduleTimer;
+    ac->ev.reattach = __redisRuntimeReattach;
+    ac->ev.data = conn;
+}
+
+static void __redisRuntimePin(redisRuntimeThread *t) {
+#ifdef __linux__
+    cpu_set_t set;
+
+    if (t->cpu < 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(t->cpu,&set);
+    pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+#else
+    (void)t;
+#endif
+}
+
+/* Free the connections of a thread, on the thread owning them. */
+static void __redisRuntimeCloseConns(redisRuntimeConn **conns, int nconns) {
+    int i;
+
+    for (i = 0; i < nconns; i++) {
+        if (conns[i]->ac != NULL)
+            redisAsyncFree(conns[i]->ac);
+        redisQueueFree(conns[i]->q);
+        conns[i]->q = NULL;
+    }
+}
+
+/* The loop of a thread, polling the stop pipe and, for every connection,
+ * its socket and its queue. */
+static void *__redisRuntimeLoop(void *privdata) {
+    redisRuntimeThread *t = privdata;
+    redisRuntime *rt = t->rt;
+    redisRuntimeConn *conn;
+    struct pollfd *fds, *fd;
+    long long now, deadline;
+    int i, timeout;
+
+    __redisRuntimePin(t);
+    for (i = 0; i < t->nconns; i++) {
+        conn = t->conns[i];
+        if (conn->ac != NULL && rt->setup != NULL && rt->setup(conn->ac,rt->setupdata) != REDIS_OK)
+            redisAsyncFree(conn->ac);
+    }
+
+    if ((fds = malloc(sizeof(*fds)*(1+2*t->nconns))) == NULL) {
+        __redisRuntimeCloseConns(t->conns,t->nconns);
+        return NULL;
+    }
+    fds[0].fd = rt->stopfd[0];
+    fds[0].events = POLLIN;
+
+    while (1) {
+        deadline = 0;
+        for (i = 0; i < t->nconns; i++) {
+            conn = t->conns[i];
+            fd = &fds[1+2*i];
+            fd->fd = conn->ac != NULL ? conn->ac->c.fd : -1;
+            fd->events = conn->events;
+            fd[1].fd = conn->q->fd;
+            fd[1].events = POLLIN;
+            if (conn->timer != 0 && (deadline == 0 || conn->timer < deadline))
+                deadline = conn->timer;
+        }
+
+        timeout = -1;
+        if (deadline != 0) {
+            now = redisNowUsec();
+            timeout = deadline > now ? (int)((deadline-now+999)/1000) : 0;
+        }
+        if (poll(fds,1+2*t->nconns,timeout) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[0].revents)
+            break;
+
+        now = redisNowUsec();
+        for (i = 0; i < t->nconns; i++) {
+            conn = t->conns[i];
+            fd = &fds[1+2*i];
+            if (fd[1].revents & POLLIN)
+                redisQueueHandleWakeup(conn->q);
+            if (conn->ac != NULL && conn->timer != 0 && conn->timer <= now) {
+                conn->timer = 0;
+                redisAsyncHandleTimeout(conn->ac);
+            }
+            /* Events of a socket the timeout just replaced are stale. */
+            if (conn->ac == NULL || conn->ac->c.fd != fd->fd)
+                continue;
+            if (fd->revents & (POLLIN|POLLHUP|POLLERR))
+                redisAsyncHandleRead(conn->ac);
+            if (conn->ac != NULL && (fd->revents & POLLOUT) && (conn->events & POLLOUT))
+                redisAsyncHandleWrite(conn->ac);
+        }
+    }
+
+    free(fds);
+    __redisRuntimeCloseConns(t->conns,t->nconns);
+    return NULL;
+}
+
+redisRuntime *redisRuntimeCreate(int nthreads, int flags) {
+    redisRuntime *rt;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    if (nthreads < 1)
+        return NULL;
+    if ((rt = calloc(1,sizeof(*rt))) == NULL)
+        return NULL;
+    if ((rt->threads = calloc(nthreads,sizeof(*rt->threads))) == NULL) {
+        free(rt);
+        return NULL;
+    }
+    rt->nthreads = nthreads;
+    rt->flags = flags & REDIS_RUNTIME_PIN_CPUS;
+    rt->stopfd[0] = rt->stopfd[1] = -1;
+    for (i = 0; i < nthreads; i++) {
+        rt->threads[i].rt = rt;
+        rt->threads[i].cpu = (flags & REDIS_RUNTIME_PIN_CPUS) && ncpus > 0 ? (int)(i % ncpus) : -1;
+    }
+    return rt;
+}
+
+static int __redisRuntimeAdd(redisRuntime *rt, enum redisConnectionType type, const char *host, int port) {
+    redisRuntimeThread *t = &rt->threads[rt->nconns % rt->nthreads];
+    redisRuntimeConn *conn, **conns;
+
+    if (rt->stopfd[0] != -1)
+        return REDIS_ERR;
+    if ((conn = calloc(1,sizeof(*conn))) == NULL)
+        return REDIS_ERR;
+    conn->type = type;
+    conn->port = port;
+    conn->thread = t;
+    if ((conn->host = strdup(host)) == NULL)
+        goto oom;
+
+    if ((conns = realloc(rt->conns,sizeof(*conns)*(rt->nconns+1))) == NULL)
+        goto oom;
+    rt->conns = conns;
+    if ((conns = realloc(t->conns,sizeof(*conns)*(t->nconns+1))) == NULL)
+        goto oom;
+    t->conns = conns;
+
+    t->conns[t->nconns++] = conn;
+    rt->conns[rt->nconns] = conn;
+    return rt->nconns++;
+
+oom:
+    free(conn->host);
+    free(conn);
+    return REDIS_ERR;
+}
+
+int redisRuntimeConnect(redisRuntime *rt, const char *ip, int port) {
+    return __redisRuntimeAdd(rt,REDIS_CONN_TCP,ip,port);
+}
+
+int redisRuntimeConnectUnix(redisRuntime *rt, const char *path) {
+    return __redisRuntimeAdd(rt,REDIS_CONN_UNIX,path,0);
+}
+
+void redisRuntimeSetSetupCallback(redisRuntime *rt, redisRuntimeSetupCallback *fn, void *privdata) {
+    rt->setup = fn;
+    rt->setupdata = privdata;
+}
+
+void redisRuntimeSetExecutor(redisRuntime *rt, redisRuntimeExecutor *executor, void *privdata) {
+    rt->executor = executor;
+    rt->executordata = privdata;
+}
+
+static void __redisRuntimeStop(redisRuntime *rt, int nthreads) {
+    char stop = 1;
+    int i;
+
+    while (write(rt->stopfd[1],&stop,1) == -1 && errno == EINTR);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(rt->threads[i].thread,NULL);
+}
+
+int redisRuntimeStart(redisRuntime *rt) {
+    redisRuntimeConn *conn;
+    redisAsyncContext *ac;
+    int i;
+
+    /* A runtime is started once. */
+    if (rt->stopfd[0] != -1)
+        return REDIS_ERR;
+    if (pipe(rt->stopfd) == -1) {
+        rt->stopfd[0] = rt->stopfd[1] = -1;
+        return REDIS_ERR;
+    }
+
+    /* Connections are set up here, the threads own them once started. */
+    for (i = 0; i < rt->nconns; i++) {
+        conn = rt->conns[i];
+        if (conn->type == REDIS_CONN_TCP)
+            ac = redisAsyncConnect(conn->host,conn->port);
+        else
+            ac = redisAsyncConnectUnix(conn->host);
+        if (ac != NULL && ac->err) {
+            redisAsyncFree(ac);
+            ac = NULL;
+        }
+        conn->ac = ac;
+        if ((conn->q = redisQueueCreate(ac)) == NULL)
+            return REDIS_ERR;
+        if (ac != NULL)
+            __redisRuntimeAttach(conn);
+    }
+
+    for (i = 0; i < rt->nthreads; i++) {
+        if (pthread_create(&rt->threads[i].thread,NULL,__redisRuntimeLoop,&rt->threads[i]) != 0) {
+            __redisRuntimeStop(rt,i);
+            return REDIS_ERR;
+        }
+    }
+    rt->flags |= REDIS_RUNTIME_RUNNING;
+    return REDIS_OK;
+}
+
+void redisRuntimeFree(redisRuntime *rt) {
+    redisRuntimeConn *conn;
+    int i;
+
+    if (rt == NULL)
+        return;
+    if (rt->flags & REDIS_RUNTIME_RUNNING)
+        __redisRuntimeStop(rt,rt->nthreads);
+
+    /* Connections of threads that never ran. */
+    for (i = 0; i < rt->nconns; i++) {
+        conn = rt->conns[i];
+        if (conn->ac != NULL)
+            redisAsyncFree(conn->ac);
+        redisQueueFree(conn->q);
+        free(conn->host);
+        free(conn);
+    }
+    for (i = 0; i < rt->nthreads; i++)
+        free(rt->threads[i].conns);
+    if (rt->stopfd[0] != -1) {
+        close(rt->stopfd[0]);
+        close(rt->stopfd[1]);
+    }
+    free(rt->conns);
+    free(rt->threads);
+    free(rt);
+}
+
+static void __redisRuntimeRunTask(void *privdata) {
+    redisRuntimeTask *task = privdata;
+
+    task->fn(task->ac,task->reply,task->privdata);
+    freeReplyObject(task->reply);
+    free(task);
+}
+
+static void __redisRuntimeOnReply(redisAsyncContext *ac, void *r, void *privdata) {
+    redisRuntimeTask *task = privdata;
+    redisReply *reply = r;
+
+    task->ac = ac;
+    task->reply = NULL;
+
+    /* The reply is free'd once this returns: its contents move to a
+     * header of the task's own, leaving an empty one behind. */
+    if (reply != NULL) {
+        if ((task->reply = malloc(sizeof(*reply))) == NULL) {
+            task->fn(ac,reply,task->privdata);
+            free(task);
+            return;
+        }
+        *task->reply = *reply;
+        reply->type = REDIS_REPLY_NIL;
+        reply->str = NULL;
+        reply->len = 0;
+        reply->element = NULL;
+        reply->elements = 0;
+    }
+    task->rt->executor(__redisRuntimeRunTask,task,task->rt->executordata);
+}
+
+int redisRuntimeFormattedCommand(redisRuntime *rt, int conn, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len) {
+    const redisCommandInfo *info;
+    redisCommandKeys keys;
+    redisRuntimeTask *task;
+    const char *key;
+    size_t keylen;
+    redisQueue *q;
+
+    if (!(rt->flags & REDIS_RUNTIME_RUNNING) || conn >= rt->nconns || rt->nconns == 0)
+        return REDIS_ERR;
+    if (conn >= 0)
+        q = rt->conns[conn]->q;
+    else if (redisFormattedCommandKey(cmd,len,&key,&keylen))
+        q = rt->conns[redisFnv1a(REDIS_FNV_BASIS,key,keylen,0) % rt->nconns]->q;
+    else
+        q = rt->conns[__atomic_fetch_add(&rt->next,1,__ATOMIC_RELAXED) % rt->nconns]->q;
+
+    if (rt->executor == NULL || fn == NULL)
+        return redisQueueFormattedCommand(q,fn,privdata,cmd,len);
+
+    /* A task carries a single reply. */
+    info = redisFormattedCommandInfo(cmd,len,&keys);
+    if (info != NULL && (info->flags & (REDIS_CMD_SUBSCRIBE|REDIS_CMD_UNSUBSCRIBE|REDIS_CMD_MONITOR)))
+        return REDIS_ERR;
+
+    if ((task = malloc(sizeof(*task))) == NULL)
+        return REDIS_ERR;
+    task->rt = rt;
+    task->fn = fn;
+    task->privdata = privdata;
+    if (redisQueueFormattedCommand(q,__redisRuntimeOnReply,task,cmd,len) != REDIS_OK) {
+        free(task);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+int redisvRuntimeCommand(redisRuntime *rt, int conn, redisCallbackFn *fn, void *privdata, const char *format, va_list ap) {
+    char *cmd;
+    int len;
+    int status;
+
+    len = redisvFormatCommand(&cmd,format,ap);
+    if (len < 0)
+        return REDIS_ERR;
+    status = redisRuntimeFormattedCommand(rt,conn,fn,privdata,cmd,len);
+    free(cmd);
+    return status;
+}
+
+int redisRuntimeCommand(redisRuntime *rt, int conn, redisCallbackFn *fn, void *privdata, const char *format, ...) {
+    va_list ap;
+    int status;
+    va_start(ap,format);
+    status = redisvRuntimeCommand(rt,conn,fn,privdata,format,ap);
+    va_end(ap);
+    return status;
+}
+
+int redisRuntimeCommandArgv(redisRuntime *rt, int conn, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen) {
+    char *cmd;
+    int len;
+    int status;
+
+    len = redisFormatCommandArgv(&cmd,argc,argv,argvlen);
+    if (len < 0)
+        return REDIS_ERR;
+    status = redisRuntimeFormattedCommand(rt,conn,fn,privdata,cmd,len);
+    free(cmd);
+    return status;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_RUNTIME_H
+#define __HIREDIS_RUNTIME_H
+#include <pthread.h>
+#include "async.h"
+#include "queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Pin loop thread i to CPU i, modulo the CPUs online. Only done on Linux,
+ * elsewhere the flag is ignored. */
+#define REDIS_RUNTIME_PIN_CPUS 0x1
+
+/* Set between redisRuntimeStart() and redisRuntimeFree(). */
+#define REDIS_RUNTIME_RUNNING 0x2
+
+/* Connection argument of the command functions: the connection is picked
+ * by the hash of the first key, so commands on one key keep their order.
+ * Commands without a key are spread over all connections. */
+#define REDIS_RUNTIME_ANY -1
+
+/* Called on the loop thread owning a connection, once it is attached and
+ * before any command is sent, e.g. to set callbacks or enable reconnects.
+ * Returns REDIS_OK or REDIS_ERR, which fails every command on it. */
+typedef int (redisRuntimeSetupCallback)(redisAsyncContext *ac, void *privdata);
+
+/* Runs a callback handed off by a loop thread. An executor calls "run"
+ * with "task" once, on any thread of its own. */
+typedef void (redisRuntimeTaskFn)(void *task);
+typedef void (redisRuntimeExecutor)(redisRuntimeTaskFn *run, void *task, void *privdata);
+
+typedef struct redisRuntimeConn {
+    redisAsyncContext *ac; /* NULL once free'd */
+    redisQueue *q; /* commands from any thread */
+    struct redisRuntimeThread *thread;
+    int events; /* POLLIN and POLLOUT the context waits for */
+    long long timer; /* monotonic usec the context timer fires at, 0 if unset */
+
+    enum redisConnectionType type;
+    char *host; /* or path of the unix socket */
+    int port;
+} redisRuntimeConn;
+
+typedef struct redisRuntimeThread {
+    struct redisRuntime *rt;
+    pthread_t thread;
+    int cpu; /* pinned to, -1 when not */
+    redisRuntimeConn **conns;
+    int nconns;
+} redisRuntimeThread;
+
+/* Event loop threads each owning some async connections, shared nothing:
+ * a connection is only touched by its thread, which polls it along with
+ * the queue other threads submit commands through, see queue.h.
+ *
+ *   redisRuntime *rt = redisRuntimeCreate(4,REDIS_RUNTIME_PIN_CPUS);
+ *   for (i = 0; i < 8; i++)
+ *       redisRuntimeConnect(rt,"127.0.0.1",6379);
+ *   redisRuntimeStart(rt);
+ *   // any thread
+ *   redisRuntimeCommand(rt,REDIS_RUNTIME_ANY,onReply,NULL,"GET %s",key);
+ *
+ * Connections are spread over the threads in turn. Callbacks run on the
+ * thread owning the connection, unless an executor is set: replies are
+ * then handed to it and belong to the task, which frees them after the
+ * callback. The context passed along must not be used from there, and
+ * pub/sub commands are refused, as they have more than one reply. */
+typedef struct redisRuntime {
+    redisRuntimeThread *threads;
+    int nthreads;
+    redisRuntimeConn **conns;
+    int nconns;
+    int flags;
+    int stopfd[2]; /* read end polled by every thread, written to stop */
+    unsigned int next; /* connection of the next keyless command */
+
+    redisRuntimeSetupCallback *setup;
+    void *setupdata;
+    redisRuntimeExecutor *executor;
+    void *executordata;
+} redisRuntime;
+
+redisRuntime *redisRuntimeCreate(int nthreads, int flags);
+
+/* Add a connection, before the runtime is started. Returns its number, to
+ * send commands to, or REDIS_ERR. */
+int redisRuntimeConnect(redisRuntime *rt, const char *ip, int port);
+int redisRuntimeConnectUnix(redisRuntime *rt, const char *path);
+
+/* Set before the runtime is started. */
+void redisRuntimeSetSetupCallback(redisRuntime *rt, redisRuntimeSetupCallback *fn, void *privdata);
+void redisRuntimeSetExecutor(redisRuntime *rt, redisRuntimeExecutor *executor, void *privdata);
+
+/* Connect and start the loop threads. */
+int redisRuntimeStart(redisRuntime *rt);
+
+/* Stop the threads and free the connections, once no thread submits
+ * commands anymore. Pending commands get a NULL reply. */
+void redisRuntimeFree(redisRuntime *rt);
+
+/* Commands from any thread, on connection "conn" or REDIS_RUNTIME_ANY.
+ * REDIS_ERR is returned when the command could not be queued, its callback
+ * is not called then. */
+int redisvRuntimeCommand(redisRuntime *rt, int conn, redisCallbackFn *fn, void *privdata, const char *format, va_list ap);
+int redisRuntimeCommand(redisRuntime *rt, int conn, redisCallbackFn *fn, void *privdata, const char *format, ...);
+int redisRuntimeCommandArgv(redisRuntime *rt, int conn, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen);
+int redisRuntimeFormattedCommand(redisRuntime *rt, int conn, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "scatter.h"
+
+/* How the replies of a split command are put together. */
+#define REDIS_GATHER_ARRAY 1 /* one element per key, like MGET */
+#define REDIS_GATHER_SUM 2 /* the sum of integers, like DEL */
+#define REDIS_GATHER_STATUS 3 /* +OK when every part succeeds, like MSET */
+
+/* Multi-key commands that can be split, their keys as the command table
+ * gives them. */
+static const struct {
+    const char *name;
+    int gather;
+} __redisScatterCommands[] = {
+    { "mget", REDIS_GATHER_ARRAY },
+    { "mset", REDIS_GATHER_STATUS },
+    { "del", REDIS_GATHER_SUM },
+    { "exists", REDIS_GATHER_SUM },
+    { "unlink", REDIS_GATHER_SUM },
+    { NULL, 0 }
+};
+
+struct redisScatterGather;
+
+/* The keys of a command sent to one group. */
+typedef struct redisScatterPart {
+    struct redisScatterGather *g;
+    int first, n; /* range in g->order */
+} redisScatterPart;
+
+/* A split command, waiting for the replies of its parts. */
+typedef struct redisScatterGather {
+    redisCallbackFn *fn;
+    void *privdata;
+    int type; /* REDIS_GATHER_* */
+    int pending; /* parts without a reply yet */
+    int failed; /* a part got no reply */
+    redisReply *reply; /* being put together */
+    redisReply *error; /* first error reply of a part */
+    int *order; /* key positions, grouped */
+    redisScatterPart *parts;
+} redisScatterGather;
+
+void redisKeyHashTag(const char **key, size_t *len) {
+    const char *k = *key;
+    size_t s, e;
+
+    /* Only the part between the first { and the next } is hashed, unless
+     * it is empty. */
+    for (s = 0; s < *len; s++)
+        if (k[s] == '{') break;
+    if (s < *len) {
+        for (e = s+1; e < *len; e++)
+            if (k[e] == '}') break;
+        if (e < *len && e != s+1) {
+            *key = k+s+1;
+            *len = e-s-1;
+        }
+    }
+}
+
+static void __redisScatterFreeGather(redisScatterGather *g) {
+    freeReplyObject(g->reply);
+    freeReplyObject(g->error);
+    free(g->order);
+    free(g->parts);
+    free(g);
+}
+
+/* Put the reply of a part in place, and hand the whole reply over once
+ * every part is in. */
+static void __redisScatterOnPart(redisAsyncContext *ac, void *r, void *privdata) {
+    redisScatterPart *part = privdata;
+    redisScatterGather *g = part->g;
+    redisReply *reply = r, *result;
+    int j;
+
+    if (reply == NULL) {
+        g->failed = 1;
+    } else if (reply->type == REDIS_REPLY_ERROR) {
+        /* The reply is free'd after this callback, keep a copy. */
+        if (g->error == NULL && (g->error = calloc(1,sizeof(redisReply))) != NULL) {
+            g->error->type = REDIS_REPLY_ERROR;
+            if ((g->error->str = malloc(reply->len+1)) != NULL) {
+                memcpy(g->error->str,reply->str,reply->len+1);
+                g->error->len = reply->len;
+            }
+        }
+    } else if (g->type == REDIS_GATHER_ARRAY && reply->type == REDIS_REPLY_ARRAY &&
+               reply->elements == (size_t)part->n) {
+        /* Take the elements over, they aren't free'd with the reply then. */
+        for (j = 0; j < part->n; j++) {
+            g->reply->element[g->order[part->first+j]] = reply->element[j];
+            reply->element[j] = NULL;
+        }
+    } else if (g->type == REDIS_GATHER_SUM && reply->type == REDIS_REPLY_INTEGER) {
+        g->reply->integer += reply->integer;
+    } else if (g->type != REDIS_GATHER_STATUS || reply->type != REDIS_REPLY_STATUS) {
+        g->failed = 1;
+    }
+
+    if (--g->pending > 0)
+        return;
+
+    if (g->failed || (g->error != NULL && g->error->str == NULL))
+        result = NULL;
+    else if (g->error != NULL)
+        result = g->error;
+    else
+        result = g->reply;
+    if (g->fn != NULL)
+        g->fn(ac,result,g->privdata);
+    __redisScatterFreeGather(g);
+}
+
+/* Group of every key, sorted to bring the keys of a group together. */
+typedef struct {
+    unsigned int group;
+    int index;
+} redisScatterKeyRef;
+
+static int __redisScatterCompareKeys(const void *a, const void *b) {
+    const redisScatterKeyRef *x = a, *y = b;
+    if (x->group != y->group)
+        return x->group < y->group ? -1 : 1;
+    return x->index - y->index;
+}
+
+int redisScatterCommand(void *ctx, redisScatterRouteFn *route, redisScatterSendFn *send,
+                        redisCallbackFn *fn, void *privdata, const char *cmd, size_t len, int *status)
+{
+    const char *p, *end = cmd+len, **argv = NULL, **subv = NULL;
+    size_t argc, *argvlen = NULL, *sublen = NULL;
+    const redisCommandInfo *info;
+    redisCommandKeys ks;
+    redisScatterKeyRef *keys = NULL;
+    redisScatterGather *g = NULL;
+    int i, j, k, c, nkeys, nparts, step, type = 0, split = 0, sent;
+    sds sub;
+
+    /* Every key followed by its values, up to the last argument. */
+    if ((info = redisFormattedCommandInfo(cmd,len,&ks)) == NULL || ks.argc < 3 ||
+        ks.first != 1 || (ks.argc-1) % ks.step != 0 || ks.last < ks.argc-ks.step)
+        return 0;
+    for (i = 0; __redisScatterCommands[i].name != NULL; i++) {
+        if (strcasecmp(__redisScatterCommands[i].name,info->name) == 0) {
+            type = __redisScatterCommands[i].gather;
+            break;
+        }
+    }
+    if (type == 0)
+        return 0;
+    step = ks.step;
+
+    p = redisFormattedCommandArgc(cmd,len,&argc);
+    argv = malloc(sizeof(char*)*argc);
+    argvlen = malloc(sizeof(size_t)*argc);
+    if (argv == NULL || argvlen == NULL)
+        goto done;
+    for (i = 0; i < (int)argc; i++)
+        if ((p = redisFormattedCommandNextArgument(p,end,&argv[i],&argvlen[i])) == NULL)
+            goto done;
+
+    nkeys = (int)(argc-1)/step;
+    keys = malloc(sizeof(*keys)*nkeys);
+    if (keys == NULL)
+        goto done;
+    for (i = 0; i < nkeys; i++) {
+        keys[i].group = route(ctx,argv[1+i*step],argvlen[1+i*step]);
+        keys[i].index = i;
+        if (keys[i].group != keys[0].group)
+            split = 1;
+    }
+    if (!split)
+        goto done;
+
+    /* From here on the command is handled, or fails. */
+    *status = REDIS_ERR;
+    qsort(keys,nkeys,sizeof(*keys),__redisScatterCompareKeys);
+    for (i = 0, nparts = 0; i < nkeys; i++)
+        if (i == 0 || keys[i].group != keys[i-1].group)
+            nparts++;
+
+    g = calloc(1,sizeof(*g));
+    subv = malloc(sizeof(char*)*argc);
+    sublen = malloc(sizeof(size_t)*argc);
+    if (g == NULL || subv == NULL || sublen == NULL)
+        goto done;
+    g->fn = fn;
+    g->privdata = privdata;
+    g->type = type;
+    g->order = malloc(sizeof(int)*nkeys);
+    g->parts = calloc(nparts,sizeof(redisScatterPart));
+    g->reply = calloc(1,sizeof(redisReply));
+    if (g->order == NULL || g->parts == NULL || g->reply == NULL)
+        goto done;
+    if (type == REDIS_GATHER_ARRAY) {
+        g->reply->type = REDIS_REPLY_ARRAY;
+        g->reply->elements = nkeys;
+        if ((g->reply->element = calloc(nkeys,sizeof(redisReply*))) == NULL)
+            goto done;
+    } else if (type == REDIS_GATHER_SUM) {
+        g->reply->type = REDIS_REPLY_INTEGER;
+    } else {
+        g->reply->type = REDIS_REPLY_STATUS;
+        if ((g->reply->str = strdup("OK")) == NULL)
+            goto done;
+        g->reply->len = 2;
+    }
+    for (i = 0; i < nkeys; i++)
+        g->order[i] = keys[i].index;
+
+    /* One command per group, the keys in the order they were given. */
+    g->pending = nparts;
+    subv[0] = argv[0];
+    sublen[0] = argvlen[0];
+    for (i = 0, k = 0; i < nkeys; i = j, k++) {
+        for (j = i, c = 1; j < nkeys && keys[j].group == keys[i].group; j++) {
+            memcpy(subv+c,argv+1+keys[j].index*step,sizeof(char*)*step);
+            memcpy(sublen+c,argvlen+1+keys[j].index*step,sizeof(size_t)*step);
+            c += step;
+        }
+        g->parts[k].g = g;
+        g->parts[k].first = i;
+        g->parts[k].n = j-i;
+        if (redisFormatSdsCommandArgv(&sub,c,subv,sublen) < 0) {
+            sub = NULL;
+            sent = REDIS_ERR;
+        } else {
+            sent = send(ctx,__redisScatterOnPart,&g->parts[k],sub,sdslen(sub));
+        }
+        sdsfree(sub);
+        if (sent == REDIS_OK) {
+            *status = REDIS_OK;
+        } else {
+            g->failed = 1;
+            g->pending--;
+        }
+    }
+    if (*status == REDIS_OK)
+        g = NULL; /* free'd with the last reply */
+
+done:
+    if (g != NULL)
+        __redisScatterFreeGather(g);
+    free(argv);
+    free(argvlen);
+    free(subv);
+    free(sublen);
+    free(keys);
+    return split;
+}
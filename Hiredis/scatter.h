@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_SCATTER_H
+#define __HIREDIS_SCATTER_H
+#include "async.h"
+#include "command.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Helpers for front ends spreading commands over several connections, by
+ * the key of every command. */
+
+/* Narrow a key to its {hash tag}, the part of the key that is hashed. Keys
+ * with the same tag are kept together. */
+void redisKeyHashTag(const char **key, size_t *len);
+
+/* The group a key belongs to: a slot, a server... */
+typedef unsigned int (redisScatterRouteFn)(void *ctx, const char *key, size_t len);
+
+/* Send a command to the group of its key, like redisAsyncFormattedCommand(). */
+typedef int (redisScatterSendFn)(void *ctx, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len);
+
+/* Split MGET, MSET, DEL, EXISTS and UNLINK with keys in several groups into
+ * one command per group, all sent at once. The callback gets one reply put
+ * together in the order of the keys: the elements of MGET, the sum of DEL,
+ * EXISTS and UNLINK, +OK for MSET. The first error reply of a part wins, a
+ * part without a reply gives a NULL reply. Returns 0 when the command
+ * doesn't need to be split, 1 otherwise with the outcome in "status". */
+int redisScatterCommand(void *ctx, redisScatterRouteFn *route, redisScatterSendFn *send,
+                        redisCallbackFn *fn, void *privdata, const char *cmd, size_t len, int *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,470 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shard.h"
+#include "scatter.h"
+#include "net.h"
+
+/* Set while redisShardDisconnect() walks the servers, so the context isn't
+ * free'd under its feet. */
+#define REDIS_SHARD_IN_DISCONNECT 0x4
+
+/* Spread the bits of a hash over the whole ring (MurmurHash3 finalizer). */
+static unsigned int __redisShardMix(unsigned int h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+static int __redisShardComparePoints(const void *a, const void *b) {
+    const redisShardPoint *x = a, *y = b;
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+
+    /* Same order whatever the order members were added in. */
+    return strcmp(x->node->name,y->node->name);
+}
+
+/* Place the points of every member but "exclude" on a new ring, and work
+ * out the share of the hash space each member owns. */
+static int __redisShardRingBuild(redisShardRing *ring, redisShardNode *exclude) {
+    redisShardPoint *points = NULL;
+    redisShardNode *node;
+    unsigned int npoints = 0, prev, h;
+    char suffix[16];
+    int i, j, n;
+
+    for (i = 0; i < ring->nnodes; i++)
+        if (ring->nodes[i] != exclude)
+            npoints += ring->nodes[i]->weight*REDIS_SHARD_POINTS;
+    if (npoints > 0 && (points = malloc(sizeof(*points)*npoints)) == NULL)
+        return REDIS_ERR;
+
+    for (i = 0, npoints = 0; i < ring->nnodes; i++) {
+        node = ring->nodes[i];
+        node->share = 0;
+        if (node == exclude)
+            continue;
+        h = redisFnv1a(REDIS_FNV_BASIS,node->name,strlen(node->name),0);
+        for (j = 0; j < node->weight*REDIS_SHARD_POINTS; j++) {
+            n = snprintf(suffix,sizeof(suffix),"-%d",j);
+            points[npoints].hash = __redisShardMix(redisFnv1a(h,suffix,n,0));
+            points[npoints].node = node;
+            npoints++;
+        }
+    }
+    if (npoints > 0)
+        qsort(points,npoints,sizeof(*points),__redisShardComparePoints);
+
+    /* A point owns the hashes since the one before it. */
+    for (i = 0; i < (int)npoints; i++) {
+        prev = points[i > 0 ? i-1 : (int)npoints-1].hash;
+        if (npoints == 1)
+            points[i].node->share = 1;
+        else
+            points[i].node->share += (double)(points[i].hash-prev)/4294967296.0;
+    }
+
+    free(ring->points);
+    ring->points = points;
+    ring->npoints = npoints;
+    return REDIS_OK;
+}
+
+redisShardRing *redisShardRingCreate(void) {
+    return calloc(1,sizeof(redisShardRing));
+}
+
+redisShardNode *redisShardRingFind(const redisShardRing *ring, const char *name) {
+    int i;
+    for (i = 0; i < ring->nnodes; i++)
+        if (strcmp(ring->nodes[i]->name,name) == 0)
+            return ring->nodes[i];
+    return NULL;
+}
+
+redisShardNode *redisShardRingAdd(redisShardRing *ring, const char *name, int weight, void *data) {
+    redisShardNode *node, **nodes;
+
+    if (weight < 1 || redisShardRingFind(ring,name) != NULL)
+        return NULL;
+
+    nodes = realloc(ring->nodes,sizeof(*nodes)*(ring->nnodes+1));
+    if (nodes == NULL)
+        return NULL;
+    ring->nodes = nodes;
+
+    node = calloc(1,sizeof(*node));
+    if (node == NULL)
+        return NULL;
+    if ((node->name = strdup(name)) == NULL) {
+        free(node);
+        return NULL;
+    }
+    node->weight = weight;
+    node->data = data;
+    node->index = ring->nnodes;
+    ring->nodes[ring->nnodes++] = node;
+
+    if (__redisShardRingBuild(ring,NULL) != REDIS_OK) {
+        ring->nnodes--;
+        free(node->name);
+        free(node);
+        return NULL;
+    }
+    return node;
+}
+
+int redisShardRingRemove(redisShardRing *ring, const char *name) {
+    redisShardNode *node = redisShardRingFind(ring,name);
+    int i;
+
+    if (node == NULL || __redisShardRingBuild(ring,node) != REDIS_OK)
+        return REDIS_ERR;
+
+    for (i = node->index+1; i < ring->nnodes; i++) {
+        ring->nodes[i-1] = ring->nodes[i];
+        ring->nodes[i-1]->index = i-1;
+    }
+    ring->nnodes--;
+    free(node->name);
+    free(node);
+    return REDIS_OK;
+}
+
+redisShardNode *redisShardRingLookup(const redisShardRing *ring, const char *key, size_t len) {
+    unsigned int h, lo = 0, hi = ring->npoints, mid;
+
+    if (ring->npoints == 0)
+        return NULL;
+
+    redisKeyHashTag(&key,&len);
+    h = __redisShardMix(redisFnv1a(REDIS_FNV_BASIS,key,len,0));
+
+    /* First point at or after the hash, wrapping around. */
+    while (lo < hi) {
+        mid = lo+(hi-lo)/2;
+        if (ring->points[mid].hash < h)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return ring->points[lo == ring->npoints ? 0 : lo].node;
+}
+
+void redisShardRingFree(redisShardRing *ring) {
+    int i;
+
+    if (ring == NULL)
+        return;
+    for (i = 0; i < ring->nnodes; i++) {
+        free(ring->nodes[i]->name);
+        free(ring->nodes[i]);
+    }
+    free(ring->nodes);
+    free(ring->points);
+    free(ring);
+}
+
+static void __redisShardFreeServer(redisShardServer *server) {
+    free(server->host);
+    free(server);
+}
+
+static void __redisShardFreeStorage(redisShardContext *sc) {
+    int i;
+
+    for (i = 0; i < sc->ring->nnodes; i++)
+        __redisShardFreeServer(sc->ring->nodes[i]->data);
+    redisShardRingFree(sc->ring);
+    free(sc);
+}
+
+/* Free the context once redisShardDisconnect() closed every connection. */
+static void __redisShardCheckGone(redisShardContext *sc) {
+    redisShardServer *server;
+    int i;
+
+    if (!(sc->flags & REDIS_SHARD_DISCONNECTING) || (sc->flags & REDIS_SHARD_IN_DISCONNECT))
+        return;
+    for (i = 0; i < sc->ring->nnodes; i++) {
+        server = sc->ring->nodes[i]->data;
+        if (server->ac != NULL)
+            return;
+    }
+    __redisShardFreeStorage(sc);
+}
+
+static void __redisShardOnConnect(const redisAsyncContext *ac, int status) {
+    redisShardServer *server = ac->data;
+
+    if (status == REDIS_OK || server == NULL)
+        return;
+
+    /* The context is free'd after this callback, try again later. */
+    server->ac = NULL;
+    __redisShardCheckGone(server->sc);
+}
+
+static void __redisShardOnDisconnect(const redisAsyncContext *ac, int status) {
+    redisShardServer *server = ac->data;
+
+    ((void)status);
+    if (server == NULL)
+        return;
+    server->ac = NULL;
+    __redisShardCheckGone(server->sc);
+}
+
+static void __redisShardConnect(redisShardServer *server) {
+    redisShardContext *sc = server->sc;
+    redisAsyncContext *ac;
+
+    server->retry = redisNowUsec()+REDIS_SHARD_RETRY_INTERVAL*1000LL;
+    ac = redisAsyncConnect(server->host,server->port);
+    if (ac == NULL)
+        return;
+
+    if (ac->err || sc->attach(ac,sc->attachdata) != REDIS_OK) {
+        redisAsyncFree(ac);
+        return;
+    }
+
+    ac->data = server;
+    redisAsyncSetConnectCallback(ac,__redisShardOnConnect);
+    redisAsyncSetDisconnectCallback(ac,__redisShardOnDisconnect);
+    server->ac = ac;
+}
+
+/* Close a connection once its pending replies are read. Returns 1 when it
+ * is gone already: a context that never connected is free'd without
+ * telling. */
+static int __redisShardClose(redisAsyncContext *ac) {
+    if (!(ac->c.flags & REDIS_CONNECTED) && ac->replies.len == 0) {
+        ac->data = NULL;
+        redisAsyncFree(ac);
+        return 1;
+    }
+    redisAsyncDisconnect(ac);
+    return 0;
+}
+
+redisShardContext *redisShardCreate(redisShardAttachCallback *attach, void *privdata) {
+    redisShardContext *sc;
+
+    if (attach == NULL)
+        return NULL;
+
+    sc = calloc(1,sizeof(*sc));
+    if (sc == NULL)
+        return NULL;
+    if ((sc->ring = redisShardRingCreate()) == NULL) {
+        free(sc);
+        return NULL;
+    }
+    sc->attach = attach;
+    sc->attachdata = privdata;
+    return sc;
+}
+
+int redisShardAddServer(redisShardContext *sc, const char *ip, int port, int weight) {
+    redisShardServer *server;
+    char name[REDIS_SHARD_NAME_LEN];
+
+    snprintf(name,sizeof(name),"%s:%d",ip,port);
+    server = calloc(1,sizeof(*server));
+    if (server == NULL)
+        return REDIS_ERR;
+    server->host = strdup(ip);
+    server->port = port;
+    server->sc = sc;
+    if (server->host == NULL ||
+        (server->node = redisShardRingAdd(sc->ring,name,weight,server)) == NULL)
+    {
+        __redisShardFreeServer(server);
+        return REDIS_ERR;
+    }
+
+    /* A server failing now is retried when commands come in. */
+    __redisShardConnect(server);
+    return REDIS_OK;
+}
+
+int redisShardRemoveServer(redisShardContext *sc, const char *ip, int port) {
+    redisShardServer *server;
+    redisShardNode *node;
+    char name[REDIS_SHARD_NAME_LEN];
+
+    snprintf(name,sizeof(name),"%s:%d",ip,port);
+    if ((node = redisShardRingFind(sc->ring,name)) == NULL)
+        return REDIS_ERR;
+    server = node->data;
+    if (redisShardRingRemove(sc->ring,name) != REDIS_OK)
+        return REDIS_ERR;
+
+    if (server->ac != NULL) {
+        server->ac->data = NULL;
+        __redisShardClose(server->ac);
+    }
+    __redisShardFreeServer(server);
+    return REDIS_OK;
+}
+
+redisShardServer *redisShardKeyServer(redisShardContext *sc, const char *key, size_t len) {
+    redisShardNode *node = redisShardRingLookup(sc->ring,key,len);
+    return node != NULL ? node->data : NULL;
+}
+
+void redisShardDisconnect(redisShardContext *sc) {
+    redisShardServer *server;
+    int i;
+
+    sc->flags |= REDIS_SHARD_DISCONNECTING|REDIS_SHARD_IN_DISCONNECT;
+    for (i = 0; i < sc->ring->nnodes; i++) {
+        server = sc->ring->nodes[i]->data;
+        if (server->ac != NULL && __redisShardClose(server->ac))
+            server->ac = NULL;
+    }
+    sc->flags &= ~REDIS_SHARD_IN_DISCONNECT;
+    __redisShardCheckGone(sc);
+}
+
+void redisShardFree(redisShardContext *sc) {
+    redisShardServer *server;
+    redisAsyncContext *ac;
+    int i;
+
+    sc->flags |= REDIS_SHARD_FREEING;
+    for (i = 0; i < sc->ring->nnodes; i++) {
+        server = sc->ring->nodes[i]->data;
+        if ((ac = server->ac) == NULL)
+            continue;
+        server->ac = NULL;
+        ac->data = NULL;
+        redisAsyncFree(ac);
+    }
+    __redisShardFreeStorage(sc);
+}
+
+/* Send a command to a server, counting it and its keys once it's on its way. */
+static int __redisShardSendTo(redisShardServer *server, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len) {
+    redisCommandKeys keys;
+
+    if (server->ac == NULL && server->retry <= redisNowUsec())
+        __redisShardConnect(server);
+    if (server->ac == NULL || (server->ac->c.flags & (REDIS_DISCONNECTING|REDIS_FREEING)))
+        return REDIS_ERR;
+    if (redisAsyncFormattedCommand(server->ac,fn,privdata,cmd,len) != REDIS_OK)
+        return REDIS_ERR;
+    server->commands++;
+    redisFormattedCommandInfo(cmd,len,&keys);
+    if (keys.first != 0)
+        server->keys += (keys.last-keys.first)/keys.step+1;
+    return REDIS_OK;
+}
+
+/* Group the keys of a command to split by server. */
+static unsigned int __redisShardRoute(void *ctx, const char *key, size_t len) {
+    redisShardContext *sc = ctx;
+    return redisShardRingLookup(sc->ring,key,len)->index;
+}
+
+/* Send a part of a split command. */
+static int __redisShardSendPart(void *ctx, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len) {
+    redisShardContext *sc = ctx;
+    const char *key;
+    size_t keylen;
+
+    if (!redisFormattedCommandKey(cmd,len,&key,&keylen))
+        return REDIS_ERR;
+    return __redisShardSendTo(redisShardKeyServer(sc,key,keylen),fn,privdata,cmd,len);
+}
+
+int redisShardFormattedCommand(redisShardContext *sc, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len) {
+    redisShardServer *server;
+    const char *key;
+    size_t keylen;
+    int status;
+
+    if ((sc->flags & (REDIS_SHARD_DISCONNECTING|REDIS_SHARD_FREEING)) || sc->ring->nnodes == 0)
+        return REDIS_ERR;
+    if (redisScatterCommand(sc,__redisShardRoute,__redisShardSendPart,fn,privdata,cmd,len,&status))
+        return status;
+
+    if (redisFormattedCommandKey(cmd,len,&key,&keylen))
+        server = redisShardKeyServer(sc,key,keylen);
+    else
+        server = sc->ring->nodes[0]->data;
+    return __redisShardSendTo(server,fn,privdata,cmd,len);
+}
+
+int redisvShardCommand(redisShardContext *sc, redisCallbackFn *fn, void *privdata, const char *format, va_list ap) {
+    char *cmd;
+    int len;
+    int status;
+    len = redisvFormatCommand(&cmd,format,ap);
+
+    /* We don't want to pass -1 or -2 to future functions as a length. */
+    if (len < 0)
+        return REDIS_ERR;
+
+    status = redisShardFormattedCommand(sc,fn,privdata,cmd,len);
+    free(cmd);
+    return status;
+}
+
+int redisShardCommand(redisShardContext *sc, redisCallbackFn *fn, void *privdata, const char *format, ...) {
+    va_list ap;
+    int status;
+    va_start(ap,format);
+    status = redisvShardCommand(sc,fn,privdata,format,ap);
+    va_end(ap);
+    return status;
+}
+
+int redisShardCommandArgv(redisShardContext *sc, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen) {
+    sds cmd;
+    int len;
+    int status;
+    len = redisFormatSdsCommandArgv(&cmd,argc,argv,argvlen);
+    if (len < 0)
+        return REDIS_ERR;
+    status = redisShardFormattedCommand(sc,fn,privdata,cmd,len);
+    sdsfree(cmd);
+    return status;
+}
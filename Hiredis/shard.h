@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HIREDIS_SHARD_H
+#define __HIREDIS_SHARD_H
+#include "async.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Points on the hash ring per unit of weight. */
+#define REDIS_SHARD_POINTS 160
+
+/* Longest "host:port" name of a server. */
+#define REDIS_SHARD_NAME_LEN 288
+
+/* Msec to wait before connecting to a server again after a failure. */
+#define REDIS_SHARD_RETRY_INTERVAL 1000
+
+/* Flags set while the context goes away. */
+#define REDIS_SHARD_DISCONNECTING 0x1
+#define REDIS_SHARD_FREEING 0x2
+
+/* A member of a hash ring. */
+typedef struct redisShardNode {
+    char *name;
+    int weight;
+    int index; /* position in ring->nodes */
+    double share; /* fraction of the hash space owned */
+    void *data; /* what the member stands for, e.g. a redisContext */
+} redisShardNode;
+
+typedef struct redisShardPoint {
+    unsigned int hash;
+    redisShardNode *node;
+} redisShardPoint;
+
+/* Consistent hashing, ketama style: every member owns REDIS_SHARD_POINTS
+ * points per unit of weight, placed on the ring by hashing its name. A key
+ * belongs to the member of the first point at or after its hash, so adding
+ * or removing a member only moves the keys of the points it owns. Keys are
+ * hashed by their {hash tag} when they have one. */
+typedef struct redisShardRing {
+    redisShardNode **nodes;
+    int nnodes;
+    redisShardPoint *points;
+    unsigned int npoints;
+} redisShardRing;
+
+/* The ring can be used on its own, e.g. over blocking contexts kept as the
+ * data of its members. Names must be unique. */
+redisShardRing *redisShardRingCreate(void);
+redisShardNode *redisShardRingAdd(redisShardRing *ring, const char *name, int weight, void *data);
+int redisShardRingRemove(redisShardRing *ring, const char *name);
+redisShardNode *redisShardRingFind(const redisShardRing *ring, const char *name);
+redisShardNode *redisShardRingLookup(const redisShardRing *ring, const char *key, size_t len);
+void redisShardRingFree(redisShardRing *ring);
+
+/* Hook attaching a new connection to the event library, e.g. a wrapper
+ * around redisMacOSAttach(). Returns REDIS_OK or REDIS_ERR. */
+typedef int (redisShardAttachCallback)(redisAsyncContext *ac, void *privdata);
+
+struct redisShardContext; /* forward declaration */
+
+/* A server of the async front end, the data of its ring member. */
+typedef struct redisShardServer {
+    char *host;
+    int port;
+    redisAsyncContext *ac; /* NULL while down */
+    long long retry; /* monotonic usec a down server is retried at */
+    unsigned long long commands; /* commands sent */
+    unsigned long long keys; /* keys of the commands sent */
+    redisShardNode *node;
+    struct redisShardContext *sc;
+} redisShardServer;
+
+/* Async front end over independent servers. Commands go to the server
+ * owning their key on the ring, commands without a key to the first server.
+ * MGET, MSET, DEL, EXISTS and UNLINK with keys on several servers are split
+ * per server and sent at once, see redisScatterCommand(). The load of a
+ * server is in its stats and in the replies pending on its context. */
+typedef struct redisShardContext {
+    redisShardRing *ring;
+    int flags;
+
+    redisShardAttachCallback *attach;
+    void *attachdata;
+} redisShardContext;
+
+redisShardContext *redisShardCreate(redisShardAttachCallback *attach, void *privdata);
+
+/* Add a server to the ring and connect to it. A removed server is closed
+ * once its pending replies are read. */
+int redisShardAddServer(redisShardContext *sc, const char *ip, int port, int weight);
+int redisShardRemoveServer(redisShardContext *sc, const char *ip, int port);
+
+/* The server owning a key. */
+redisShardServer *redisShardKeyServer(redisShardContext *sc, const char *key, size_t len);
+
+/* Close the connections once pending replies are read, the context is
+ * free'd with the last one. */
+void redisShardDisconnect(redisShardContext *sc);
+void redisShardFree(redisShardContext *sc);
+
+/* Commands, like their redisAsyncCommand() counterparts. REDIS_ERR is
+ * returned when no server could take the command. */
+int redisvShardCommand(redisShardContext *sc, redisCallbackFn *fn, void *privdata, const char *format, va_list ap);
+int redisShardCommand(redisShardContext *sc, redisCallbackFn *fn, void *privdata, const char *format, ...);
+int redisShardCommandArgv(redisShardContext *sc, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen);
+int redisShardFormattedCommand(redisShardContext *sc, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,6 +17,15 @@ extern NSString * const CocoaRedisMessageNotification;
 @property (readonly) int port;
 @property (readonly) BOOL isConnected;
 
+/** Time allowed for the connection to be established, 0 for no limit. */
+@property (nonatomic) NSTimeInterval connectTimeout;
+/** Time allowed for every command issued afterwards to get a reply, 0 for no limit.
+    Commands that timed out are rejected; if they were already sent the connection is dropped. */
+@property (nonatomic) NSTimeInterval commandTimeout;
+/** Reconnect with backoff when the connection is lost, set before connecting.
+    Commands that were not sent yet are sent once reconnected, the others are rejected. */
+@property (nonatomic) BOOL autoReconnect;
+
 - (instancetype) init;
 - (CocoaPromise*) connectWithHost: (NSString*)serverHost;
 - (CocoaPromise*) connectWithHost: (NSString*)serverHost port: (int)serverPort;
@@ -15,6 +15,10 @@ NSString * const CocoaRedisMonitorNotification = @"CocoaRedisMonitorNotification
 NSString * const CocoaRedisMessageNotification = @"CocoaRedisMessageNotification";
 
 static void connectCallback(redisAsyncContext *ctx, int status) {
+    /* Only the first attempt settles the connect promise: by the time the
+       context reconnects, ctx->data belongs to a subscribe or a close. */
+    ctx->onConnect = NULL;
+
     CocoaPromise* promise = CFBridgingRelease(ctx->data);
     ctx->data = NULL;
 
@@ -507,8 +511,16 @@ static void CollectZSetKeys(CocoaRedis* redis, id key, CocoaPromise* cursorPromi
 
 @interface CocoaRedis ()
 @property redisAsyncContext* ctx;
+@property (readonly) BOOL isUsable;
 @end
 
+static struct timeval TimevalFromInterval(NSTimeInterval interval) {
+    struct timeval tv;
+    tv.tv_sec = (time_t) interval;
+    tv.tv_usec = (suseconds_t) ((interval - tv.tv_sec) * 1000000);
+    return tv;
+}
+
 @implementation CocoaRedis
 
 - (instancetype)init {
@@ -519,6 +531,11 @@ static void CollectZSetKeys(CocoaRedis* redis, id key, CocoaPromise* cursorPromi
     return self;
 }
 
+- (void)setCommandTimeout:(NSTimeInterval)commandTimeout {
+    _commandTimeout = commandTimeout;
+    if( self.ctx ) redisAsyncSetTimeout(self.ctx, TimevalFromInterval(commandTimeout));
+}
+
 - (CocoaPromise *)connectWithHost:(NSString *)serverHost {
     int serverPort = 6379;
 
@@ -531,11 +548,7 @@ static void CollectZSetKeys(CocoaRedis* redis, id key, CocoaPromise* cursorPromi
     return [self connectWithHost: serverHost port: serverPort];
 }
 
-- (CocoaPromise *)connectWithHost:(NSString *)serverHost port:(int)serverPort {
-    NSAssert(!self.isConnected, @"Already connected");
-    
-    CocoaPromise* result = [CocoaPromise new];
-    
+- (void) attachToHost:(NSString *)serverHost port:(int)serverPort result:(CocoaPromise*)result {
     self.ctx = redisAsyncConnect(serverHost.UTF8String, serverPort);
     
     if( self.ctx == NULL || self.ctx->err ) {
@@ -550,13 +563,56 @@ static void CollectZSetKeys(CocoaRedis* redis, id key, CocoaPromise* cursorPromi
         redisAsyncSetDisconnectCallback(self.ctx, disconnectCallback);
         
         redisMacOSAttach(self.ctx, CFRunLoopGetCurrent());
+
+        if( self.connectTimeout > 0 ) redisAsyncSetConnectTimeout(self.ctx, TimevalFromInterval(self.connectTimeout));
+        if( self.commandTimeout > 0 ) redisAsyncSetTimeout(self.ctx, TimevalFromInterval(self.commandTimeout));
+        if( self.autoReconnect ) redisAsyncEnableReconnect(self.ctx, NULL);
+    }
+}
+
+static void resolveCallback(int status, const char *errstr, void *privdata) {
+    void (^completion)(NSError*) = CFBridgingRelease(privdata);
+    NSError* err = nil;
+
+    if( status != REDIS_OK ) {
+        err = [NSError errorWithDomain: [NSString stringWithUTF8String: errstr]
+                                  code: REDIS_ERR_OTHER
+                              userInfo: nil];
+    }
+    completion(err);
+}
+
+- (CocoaPromise *)connectWithHost:(NSString *)serverHost port:(int)serverPort {
+    NSAssert(!self.isConnected, @"Already connected");
+    
+    CocoaPromise* result = [CocoaPromise new];
+    CFRunLoopRef runLoop = CFRunLoopGetCurrent();
+
+    /* Resolve the host on a helper thread; the connect then picks the
+       addresses from the resolver cache instead of blocking the run loop.
+       A host that doesn't resolve fails the connect right away. */
+    void (^completion)(NSError*) = ^(NSError* err) {
+        CFRunLoopPerformBlock(runLoop, kCFRunLoopDefaultMode, ^{
+            if( err != nil ) {
+                [result reject: err];
+            } else {
+                [self attachToHost: serverHost port: serverPort result: result];
+            }
+        });
+        CFRunLoopWakeUp(runLoop);
+    };
+
+    void* privdata = (void*) CFBridgingRetain(completion);
+    if( redisResolveAsync(serverHost.UTF8String, serverPort, resolveCallback, privdata) != REDIS_OK ) {
+        CFBridgingRelease(privdata);
+        [self attachToHost: serverHost port: serverPort result: result];
     }
     
     return result;
 }
 
 - (CocoaPromise*) close {
-    NSAssert(self.isConnected, @"Not connected");
+    NSAssert(self.isUsable, @"Not connected");
     CocoaPromise* result = [CocoaPromise new];
 
     redisAsyncContext* ac = self.ctx;
@@ -583,6 +639,11 @@ static void CollectZSetKeys(CocoaRedis* redis, id key, CocoaPromise* cursorPromi
     return self.ctx != NULL && self.ctx->c.flags & REDIS_CONNECTED;
 }
 
+/* While reconnecting, hiredis buffers the commands until the connection is back. */
+- (BOOL) isUsable {
+    return self.ctx != NULL && self.ctx->c.flags & (REDIS_CONNECTED | REDIS_RECONNECTING);
+}
+
 typedef struct {
     char const** argv;
     size_t* argvlen;
@@ -605,7 +666,7 @@ static CocoaPromise* reject(CocoaPromise* result, NSString* reason, argvbuf* buf
 - (CocoaPromise *)command:(NSArray *)arguments {
     CocoaPromise* result = [CocoaPromise new];
     
-    if( !self.isConnected ) return reject(result, @"Not connected", NULL);
+    if( !self.isUsable ) return reject(result, @"Not connected", NULL);
         
     argvbuf buf = {NULL, NULL};
     const NSUInteger count = arguments.count;
@@ -632,15 +693,26 @@ static CocoaPromise* reject(CocoaPromise* result, NSString* reason, argvbuf* buf
         }
     }
     
+    void* privdata = (void*) CFBridgingRetain(result);
     int rc = redisAsyncCommandArgv(self.ctx,
                                    commandCallback,
-                                   (void*) CFBridgingRetain(result),
+                                   privdata,
                                    (int) count, buf.argv, buf.argvlen);
     
     if( rc != REDIS_OK ) {
-        NSError* err = [NSError errorWithDomain: [NSString stringWithUTF8String: self.ctx->errstr]
-                                           code: self.ctx->err
-                                       userInfo: nil];
+        /* The callback never runs for a command that wasn't accepted. */
+        CFBridgingRelease(privdata);
+
+        /* Without an error on the context, the command was refused: too
+           many callbacks pending, or too much buffered while reconnecting. */
+        NSError* err;
+        if( self.ctx->err ) {
+            err = [NSError errorWithDomain: [NSString stringWithUTF8String: self.ctx->errstr]
+                                      code: self.ctx->err
+                                  userInfo: nil];
+        } else {
+            err = [NSError errorWithDomain: @"Too many commands pending" code: REDIS_ERR_OTHER userInfo: nil];
+        }
         [result reject: err];
     }
     
@@ -13,6 +13,7 @@
 
 #import "CocoaRedis.h"
 #import "RedisTestCase.h"
+#include "hiredis.h"
 
 @interface BasicTests : XCTestCase
 @end
@@ -58,4 +59,25 @@
     [self waitForExpectationsWithTimeout:2 handler:nil];
 }
 
+- (void) test_CommandTimeout {
+    XCTestExpectation* test = [self expectationWithDescription: @"Command timeout test"];
+    
+    CocoaRedis* redis = [CocoaRedis new];
+    redis.commandTimeout = 0.2;
+    
+    /* Blocks this connection only, on a key that never gets a value. */
+    [[[redis connectWithHost: REDIS_ADDRESS] then:^id(id value) {
+        return [redis command: @[@"BLPOP", @"test_CommandTimeout:nokey", @"1"]];
+    }] onFulfill:^id(id value) {
+        XCTAssert(NO, @"Should not get here");
+        return nil;
+    } onReject:^id(NSError *err) {
+        XCTAssertEqual(err.code, REDIS_ERR_TIMEOUT);
+        [test fulfill];
+        return nil;
+    }];
+    
+    [self waitForExpectationsWithTimeout:2 handler:nil];
+}
+
 @end
@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Cluster redirection driver: runs redisCluster against a stand-in cluster
+ * of three nodes on loopback ports, started in-process, and checks how
+ * redirections are followed:
+ *
+ *   - keys go to the node serving their slot, {hash tags} included
+ *   - a MOVED slot is followed and the slot map loaded again, so the next
+ *     command goes to the new node directly
+ *   - an ASK slot is followed with ASKING, for that command only
+ *   - a slot the nodes keep bouncing between them gives up after
+ *     REDIS_CLUSTER_MAX_REDIRECTS redirections
+ *
+ *   cc -O2 -pthread -I../Hiredis -o cluster_redirect cluster_redirect.c \
+ *      ../Hiredis/cluster.c ../Hiredis/scatter.c ../Hiredis/async.c \
+ *      ../Hiredis/hiredis.c ../Hiredis/net.c ../Hiredis/read.c \
+ *      ../Hiredis/sds.c ../Hiredis/command.c
+ *   ./cluster_redirect
+ *
+ * It prints a line per check and exits with 1 when one of them failed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "cluster.h"
+#include "net.h"
+
+#define NODES 3
+
+/* Stand-in cluster: which node serves each slot, slots being migrated to
+ * another node (ASK) and slots no node admits to serving (MOVED to the
+ * next node, forever). Guarded by "lock". */
+static struct {
+    pthread_mutex_t lock;
+    int port[NODES];
+    unsigned char owner[REDIS_CLUSTER_SLOTS];
+    signed char migrating[REDIS_CLUSTER_SLOTS];
+    unsigned char bounce[REDIS_CLUSTER_SLOTS];
+    long moved, ask, slots;
+} standin;
+
+typedef struct standinClient {
+    int fd, node;
+} standinClient;
+
+static int reply(int fd, const char *fmt, ...) {
+    char buf[65536];
+    va_list ap;
+    int len;
+
+    va_start(ap,fmt);
+    len = vsnprintf(buf,sizeof(buf),fmt,ap);
+    va_end(ap);
+    return write(fd,buf,len) == len ? 0 : -1;
+}
+
+/* CLUSTER SLOTS, one range per run of slots served by the same node. */
+static int replySlots(int fd) {
+    char buf[65536];
+    int ranges = 0, len = 0, start, s;
+
+    for (start = 0; start < REDIS_CLUSTER_SLOTS; start = s) {
+        for (s = start; s < REDIS_CLUSTER_SLOTS && standin.owner[s] == standin.owner[start]; s++);
+        len += snprintf(buf+len,sizeof(buf)-len,
+                        "*3\r\n:%d\r\n:%d\r\n*3\r\n$9\r\n127.0.0.1\r\n:%d\r\n$5\r\nnode%d\r\n",
+                        start,s-1,standin.port[standin.owner[start]],standin.owner[start]);
+        ranges++;
+    }
+    return reply(fd,"*%d\r\n%.*s",ranges,len,buf);
+}
+
+/* Answer one command; GET replies with the name of the node serving it. */
+static int serveCommand(standinClient *cl, redisReply *r, int *asking) {
+    int me = cl->node, s, status;
+    const char *cmd;
+
+    if (r->type != REDIS_REPLY_ARRAY || r->elements == 0)
+        return -1;
+    cmd = r->element[0]->str;
+    if (strcasecmp(cmd,"ASKING") == 0) {
+        *asking = 1;
+        return reply(cl->fd,"+OK\r\n");
+    }
+    if (strcasecmp(cmd,"CLUSTER") == 0) {
+        pthread_mutex_lock(&standin.lock);
+        standin.slots++;
+        status = replySlots(cl->fd);
+        pthread_mutex_unlock(&standin.lock);
+        return status;
+    }
+    if (r->elements < 2)
+        return reply(cl->fd,"+PONG\r\n");
+
+    s = redisClusterKeySlot(r->element[1]->str,r->element[1]->len);
+    pthread_mutex_lock(&standin.lock);
+    if (standin.bounce[s]) {
+        standin.moved++;
+        status = reply(cl->fd,"-MOVED %d 127.0.0.1:%d\r\n",s,standin.port[(me+1)%NODES]);
+    } else if (standin.owner[s] == me && standin.migrating[s] >= 0) {
+        standin.ask++;
+        status = reply(cl->fd,"-ASK %d 127.0.0.1:%d\r\n",s,standin.port[standin.migrating[s]]);
+    } else if (standin.owner[s] != me && !(*asking && standin.migrating[s] == me)) {
+        standin.moved++;
+        status = reply(cl->fd,"-MOVED %d 127.0.0.1:%d\r\n",s,standin.port[standin.owner[s]]);
+    } else {
+        status = reply(cl->fd,"$5\r\nnode%d\r\n",me);
+    }
+    pthread_mutex_unlock(&standin.lock);
+    *asking = 0;
+    return status;
+}
+
+static void *serveClient(void *privdata) {
+    standinClient *cl = privdata;
+    redisReader *reader = redisReaderCreate();
+    char buf[16384];
+    ssize_t nread;
+    void *r;
+    int asking = 0, ok = reader != NULL;
+
+    while (ok && (nread = read(cl->fd,buf,sizeof(buf))) > 0) {
+        redisReaderFeed(reader,buf,nread);
+        while (ok && redisReaderGetReply(reader,&r) == REDIS_OK && r != NULL) {
+            ok = serveCommand(cl,r,&asking) == 0;
+            freeReplyObject(r);
+        }
+    }
+    if (reader)
+        redisReaderFree(reader);
+    close(cl->fd);
+    free(cl);
+    return NULL;
+}
+
+static void *serveNode(void *privdata) {
+    int node = (int)(long)privdata >> 16, s = (int)(long)privdata & 0xffff;
+    standinClient *cl;
+    pthread_t thread;
+    int fd;
+
+    while ((fd = accept(s,NULL,NULL)) != -1) {
+        if ((cl = malloc(sizeof(*cl))) == NULL) {
+            close(fd);
+            continue;
+        }
+        cl->fd = fd;
+        cl->node = node;
+        if (pthread_create(&thread,NULL,serveClient,cl) != 0) {
+            close(fd);
+            free(cl);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+/* Listen on a loopback port per node, slots split evenly between them. */
+static int startStandIn(void) {
+    struct sockaddr_in sa;
+    socklen_t len;
+    pthread_t thread;
+    int i, s;
+
+    pthread_mutex_init(&standin.lock,NULL);
+    for (i = 0; i < REDIS_CLUSTER_SLOTS; i++) {
+        standin.owner[i] = i*NODES/REDIS_CLUSTER_SLOTS;
+        standin.migrating[i] = -1;
+    }
+    for (i = 0; i < NODES; i++) {
+        if ((s = socket(AF_INET,SOCK_STREAM,0)) == -1)
+            return -1;
+        memset(&sa,0,sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        len = sizeof(sa);
+        if (bind(s,(struct sockaddr*)&sa,sizeof(sa)) == -1 || listen(s,128) == -1 ||
+            getsockname(s,(struct sockaddr*)&sa,&len) == -1 ||
+            pthread_create(&thread,NULL,serveNode,(void*)(long)(i << 16 | s)) != 0)
+        {
+            close(s);
+            return -1;
+        }
+        pthread_detach(thread);
+        standin.port[i] = ntohs(sa.sin_port);
+    }
+    return 0;
+}
+
+/* Client side: a poll(2) loop over the node connections. */
+typedef struct pollEvents {
+    int reading, writing;
+} pollEvents;
+
+static void pollAddRead(void *privdata) { ((pollEvents*)privdata)->reading = 1; }
+static void pollDelRead(void *privdata) { ((pollEvents*)privdata)->reading = 0; }
+static void pollAddWrite(void *privdata) { ((pollEvents*)privdata)->writing = 1; }
+static void pollDelWrite(void *privdata) { ((pollEvents*)privdata)->writing = 0; }
+static void pollCleanup(void *privdata) { free(privdata); }
+
+static int pollAttach(redisAsyncContext *ac, void *privdata) {
+    pollEvents *ev = calloc(1,sizeof(*ev));
+
+    ((void)privdata);
+    if (ev == NULL)
+        return REDIS_ERR;
+    ac->ev.data = ev;
+    ac->ev.addRead = pollAddRead;
+    ac->ev.delRead = pollDelRead;
+    ac->ev.addWrite = pollAddWrite;
+    ac->ev.delWrite = pollDelWrite;
+    ac->ev.cleanup = pollCleanup;
+    return REDIS_OK;
+}
+
+static int nodeConnected(redisClusterContext *cc, redisAsyncContext *ac) {
+    redisClusterNode *node;
+
+    for (node = cc->nodes; node != NULL; node = node->next)
+        if (node->ac == ac)
+            return 1;
+    return 0;
+}
+
+/* Run the loop until "*done" is set, or for a second at most. The slot map
+ * is waited for as well. */
+static int runUntil(redisClusterContext *cc, int *done) {
+    redisAsyncContext *acs[NODES*2];
+    struct pollfd pfd[NODES*2];
+    redisClusterNode *node;
+    long long deadline = redisNowUsec()+1000000;
+    pollEvents *ev;
+    int i, n;
+
+    while (!*done || cc->refreshing) {
+        if (redisNowUsec() > deadline)
+            return -1;
+        for (n = 0, node = cc->nodes; node != NULL && n < NODES*2; node = node->next) {
+            if (node->ac == NULL)
+                continue;
+            ev = node->ac->ev.data;
+            acs[n] = node->ac;
+            pfd[n].fd = node->ac->c.fd;
+            pfd[n].events = (ev->reading ? POLLIN : 0)|(ev->writing ? POLLOUT : 0);
+            n++;
+        }
+        if (poll(pfd,n,100) <= 0)
+            continue;
+        for (i = 0; i < n; i++) {
+            if (pfd[i].revents & (POLLIN|POLLHUP|POLLERR) && nodeConnected(cc,acs[i]))
+                redisAsyncHandleRead(acs[i]);
+            if (pfd[i].revents & POLLOUT && nodeConnected(cc,acs[i]) &&
+                ((pollEvents*)acs[i]->ev.data)->writing)
+                redisAsyncHandleWrite(acs[i]);
+        }
+    }
+    return 0;
+}
+
+typedef struct result {
+    int done;
+    char str[128];
+} result;
+
+static void onReply(redisAsyncContext *ac, void *r, void *privdata) {
+    redisReply *reply = r;
+    result *res = privdata;
+
+    ((void)ac);
+    res->done = 1;
+    if (reply == NULL)
+        snprintf(res->str,sizeof(res->str),"(no reply)");
+    else if (reply->type == REDIS_REPLY_STRING || reply->type == REDIS_REPLY_ERROR)
+        snprintf(res->str,sizeof(res->str),"%s",reply->str);
+    else
+        snprintf(res->str,sizeof(res->str),"(reply type %d)",reply->type);
+}
+
+/* GET "key" through the cluster. Returns the reply, as a string. */
+static const char *get(redisClusterContext *cc, const char *key, result *res) {
+    res->done = 0;
+    if (redisClusterCommand(cc,onReply,res,"GET %s",key) != REDIS_OK)
+        return "(not sent)";
+    if (runUntil(cc,&res->done) != 0)
+        return "(timeout)";
+    return res->str;
+}
+
+static long counter(long *c) {
+    long v;
+
+    pthread_mutex_lock(&standin.lock);
+    v = *c;
+    pthread_mutex_unlock(&standin.lock);
+    return v;
+}
+
+static int failures;
+
+static void check(int ok, const char *what) {
+    printf("%-4s %s\n",ok ? "ok" : "FAIL",what);
+    if (!ok)
+        failures++;
+}
+
+static int slotOf(const char *key) {
+    return redisClusterKeySlot(key,strlen(key));
+}
+
+int main(void) {
+    redisClusterContext *cc;
+    char expected[16];
+    result res, other;
+    long moved, slots;
+    int s, to, idle = 1;
+
+    if (startStandIn() != 0) {
+        fprintf(stderr,"can't start the stand-in cluster\n");
+        return 1;
+    }
+    if ((cc = redisClusterConnect("127.0.0.1",standin.port[0],pollAttach,NULL)) == NULL) {
+        fprintf(stderr,"out of memory\n");
+        return 1;
+    }
+    runUntil(cc,&idle);
+    check(cc->slots[0] != NULL && cc->slots[REDIS_CLUSTER_SLOTS-1] != NULL,
+          "slot map loaded with CLUSTER SLOTS");
+
+    /* Routing by slot. */
+    s = slotOf("foo");
+    snprintf(expected,sizeof(expected),"node%d",standin.owner[s]);
+    check(strcmp(get(cc,"foo",&res),expected) == 0 && counter(&standin.moved) == 0,
+          "key sent to the node serving its slot");
+    check(slotOf("{user1000}.following") == slotOf("{user1000}.followers") &&
+          strcmp(get(cc,"{user1000}.following",&res),get(cc,"{user1000}.followers",&other)) == 0 &&
+          counter(&standin.moved) == 0,
+          "keys with the same hash tag go to the same node");
+
+    /* MOVED: the slot of "foo" changes hands. */
+    to = (standin.owner[s]+1)%NODES;
+    pthread_mutex_lock(&standin.lock);
+    standin.owner[s] = to;
+    pthread_mutex_unlock(&standin.lock);
+    slots = counter(&standin.slots);
+    snprintf(expected,sizeof(expected),"node%d",to);
+    check(strcmp(get(cc,"foo",&res),expected) == 0 && counter(&standin.moved) == 1,
+          "MOVED followed to the new node");
+    check(counter(&standin.slots) == slots+1, "slot map loaded again after MOVED");
+    check(strcmp(get(cc,"foo",&res),expected) == 0 && counter(&standin.moved) == 1,
+          "next command sent to the new node directly");
+
+    /* ASK: the slot of "bar" is being migrated. */
+    s = slotOf("bar");
+    to = (standin.owner[s]+1)%NODES;
+    pthread_mutex_lock(&standin.lock);
+    standin.migrating[s] = to;
+    pthread_mutex_unlock(&standin.lock);
+    moved = counter(&standin.moved);
+    slots = counter(&standin.slots);
+    snprintf(expected,sizeof(expected),"node%d",to);
+    check(strcmp(get(cc,"bar",&res),expected) == 0 && counter(&standin.ask) == 1,
+          "ASK followed with ASKING to the importing node");
+    check(strcmp(get(cc,"bar",&res),expected) == 0 && counter(&standin.ask) == 2 &&
+          counter(&standin.moved) == moved && counter(&standin.slots) == slots,
+          "ASK leaves the slot map alone");
+
+    /* A slot bounced between the nodes forever. */
+    s = slotOf("loop");
+    pthread_mutex_lock(&standin.lock);
+    standin.bounce[s] = 1;
+    pthread_mutex_unlock(&standin.lock);
+    moved = counter(&standin.moved);
+    check(strncmp(get(cc,"loop",&res),"MOVED ",6) == 0 &&
+          counter(&standin.moved) == moved+REDIS_CLUSTER_MAX_REDIRECTS+1,
+          "redirections given up after REDIS_CLUSTER_MAX_REDIRECTS");
+
+    redisClusterFree(cc);
+    printf("%s\n",failures ? "some checks failed" : "all checks passed");
+    return failures ? 1 : 0;
+}
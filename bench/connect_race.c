@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Time to connect to a host with several addresses, with a blocking
+ * context and with an async one on redisRuntime, whose event loop can move
+ * over to another socket while addresses are raced.
+ *
+ *   cc -O2 -pthread -I../Hiredis -o connect_race connect_race.c \
+ *      ../Hiredis/runtime.c ../Hiredis/queue.c ../Hiredis/async.c \
+ *      ../Hiredis/hiredis.c ../Hiredis/net.c ../Hiredis/read.c \
+ *      ../Hiredis/sds.c ../Hiredis/command.c
+ *   ./connect_race racetest 6379 20
+ *
+ * The interesting hosts resolve to addresses that don't answer before one
+ * that does, e.g. with these lines in /etc/hosts:
+ *
+ *   10.255.255.1 racetest   # unroutable: SYNs are dropped
+ *   127.0.0.2    racetest   # slow: a listener whose backlog is full
+ *   127.0.0.1    racetest   # the server
+ *
+ * The slow address is made with "./connect_race -stall 127.0.0.2 6379",
+ * which listens with a full backlog until killed. The order getaddrinfo()
+ * returns the addresses in is printed first. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "runtime.h"
+#include "net.h"
+
+static long long connected;
+static int status;
+
+static void onConnect(const redisAsyncContext *ac, int st) {
+    ((void)ac);
+    status = st;
+    __atomic_store_n(&connected,redisNowUsec(),__ATOMIC_RELEASE);
+}
+
+static int setup(redisAsyncContext *ac, void *privdata) {
+    ((void)privdata);
+    return redisAsyncSetConnectCallback(ac,onConnect);
+}
+
+/* Listen with a backlog filled up by a connection never accepted, so
+ * SYNs to the address go unanswered until the kernel gives up. */
+static int stall(const char *ip, int port) {
+    struct sockaddr_in sa;
+    int s, fill, on = 1;
+
+    memset(&sa,0,sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    if (inet_pton(AF_INET,ip,&sa.sin_addr) != 1 ||
+        (s = socket(AF_INET,SOCK_STREAM,0)) == -1 ||
+        setsockopt(s,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on)) == -1 ||
+        bind(s,(struct sockaddr*)&sa,sizeof(sa)) == -1 ||
+        listen(s,0) == -1 ||
+        (fill = socket(AF_INET,SOCK_STREAM,0)) == -1 ||
+        connect(fill,(struct sockaddr*)&sa,sizeof(sa)) == -1)
+    {
+        perror("stall");
+        return 1;
+    }
+    printf("stalling %s:%d\n",ip,port);
+    pause();
+    return 0;
+}
+
+static void printAddresses(const char *host, int port) {
+    struct addrinfo hints, *servinfo, *p;
+    char buf[64], ip[INET6_ADDRSTRLEN];
+
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(buf,sizeof(buf),"%d",port);
+    if (getaddrinfo(host,buf,&hints,&servinfo) != 0)
+        return;
+    printf("%s:",host);
+    for (p = servinfo; p != NULL; p = p->ai_next) {
+        if (p->ai_family == AF_INET)
+            inet_ntop(AF_INET,&((struct sockaddr_in*)p->ai_addr)->sin_addr,ip,sizeof(ip));
+        else
+            inet_ntop(AF_INET6,&((struct sockaddr_in6*)p->ai_addr)->sin6_addr,ip,sizeof(ip));
+        printf(" %s",ip);
+    }
+    printf("\n");
+    freeaddrinfo(servinfo);
+}
+
+static void report(const char *name, long long *usec, int n, int failed) {
+    long long sum = 0, max = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        sum += usec[i];
+        if (usec[i] > max) max = usec[i];
+    }
+    printf("%-9s avg %.1f ms, max %.1f ms",name,n ? sum/1000.0/n : 0,max/1000.0);
+    if (failed)
+        printf(", %d failed",failed);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    const char *host;
+    struct timeval tv = { 10, 0 };
+    redisContext *c;
+    redisRuntime *rt;
+    long long start, *usec;
+    int port, tries, i, n, failed;
+
+    if (argc == 4 && strcmp(argv[1],"-stall") == 0)
+        return stall(argv[2],atoi(argv[3]));
+
+    host = argc > 1 ? argv[1] : "localhost";
+    port = argc > 2 ? atoi(argv[2]) : 6379;
+    tries = argc > 3 ? atoi(argv[3]) : 20;
+    if (port <= 0 || tries <= 0) {
+        fprintf(stderr,"usage: %s [host] [port] [tries]\n"
+                       "       %s -stall ip port\n",argv[0],argv[0]);
+        return 1;
+    }
+    if ((usec = malloc(sizeof(*usec)*tries)) == NULL) {
+        fprintf(stderr,"out of memory\n");
+        return 1;
+    }
+    printAddresses(host,port);
+
+    for (i = 0, n = 0, failed = 0; i < tries; i++) {
+        start = redisNowUsec();
+        c = redisConnectWithTimeout(host,port,tv);
+        if (c == NULL || c->err)
+            failed++;
+        else
+            usec[n++] = redisNowUsec()-start;
+        redisFree(c);
+    }
+    report("blocking",usec,n,failed);
+
+    for (i = 0, n = 0, failed = 0; i < tries; i++) {
+        if ((rt = redisRuntimeCreate(1,0)) == NULL) {
+            fprintf(stderr,"can't create the runtime\n");
+            return 1;
+        }
+        redisRuntimeSetSetupCallback(rt,setup,NULL);
+        redisRuntimeConnect(rt,host,port);
+        __atomic_store_n(&connected,0,__ATOMIC_RELAXED);
+        start = redisNowUsec();
+        if (redisRuntimeStart(rt) != REDIS_OK ||
+            redisRuntimeCommand(rt,REDIS_RUNTIME_ANY,NULL,NULL,"PING") != REDIS_OK)
+        {
+            fprintf(stderr,"can't start the runtime\n");
+            redisRuntimeFree(rt);
+            return 1;
+        }
+        while (__atomic_load_n(&connected,__ATOMIC_ACQUIRE) == 0 &&
+               redisNowUsec()-start < 10000000)
+            sched_yield();
+        if (__atomic_load_n(&connected,__ATOMIC_ACQUIRE) == 0 || status != REDIS_OK)
+            failed++;
+        else
+            usec[n++] = connected-start;
+        redisRuntimeFree(rt);
+    }
+    report("async",usec,n,failed);
+    free(usec);
+    return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Deep-pipeline benchmark: async PINGs per second with "depth" commands in
+ * flight on one connection, "rounds" times over. Each round sends all of
+ * them before reading any reply, so the reply callbacks pile up to the
+ * full depth. It runs with the growable callback ring and with its
+ * capacity fixed with redisAsyncSetCallbackCapacity().
+ *
+ *   cc -O2 -pthread -I../Hiredis -o deep_pipeline deep_pipeline.c \
+ *      ../Hiredis/async.c ../Hiredis/hiredis.c ../Hiredis/net.c \
+ *      ../Hiredis/read.c ../Hiredis/sds.c ../Hiredis/command.c
+ *   ./deep_pipeline 127.0.0.1 0 10000 100
+ *
+ * With port 0 the benchmark starts a stand-in server on the loopback
+ * interface that answers every PING with PONG, so the client side is what
+ * gets measured. Building it against an older Hiredis/ gives the numbers
+ * to compare with; leave out the fixed capacity run there. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "async.h"
+#include "net.h"
+
+#define PING_REQUEST "*1\r\n$4\r\nPING\r\n"
+
+typedef struct pollEvents {
+    int reading, writing;
+} pollEvents;
+
+static void pollAddRead(void *privdata) { ((pollEvents*)privdata)->reading = 1; }
+static void pollDelRead(void *privdata) { ((pollEvents*)privdata)->reading = 0; }
+static void pollAddWrite(void *privdata) { ((pollEvents*)privdata)->writing = 1; }
+static void pollDelWrite(void *privdata) { ((pollEvents*)privdata)->writing = 0; }
+
+static long pending, failed;
+
+static void onReply(redisAsyncContext *ac, void *r, void *privdata) {
+    ((void)ac);
+    ((void)privdata);
+    if (r == NULL)
+        failed++;
+    pending--;
+}
+
+/* Stand-in server. The benchmark only sends PINGs, so every complete
+ * request is answered without parsing it. */
+static void *serveClient(void *privdata) {
+    int fd = (int)(long)privdata;
+    size_t reqlen = strlen(PING_REQUEST), partial = 0, n;
+    char buf[16384], *replies;
+    ssize_t nread;
+
+    if ((replies = malloc(sizeof(buf)/reqlen*7+7)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    while ((nread = read(fd,buf,sizeof(buf))) > 0) {
+        partial += nread;
+        for (n = 0; partial >= reqlen; partial -= reqlen)
+            memcpy(replies+7*n++,"+PONG\r\n",7);
+        if (n && write(fd,replies,7*n) != (ssize_t)(7*n))
+            break;
+    }
+    free(replies);
+    close(fd);
+    return NULL;
+}
+
+static void *serve(void *privdata) {
+    int s = (int)(long)privdata, fd;
+    pthread_t thread;
+
+    while ((fd = accept(s,NULL,NULL)) != -1) {
+        if (pthread_create(&thread,NULL,serveClient,(void*)(long)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+static int startStandIn(void) {
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    pthread_t thread;
+    int s;
+
+    if ((s = socket(AF_INET,SOCK_STREAM,0)) == -1)
+        return -1;
+    memset(&sa,0,sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s,(struct sockaddr*)&sa,sizeof(sa)) == -1 || listen(s,128) == -1 ||
+        getsockname(s,(struct sockaddr*)&sa,&len) == -1 ||
+        pthread_create(&thread,NULL,serve,(void*)(long)s) != 0)
+    {
+        close(s);
+        return -1;
+    }
+    pthread_detach(thread);
+    return ntohs(sa.sin_port);
+}
+
+/* Returns the commands per second, or a negative number on error. */
+static double run(const char *host, int port, long depth, long rounds, int capacity) {
+    redisAsyncContext *ac;
+    pollEvents ev = {0,0};
+    struct pollfd pfd;
+    long long start, elapsed;
+    long round, i;
+
+    if ((ac = redisAsyncConnect(host,port)) == NULL || ac->err) {
+        fprintf(stderr,"can't connect: %s\n",ac ? ac->errstr : "out of memory");
+        if (ac)
+            redisAsyncFree(ac);
+        return -1;
+    }
+    ac->ev.data = &ev;
+    ac->ev.addRead = pollAddRead;
+    ac->ev.delRead = pollDelRead;
+    ac->ev.addWrite = pollAddWrite;
+    ac->ev.delWrite = pollDelWrite;
+    if (capacity && redisAsyncSetCallbackCapacity(ac,(int)depth) != REDIS_OK) {
+        fprintf(stderr,"can't set the callback capacity: %s\n",ac->errstr);
+        redisAsyncFree(ac);
+        return -1;
+    }
+
+    failed = 0;
+    start = redisNowUsec();
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < depth; i++) {
+            if (redisAsyncCommand(ac,onReply,NULL,"PING") != REDIS_OK) {
+                fprintf(stderr,"command refused: %s\n",ac->errstr);
+                redisAsyncFree(ac);
+                return -1;
+            }
+        }
+        pending = depth;
+        while (pending > 0) {
+            pfd.fd = ac->c.fd;
+            pfd.events = (ev.reading ? POLLIN : 0)|(ev.writing ? POLLOUT : 0);
+            if (poll(&pfd,1,1000) <= 0) {
+                fprintf(stderr,"no reply from the server\n");
+                redisAsyncFree(ac);
+                return -1;
+            }
+            if (pfd.revents & (POLLIN|POLLHUP|POLLERR))
+                redisAsyncHandleRead(ac);
+            if (ac->err) {
+                fprintf(stderr,"error: %s\n",ac->errstr);
+                redisAsyncFree(ac);
+                return -1;
+            }
+            if (pfd.revents & POLLOUT && ev.writing)
+                redisAsyncHandleWrite(ac);
+        }
+    }
+    elapsed = redisNowUsec()-start;
+    redisAsyncFree(ac);
+    if (failed) {
+        fprintf(stderr,"%ld commands failed\n",failed);
+        return -1;
+    }
+    return (double)depth*rounds*1e6/elapsed;
+}
+
+int main(int argc, char **argv) {
+    const char *host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 0;
+    long depth = argc > 3 ? atol(argv[3]) : 10000;
+    long rounds = argc > 4 ? atol(argv[4]) : 100;
+    double rate;
+    int capacity;
+
+    if (depth <= 0 || rounds <= 0) {
+        fprintf(stderr,"usage: %s [host] [port, 0 for a stand-in] [depth] "
+                       "[rounds]\n",argv[0]);
+        return 1;
+    }
+    if (port == 0) {
+        host = "127.0.0.1";
+        if ((port = startStandIn()) < 0) {
+            fprintf(stderr,"can't start the stand-in server\n");
+            return 1;
+        }
+    }
+
+    for (capacity = 0; capacity <= 1; capacity++) {
+        if ((rate = run(host,port,depth,rounds,capacity)) < 0)
+            return 1;
+        printf("%-9s %.0f commands/s\n",capacity ? "capacity" : "growable",rate);
+    }
+    return 0;
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Pool throughput benchmark: PINGs per second from 1, 2, 4... up to
+ * "threads" threads, each taking a connection for every command and giving
+ * it back. It compares redisPool with the plain mutex and condition
+ * variable pool services used to write, sized to one connection per thread
+ * in both cases.
+ *
+ *   cc -O2 -pthread -I../Hiredis -o pool_throughput pool_throughput.c \
+ *      ../Hiredis/pool.c ../Hiredis/hiredis.c ../Hiredis/net.c \
+ *      ../Hiredis/read.c ../Hiredis/sds.c
+ *   ./pool_throughput 127.0.0.1 6379 8 100000
+ *
+ * With port 0 the benchmark starts a stand-in server on the loopback
+ * interface, answering every PING with PONG from a thread per connection,
+ * so the pool rather than Redis is what gets measured. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "pool.h"
+#include "net.h"
+
+#define PING_REQUEST "*1\r\n$4\r\nPING\r\n"
+
+/* The pool every service had: a locked stack of connections. */
+typedef struct mutexPool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    redisContext **free;
+    int nfree;
+} mutexPool;
+
+typedef struct worker {
+    pthread_t thread;
+    redisPool *pool;
+    mutexPool *mpool;
+    long count, failed;
+} worker;
+
+static redisContext *mutexPoolGet(mutexPool *p) {
+    redisContext *c;
+
+    pthread_mutex_lock(&p->lock);
+    while (p->nfree == 0)
+        pthread_cond_wait(&p->cond,&p->lock);
+    c = p->free[--p->nfree];
+    pthread_mutex_unlock(&p->lock);
+    return c;
+}
+
+static void mutexPoolRelease(mutexPool *p, redisContext *c) {
+    pthread_mutex_lock(&p->lock);
+    p->free[p->nfree++] = c;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void *work(void *privdata) {
+    worker *w = privdata;
+    redisContext *c;
+    redisReply *reply;
+    long i;
+
+    for (i = 0; i < w->count; i++) {
+        c = w->pool ? redisPoolGet(w->pool,NULL) : mutexPoolGet(w->mpool);
+        if (c == NULL) {
+            w->failed++;
+            continue;
+        }
+        if ((reply = redisCommand(c,"PING")) == NULL)
+            w->failed++;
+        else
+            freeReplyObject(reply);
+        if (w->pool)
+            redisPoolRelease(w->pool,c);
+        else
+            mutexPoolRelease(w->mpool,c);
+    }
+    return NULL;
+}
+
+/* Stand-in server. The benchmark only sends PINGs, so every complete
+ * request is answered without parsing it. */
+static void *serveClient(void *privdata) {
+    int fd = (int)(long)privdata;
+    size_t reqlen = strlen(PING_REQUEST), partial = 0, n;
+    char buf[16384], *replies;
+    ssize_t nread;
+
+    if ((replies = malloc(sizeof(buf)/reqlen*7+7)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    while ((nread = read(fd,buf,sizeof(buf))) > 0) {
+        partial += nread;
+        for (n = 0; partial >= reqlen; partial -= reqlen)
+            memcpy(replies+7*n++,"+PONG\r\n",7);
+        if (n && write(fd,replies,7*n) != (ssize_t)(7*n))
+            break;
+    }
+    free(replies);
+    close(fd);
+    return NULL;
+}
+
+static void *serve(void *privdata) {
+    int s = (int)(long)privdata, fd;
+    pthread_t thread;
+
+    while ((fd = accept(s,NULL,NULL)) != -1) {
+        if (pthread_create(&thread,NULL,serveClient,(void*)(long)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+static int startStandIn(void) {
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    pthread_t thread;
+    int s;
+
+    if ((s = socket(AF_INET,SOCK_STREAM,0)) == -1)
+        return -1;
+    memset(&sa,0,sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s,(struct sockaddr*)&sa,sizeof(sa)) == -1 || listen(s,128) == -1 ||
+        getsockname(s,(struct sockaddr*)&sa,&len) == -1 ||
+        pthread_create(&thread,NULL,serve,(void*)(long)s) != 0)
+    {
+        close(s);
+        return -1;
+    }
+    pthread_detach(thread);
+    return ntohs(sa.sin_port);
+}
+
+/* Run "count" commands from each of "nthreads" threads. Returns the
+ * commands per second, or a negative number on error. */
+static double run(const char *host, int port, int nthreads, long count,
+                  int mutex, long *failed)
+{
+    redisPool *pool = NULL;
+    mutexPool mpool;
+    worker *workers;
+    long long start, elapsed;
+    int i, n = 0;
+
+    if ((workers = calloc(nthreads,sizeof(*workers))) == NULL)
+        return -1;
+    if (mutex) {
+        pthread_mutex_init(&mpool.lock,NULL);
+        pthread_cond_init(&mpool.cond,NULL);
+        mpool.nfree = 0;
+        if ((mpool.free = malloc(sizeof(redisContext*)*nthreads)) == NULL) {
+            free(workers);
+            return -1;
+        }
+        for (i = 0; i < nthreads; i++) {
+            redisContext *c = redisConnect(host,port);
+
+            if (c == NULL || c->err) {
+                fprintf(stderr,"can't connect: %s\n",c ? c->errstr : "out of memory");
+                redisFree(c);
+                break;
+            }
+            mpool.free[mpool.nfree++] = c;
+        }
+    } else if ((pool = redisPoolCreate(host,port,NULL,nthreads,nthreads)) == NULL) {
+        fprintf(stderr,"can't create the pool\n");
+        free(workers);
+        return -1;
+    }
+
+    if (!mutex || mpool.nfree == nthreads) {
+        start = redisNowUsec();
+        for (n = 0; n < nthreads; n++) {
+            workers[n].pool = pool;
+            workers[n].mpool = &mpool;
+            workers[n].count = count;
+            if (pthread_create(&workers[n].thread,NULL,work,&workers[n]) != 0)
+                break;
+        }
+        for (i = 0; i < n; i++) {
+            pthread_join(workers[i].thread,NULL);
+            *failed += workers[i].failed;
+        }
+        elapsed = redisNowUsec()-start;
+    }
+
+    if (mutex) {
+        while (mpool.nfree > 0)
+            redisFree(mpool.free[--mpool.nfree]);
+        free(mpool.free);
+        pthread_cond_destroy(&mpool.cond);
+        pthread_mutex_destroy(&mpool.lock);
+    } else {
+        redisPoolFree(pool);
+    }
+    free(workers);
+    if (n < nthreads)
+        return -1;
+    return (double)count*nthreads*1e6/elapsed;
+}
+
+int main(int argc, char **argv) {
+    const char *host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 0;
+    int maxthreads = argc > 3 ? atoi(argv[3]) : 8;
+    long count = argc > 4 ? atol(argv[4]) : 100000;
+    double rate[2];
+    long failed = 0;
+    int nthreads, mutex;
+
+    if (maxthreads <= 0 || count <= 0) {
+        fprintf(stderr,"usage: %s [host] [port, 0 for a stand-in] [threads] "
+                       "[commands per thread]\n",argv[0]);
+        return 1;
+    }
+    if (port == 0) {
+        host = "127.0.0.1";
+        if ((port = startStandIn()) < 0) {
+            fprintf(stderr,"can't start the stand-in server\n");
+            return 1;
+        }
+    }
+
+    for (nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+        for (mutex = 0; mutex <= 1; mutex++) {
+            if ((rate[mutex] = run(host,port,nthreads,count,mutex,&failed)) < 0)
+                return 1;
+        }
+        printf("%d threads: redisPool %.0f commands/s, mutex pool %.0f commands/s",
+               nthreads,rate[0],rate[1]);
+        if (failed)
+            printf(", %ld failed",failed);
+        printf("\n");
+    }
+    return 0;
+}
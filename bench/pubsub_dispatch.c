@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Pub/sub dispatch microbenchmark: the time it takes to find the callback
+ * of a "message" reply, without the socket or the reply parser. Replies are
+ * built up front for "channels" subscribed channels and each of "messages"
+ * lookups picks one of them in a scattered order.
+ *
+ * It includes async.c to reach the dispatch, so it is built with the
+ * sources rather than against the library:
+ *
+ *   cc -O2 -I../Hiredis -o pubsub_dispatch pubsub_dispatch.c \
+ *      ../Hiredis/hiredis.c ../Hiredis/net.c ../Hiredis/read.c \
+ *      ../Hiredis/sds.c ../Hiredis/command.c
+ *   ./pubsub_dispatch 1000 10000000
+ *
+ * No server is needed: the context is never connected. Building it against
+ * an older Hiredis/ gives the numbers to compare with. */
+
+#include "async.c"
+#include <stdio.h>
+
+static redisReply *createString(const char *s) {
+    redisReply *r = calloc(1,sizeof(*r));
+
+    r->type = REDIS_REPLY_STRING;
+    r->len = strlen(s);
+    r->str = strdup(s);
+    return r;
+}
+
+int main(int argc, char **argv) {
+    int nchannels = argc > 1 ? atoi(argv[1]) : 1000;
+    long n = argc > 2 ? atol(argv[2]) : 10000000, i, k, bad = 0;
+    redisAsyncContext *ac;
+    redisCallback cb, found;
+    redisReply **msgs;
+    char name[64];
+    long long start;
+    double secs;
+    int j;
+
+    if (nchannels <= 0 || n <= 0) {
+        fprintf(stderr,"usage: %s [channels] [messages]\n",argv[0]);
+        return 1;
+    }
+    if ((ac = redisAsyncConnect("127.0.0.1",6379)) == NULL ||
+        (msgs = malloc(sizeof(*msgs)*nchannels)) == NULL)
+    {
+        fprintf(stderr,"out of memory\n");
+        return 1;
+    }
+
+    memset(&cb,0,sizeof(cb));
+    for (j = 0; j < nchannels; j++) {
+        snprintf(name,sizeof(name),"news.sports.channel:%d",j);
+        cb.privdata = (void*)(long)j;
+        dictReplace(ac->sub.channels,sdsnew(name),&cb);
+
+        msgs[j] = calloc(1,sizeof(redisReply));
+        msgs[j]->type = REDIS_REPLY_ARRAY;
+        msgs[j]->elements = 3;
+        msgs[j]->element = malloc(sizeof(redisReply*)*3);
+        msgs[j]->element[0] = createString("message");
+        msgs[j]->element[1] = createString(name);
+        msgs[j]->element[2] = createString("hello");
+    }
+
+    start = redisNowUsec();
+    for (i = 0; i < n; i++) {
+        k = (i*7919) % nchannels;
+        __redisGetSubscribeCallback(ac,msgs[k],&found);
+        if ((long)found.privdata != k)
+            bad++;
+    }
+    secs = (redisNowUsec()-start)/1e6;
+
+    printf("%d channels: %.1f ns/message, %.0f messages/s",nchannels,secs*1e9/n,n/secs);
+    if (bad)
+        printf(", %ld misdispatched",bad);
+    printf("\n");
+
+    for (j = 0; j < nchannels; j++)
+        freeReplyObject(msgs[j]);
+    free(msgs);
+    redisAsyncFree(ac);
+    return bad != 0;
+}
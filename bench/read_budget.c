@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Read budget benchmark: read events per MB of replies, with one read per
+ * event as before the read loop, with the default budget and with no
+ * budget at all. "depth" GETs of a "size" byte value are kept in flight on
+ * one connection, driven by a poll(2) loop that counts read events.
+ *
+ *   cc -O2 -I../Hiredis -o read_budget read_budget.c ../Hiredis/async.c \
+ *      ../Hiredis/hiredis.c ../Hiredis/net.c ../Hiredis/read.c \
+ *      ../Hiredis/sds.c ../Hiredis/command.c
+ *   ./read_budget 127.0.0.1 6379 1 1048576 8
+ *
+ * Large values and a deep pipeline are what the budget is for: with small
+ * replies every read is short and all three lines look the same. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include "async.h"
+#include "net.h"
+
+typedef struct pollEvents {
+    int reading, writing;
+} pollEvents;
+
+typedef struct benchState {
+    long long total, received, issued;
+    size_t size;
+    long depth, pending;
+    int failed;
+} benchState;
+
+static void pollAddRead(void *privdata) { ((pollEvents*)privdata)->reading = 1; }
+static void pollDelRead(void *privdata) { ((pollEvents*)privdata)->reading = 0; }
+static void pollAddWrite(void *privdata) { ((pollEvents*)privdata)->writing = 1; }
+static void pollDelWrite(void *privdata) { ((pollEvents*)privdata)->writing = 0; }
+
+static void onReply(redisAsyncContext *ac, void *r, void *privdata) {
+    benchState *st = privdata;
+    redisReply *reply = r;
+
+    st->pending--;
+    if (reply == NULL || reply->type == REDIS_REPLY_ERROR) {
+        st->failed = 1;
+        return;
+    }
+    if (reply->type == REDIS_REPLY_STRING)
+        st->received += reply->len;
+    while (!st->failed && st->issued < st->total && st->pending < st->depth) {
+        if (redisAsyncCommand(ac,onReply,st,"GET budget:bench") != REDIS_OK) {
+            st->failed = 1;
+            return;
+        }
+        st->issued += st->size;
+        st->pending++;
+    }
+}
+
+/* Run the GETs with the given read budget. Returns the number of read
+ * events, or -1 on error. */
+static long long run(const char *host, int port, const char *value,
+                     size_t size, long long total, long depth, size_t budget,
+                     long long *received, long long *usec)
+{
+    redisAsyncContext *ac;
+    pollEvents ev = {0,0};
+    benchState st;
+    struct pollfd pfd;
+    long long start, events = 0;
+
+    if ((ac = redisAsyncConnect(host,port)) == NULL || ac->err) {
+        fprintf(stderr,"can't connect: %s\n",ac ? ac->errstr : "out of memory");
+        if (ac)
+            redisAsyncFree(ac);
+        return -1;
+    }
+    ac->ev.data = &ev;
+    ac->ev.addRead = pollAddRead;
+    ac->ev.delRead = pollDelRead;
+    ac->ev.addWrite = pollAddWrite;
+    ac->ev.delWrite = pollDelWrite;
+    redisAsyncSetReadBudget(ac,budget,0);
+
+    /* The SET reply starts the GETs. */
+    memset(&st,0,sizeof(st));
+    st.total = total;
+    st.size = size;
+    st.depth = depth;
+    st.pending = 1;
+    redisAsyncCommand(ac,onReply,&st,"SET budget:bench %b",value,size);
+
+    start = redisNowUsec();
+    while (!st.failed && st.pending > 0) {
+        pfd.fd = ac->c.fd;
+        pfd.events = (ev.reading ? POLLIN : 0)|(ev.writing ? POLLOUT : 0);
+        if (poll(&pfd,1,1000) <= 0) {
+            fprintf(stderr,"no reply from the server\n");
+            st.failed = 1;
+            break;
+        }
+        if (pfd.revents & (POLLIN|POLLHUP|POLLERR)) {
+            events++;
+            redisAsyncHandleRead(ac);
+        }
+        if (ac->err) {
+            st.failed = 1;
+            break;
+        }
+        if (pfd.revents & POLLOUT && ev.writing)
+            redisAsyncHandleWrite(ac);
+    }
+    *usec = redisNowUsec()-start;
+
+    if (st.failed) {
+        fprintf(stderr,"error: %s\n",ac->err ? ac->errstr : "bad reply");
+        redisAsyncFree(ac);
+        return -1;
+    }
+    redisAsyncFree(ac);
+    *received = st.received;
+    return events;
+}
+
+int main(int argc, char **argv) {
+    const char *host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 6379;
+    double gb = argc > 3 ? atof(argv[3]) : 1;
+    long size = argc > 4 ? atol(argv[4]) : 1024*1024;
+    long depth = argc > 5 ? atol(argv[5]) : 8;
+    const char *names[] = {"one read","default","drain"};
+    size_t budgets[] = {1, REDIS_ASYNC_READ_BUDGET, (size_t)-1};
+    long long total, events, received, usec;
+    double mb;
+    char *value;
+    int i;
+
+    if (gb <= 0 || size <= 0 || depth <= 0) {
+        fprintf(stderr,"usage: %s [host] [port] [GB] [value size] [depth]\n",argv[0]);
+        return 1;
+    }
+    if ((value = malloc(size)) == NULL) {
+        fprintf(stderr,"out of memory\n");
+        return 1;
+    }
+    memset(value,'x',size);
+    total = (long long)(gb*1024*1024*1024);
+
+    for (i = 0; i < 3; i++) {
+        if ((events = run(host,port,value,size,total,depth,budgets[i],
+                          &received,&usec)) < 0)
+            return 1;
+        mb = (double)received/(1024*1024);
+        printf("%-8s %8.1f read events/MB, %.0f MB/s\n",names[i],
+               events/mb,mb*1e6/usec);
+    }
+    free(value);
+    return 0;
+}
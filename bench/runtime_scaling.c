@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Runtime scaling benchmark: PINGs per second through redisRuntime with 1,
+ * 2, 4... up to "threads" event loop threads, two connections per thread.
+ * Commands are submitted from the main thread with REDIS_RUNTIME_ANY, with
+ * at most "window" commands per thread waiting for their reply.
+ *
+ *   cc -O2 -pthread -I../Hiredis -o runtime_scaling runtime_scaling.c \
+ *      ../Hiredis/runtime.c ../Hiredis/queue.c ../Hiredis/async.c \
+ *      ../Hiredis/hiredis.c ../Hiredis/net.c ../Hiredis/read.c \
+ *      ../Hiredis/sds.c ../Hiredis/command.c
+ *   ./runtime_scaling 127.0.0.1 6379 8 1000000
+ *
+ * Threads are pinned to CPUs where supported. The server has to keep up:
+ * with a single Redis, it is what ends up being measured. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+
+#include "runtime.h"
+#include "net.h"
+
+static long replies, failed;
+
+static void onReply(redisAsyncContext *ac, void *r, void *privdata) {
+    ((void)ac);
+    ((void)privdata);
+    if (r == NULL)
+        __atomic_add_fetch(&failed,1,__ATOMIC_RELAXED);
+    __atomic_add_fetch(&replies,1,__ATOMIC_RELEASE);
+}
+
+int main(int argc, char **argv) {
+    const char *host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 6379;
+    int maxthreads = argc > 3 ? atoi(argv[3]) : 8;
+    long total = argc > 4 ? atol(argv[4]) : 1000000;
+    long window = argc > 5 ? atol(argv[5]) : 4096;
+    redisRuntime *rt;
+    long long start, elapsed;
+    long sent;
+    int nthreads, i;
+
+    if (maxthreads <= 0 || total <= 0 || window <= 0) {
+        fprintf(stderr,"usage: %s [host] [port] [threads] [commands] [window]\n",argv[0]);
+        return 1;
+    }
+
+    for (nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+        if ((rt = redisRuntimeCreate(nthreads,REDIS_RUNTIME_PIN_CPUS)) == NULL) {
+            fprintf(stderr,"can't create the runtime\n");
+            return 1;
+        }
+        for (i = 0; i < 2*nthreads; i++)
+            redisRuntimeConnect(rt,host,port);
+        if (redisRuntimeStart(rt) != REDIS_OK) {
+            fprintf(stderr,"can't start the runtime\n");
+            redisRuntimeFree(rt);
+            return 1;
+        }
+
+        __atomic_store_n(&replies,0,__ATOMIC_RELAXED);
+        __atomic_store_n(&failed,0,__ATOMIC_RELAXED);
+        start = redisNowUsec();
+        for (sent = 0; sent < total; sent++) {
+            while (sent-__atomic_load_n(&replies,__ATOMIC_ACQUIRE) > window*nthreads)
+                sched_yield();
+            if (redisRuntimeCommand(rt,REDIS_RUNTIME_ANY,onReply,NULL,"PING") != REDIS_OK) {
+                __atomic_add_fetch(&failed,1,__ATOMIC_RELAXED);
+                __atomic_add_fetch(&replies,1,__ATOMIC_RELEASE);
+            }
+        }
+        while (__atomic_load_n(&replies,__ATOMIC_ACQUIRE) < total)
+            sched_yield();
+        elapsed = redisNowUsec()-start;
+        redisRuntimeFree(rt);
+
+        printf("%d threads: %.0f commands/s",nthreads,(double)total*1e6/elapsed);
+        if (failed)
+            printf(", %ld failed",failed);
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Socket options benchmark against a server on the loopback interface.
+ * Every profile runs a bulk phase, "depth" SETs of "size" bytes in flight,
+ * and a latency phase of one PING at a time:
+ *
+ *   default  no options
+ *   bulk     4 MB SO_RCVBUF and SO_SNDBUF
+ *   latency  TCP_QUICKACK and 50 usec of SO_BUSY_POLL
+ *
+ *   cc -O2 -I../Hiredis -o sockopt_loopback sockopt_loopback.c \
+ *      ../Hiredis/hiredis.c ../Hiredis/net.c ../Hiredis/read.c ../Hiredis/sds.c
+ *   ./sockopt_loopback 127.0.0.1 6379 1 65536 64 20000
+ *
+ * The options are passed to redisConnectWithOptions(), so the buffer sizes
+ * are in place before connect(2). The values the kernel reports back are
+ * printed with each profile; Linux doubles the buffer sizes. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hiredis.h"
+#include "net.h"
+
+static int cmpLong(const void *a, const void *b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int bulk(redisContext *c, const char *value, size_t size,
+                long long total, long depth, long long *usec)
+{
+    redisReply *reply;
+    long long start, written = 0;
+    long pending = 0;
+
+    start = redisNowUsec();
+    while (written < total || pending > 0) {
+        if (written < total && pending < depth) {
+            redisAppendCommand(c,"SET sockopt:bench %b",value,size);
+            written += size;
+            pending++;
+            continue;
+        }
+        if (redisGetReply(c,(void**)&reply) != REDIS_OK)
+            return REDIS_ERR;
+        freeReplyObject(reply);
+        pending--;
+    }
+    *usec = redisNowUsec()-start;
+    return REDIS_OK;
+}
+
+static int latency(redisContext *c, long long *rtt, long count) {
+    redisReply *reply;
+    long long start;
+    long i;
+
+    for (i = 0; i < count; i++) {
+        start = redisNowUsec();
+        if ((reply = redisCommand(c,"PING")) == NULL)
+            return REDIS_ERR;
+        rtt[i] = redisNowUsec()-start;
+        freeReplyObject(reply);
+    }
+    qsort(rtt,count,sizeof(*rtt),cmpLong);
+    return REDIS_OK;
+}
+
+static int run(const char *host, int port, const char *name,
+               const redisSocketOptions *opts, const char *value, size_t size,
+               long long total, long depth, long long *rtt, long count)
+{
+    redisContext *c;
+    redisSocketOptions in;
+    long long usec;
+
+    if ((c = redisConnectWithOptions(host,port,opts)) == NULL || c->err) {
+        fprintf(stderr,"can't connect: %s\n",c ? c->errstr : "out of memory");
+        redisFree(c);
+        return REDIS_ERR;
+    }
+    if (redisGetSocketOptions(c,&in) != REDIS_OK ||
+        bulk(c,value,size,total,depth,&usec) != REDIS_OK ||
+        latency(c,rtt,count) != REDIS_OK)
+    {
+        fprintf(stderr,"error: %s\n",c->errstr);
+        redisFree(c);
+        return REDIS_ERR;
+    }
+    printf("%-8s rcvbuf %-8d sndbuf %-8d quickack %d busy_poll %-3d "
+           "%7.0f MB/s  rtt p50 %lld p99 %lld usec\n",name,in.rcvbuf,
+           in.sndbuf,in.quickack,in.busy_poll,
+           (double)total*1e6/usec/(1024*1024),rtt[count/2],rtt[count*99/100]);
+    redisFree(c);
+    return REDIS_OK;
+}
+
+int main(int argc, char **argv) {
+    const char *host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 6379;
+    double gb = argc > 3 ? atof(argv[3]) : 1;
+    long size = argc > 4 ? atol(argv[4]) : 65536;
+    long depth = argc > 5 ? atol(argv[5]) : 64;
+    long count = argc > 6 ? atol(argv[6]) : 20000;
+    redisSocketOptions none, big, fast;
+    long long total, *rtt;
+    char *value;
+
+    if (gb <= 0 || size <= 0 || depth <= 0 || count <= 0) {
+        fprintf(stderr,"usage: %s [host] [port] [GB] [value size] [depth] "
+                       "[pings]\n",argv[0]);
+        return 1;
+    }
+    value = malloc(size);
+    rtt = malloc(sizeof(*rtt)*count);
+    if (value == NULL || rtt == NULL) {
+        fprintf(stderr,"out of memory\n");
+        return 1;
+    }
+    memset(value,'x',size);
+    total = (long long)(gb*1024*1024*1024);
+
+    memset(&none,0,sizeof(none));
+    memset(&big,0,sizeof(big));
+    big.rcvbuf = big.sndbuf = 4*1024*1024;
+    memset(&fast,0,sizeof(fast));
+    fast.quickack = 1;
+    fast.busy_poll = 50;
+
+    if (run(host,port,"default",&none,value,size,total,depth,rtt,count) != REDIS_OK ||
+        run(host,port,"bulk",&big,value,size,total,depth,rtt,count) != REDIS_OK ||
+        run(host,port,"latency",&fast,value,size,total,depth,rtt,count) != REDIS_OK)
+        return 1;
+    free(rtt);
+    free(value);
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2015, the RedisKit authors
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Zero-copy CPU benchmark: CPU seconds the client spends per GB written,
+ * with plain sends and with MSG_ZEROCOPY. The same key is SET again and
+ * again to a "size" byte value, "depth" commands in flight.
+ *
+ *   cc -O2 -I../Hiredis -o zerocopy_cpu zerocopy_cpu.c ../Hiredis/hiredis.c \
+ *      ../Hiredis/net.c ../Hiredis/read.c ../Hiredis/sds.c
+ *   ./zerocopy_cpu 10.0.0.2 6379 4 1048576 16
+ *
+ * Only the client process is measured, user and system time. Run it
+ * against a server on another host: over loopback the kernel copies
+ * zero-copy sends anyway, and the numbers say nothing. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "hiredis.h"
+#include "net.h"
+
+static double cpuSeconds(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF,&ru);
+    return ru.ru_utime.tv_sec+ru.ru_stime.tv_sec+
+           (ru.ru_utime.tv_usec+ru.ru_stime.tv_usec)/1e6;
+}
+
+/* Write "total" bytes worth of SETs. Returns the CPU seconds spent, or a
+ * negative number on error. */
+static double run(const char *host, int port, int zerocopy, const char *value,
+                  size_t size, long long total, long depth, long long *usec)
+{
+    redisContext *c;
+    redisReply *reply;
+    long long start, written = 0;
+    double cpu;
+    long pending = 0;
+
+    if ((c = redisConnect(host,port)) == NULL || c->err) {
+        fprintf(stderr,"can't connect: %s\n",c ? c->errstr : "out of memory");
+        redisFree(c);
+        return -1;
+    }
+    if (zerocopy && redisEnableZeroCopy(c,0) != REDIS_OK) {
+        fprintf(stderr,"can't enable zero-copy: %s\n",c->errstr);
+        redisFree(c);
+        return -1;
+    }
+
+    start = redisNowUsec();
+    cpu = cpuSeconds();
+    while (written < total || pending > 0) {
+        if (written < total && pending < depth) {
+            redisAppendCommand(c,"SET zerocopy:bench %b",value,size);
+            written += size;
+            pending++;
+            continue;
+        }
+        if (redisGetReply(c,(void**)&reply) != REDIS_OK) {
+            fprintf(stderr,"error: %s\n",c->errstr);
+            redisFree(c);
+            return -1;
+        }
+        freeReplyObject(reply);
+        pending--;
+    }
+    cpu = cpuSeconds()-cpu;
+    *usec = redisNowUsec()-start;
+    redisFree(c);
+    return cpu;
+}
+
+int main(int argc, char **argv) {
+    const char *host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 6379;
+    double gb = argc > 3 ? atof(argv[3]) : 4;
+    long size = argc > 4 ? atol(argv[4]) : 1024*1024;
+    long depth = argc > 5 ? atol(argv[5]) : 16;
+    long long total, usec;
+    double cpu;
+    char *value;
+    int zerocopy;
+
+    if (gb <= 0 || size <= 0 || depth <= 0) {
+        fprintf(stderr,"usage: %s [host] [port] [GB] [value size] [depth]\n",argv[0]);
+        return 1;
+    }
+    if ((value = malloc(size)) == NULL) {
+        fprintf(stderr,"out of memory\n");
+        return 1;
+    }
+    memset(value,'x',size);
+    total = (long long)(gb*1024*1024*1024);
+
+    for (zerocopy = 0; zerocopy <= 1; zerocopy++) {
+        if ((cpu = run(host,port,zerocopy,value,size,total,depth,&usec)) < 0)
+            return 1;
+        printf("%-9s %.3f CPU s/GB, %.0f MB/s\n",zerocopy ? "zerocopy" : "copy",
+               cpu*(1024.0*1024*1024)/total,(double)total*1e6/usec/(1024*1024));
+    }
+    free(value);
+    return 0;
+}